@@ -10,9 +10,16 @@
 
 void ExampleApplication::start(ITOXEngine *engine) {
   // todo generate geomety here
+  ModelOptions options;
+  options.format = VertexFormat::Snorm16;
+  options.optimize = true;
+  options.lodCount = 4;
   engine->loadModel("../resources/models/viking_room.obj",
-                    "../resources/textures/viking_room.png");
-  engine->loadRTXModel("../resources/models/CornellBox-Original.obj");
+                    "../resources/textures/viking_room.png", options);
+  engine->addModelInstance(glm::mat4(1.0f));
+  uint32_t box =
+      engine->loadRTXModel("../resources/models/CornellBox-Original.obj");
+  engine->addRTXInstance(box, glm::mat4(1.0f));
 }
 
 // rotate the Rasterizer Model
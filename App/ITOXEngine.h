@@ -16,6 +16,24 @@ struct UniformBufferObject {
   alignas(16) glm::mat4 proj;
 };
 
+// vertex layout of a rasterized model, the 16 bit formats store positions
+// relative to the mesh bounds and drop the color stream
+enum class VertexFormat { Float32, Half16, Snorm16 };
+
+// storage of a model's texture on the gpu, block compressed formats fall
+// back to Rgba8 on devices without support
+enum class TextureFormat { Rgba8, Bc1, Bc5, Bc7 };
+
+struct ModelOptions {
+  VertexFormat format = VertexFormat::Float32;
+  // reorder triangles and vertices for vertex cache, overdraw and fetch
+  bool optimize = false;
+  // levels of detail including the full mesh, each level aims for a
+  // quarter of the triangles of the previous one
+  uint32_t lodCount = 1;
+  TextureFormat textureFormat = TextureFormat::Bc7;
+};
+
 class ITOXEngine {
 public:
   ITOXEngine(IApp &app) : app(app) {}
@@ -25,10 +43,27 @@ public:
 
   // currently only supported in IApp::start()   -------------
   virtual void loadModel(const std::string modelPath,
-                         const std::string texturePath) = 0;
-  virtual void loadRTXModel(const std::string path) = 0;
+                         const std::string texturePath,
+                         const ModelOptions &options = ModelOptions()) = 0;
+  // returns the model index, a model is only ray traced through its
+  // instances
+  virtual uint32_t loadRTXModel(const std::string path) = 0;
   // ---------------------------------------------------------
 
+  // returns the object index, the rasterized model is only drawn through
+  // its objects
+  virtual uint32_t addModelInstance(const glm::mat4 &transform) = 0;
+  // the object's model matrix, applied before the uniform buffer's
+  virtual void setModelInstanceTransform(uint32_t object,
+                                         const glm::mat4 &transform) = 0;
+
+  // returns the instance index
+  virtual uint32_t addRTXInstance(uint32_t model,
+                                  const glm::mat4 &transform) = 0;
+  // the instance's model matrix, the tlas is refitted on the next frame
+  virtual void setRTXInstanceTransform(uint32_t instance,
+                                       const glm::mat4 &transform) = 0;
+
   IApp &app;
 };
 
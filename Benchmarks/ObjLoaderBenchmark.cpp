@@ -0,0 +1,199 @@
+#include "../Engine/ObjLoader.h"
+
+#include <tiny_obj_loader.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Compares ObjLoader against tinyobj::LoadObj, the loader it replaces.
+// Every file is parsed by both, checked for identical output and timed
+// over a few runs. Without arguments a scan sized grid mixing triangles,
+// quads and materials is generated first.
+//
+//   ObjLoaderBenchmark [file.obj ...] [--mtl <dir>] [--runs <count>]
+
+namespace {
+
+struct Mesh {
+  std::vector<float> positions;
+  std::vector<float> texcoords;
+  std::vector<float> normals;
+  std::vector<ObjLoader::Index> indices;
+  std::vector<int> materialIds;
+  size_t materialCount;
+};
+
+Mesh loadTinyObj(const std::string &path, const std::string &mtlBaseDir) {
+  tinyobj::attrib_t attrib;
+  std::vector<tinyobj::shape_t> shapes;
+  std::vector<tinyobj::material_t> materials;
+  std::string warn, err;
+  if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
+                        path.c_str(),
+                        mtlBaseDir.empty() ? nullptr : mtlBaseDir.c_str())) {
+    throw std::runtime_error(warn + err);
+  }
+
+  Mesh mesh{std::move(attrib.vertices), std::move(attrib.texcoords),
+            std::move(attrib.normals), {}, {}, materials.size()};
+  for (const auto &shape : shapes) {
+    for (const auto &index : shape.mesh.indices) {
+      mesh.indices.push_back(
+          {index.vertex_index, index.texcoord_index, index.normal_index});
+    }
+    mesh.materialIds.insert(mesh.materialIds.end(),
+                            shape.mesh.material_ids.begin(),
+                            shape.mesh.material_ids.end());
+  }
+  return mesh;
+}
+
+Mesh loadObjLoader(const std::string &path, const std::string &mtlBaseDir) {
+  ObjLoader obj(path, mtlBaseDir);
+  return {std::move(obj.positions), std::move(obj.texcoords),
+          std::move(obj.normals),   std::move(obj.indices),
+          std::move(obj.materialIds), obj.materials.size()};
+}
+
+bool identical(const Mesh &a, const Mesh &b) {
+  auto sameIndex = [](const ObjLoader::Index &x, const ObjLoader::Index &y) {
+    return x.vertex == y.vertex && x.texcoord == y.texcoord &&
+           x.normal == y.normal;
+  };
+  return a.positions == b.positions && a.texcoords == b.texcoords &&
+         a.normals == b.normals &&
+         std::equal(a.indices.begin(), a.indices.end(), b.indices.begin(),
+                    b.indices.end(), sameIndex) &&
+         a.materialIds == b.materialIds && a.materialCount == b.materialCount;
+}
+
+// fastest of the runs in milliseconds
+double time(int runs, const std::function<void()> &fn) {
+  double best = 0.0;
+  for (int i = 0; i < runs; i++) {
+    auto start = std::chrono::high_resolution_clock::now();
+    fn();
+    double milliseconds =
+        std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - start)
+            .count();
+    best = i == 0 ? milliseconds : std::min(best, milliseconds);
+  }
+  return best;
+}
+
+// a noisy height field of size x size vertices, one in three cells is a
+// quad and the rows switch between three materials
+std::string generate(const std::string &dir, int size) {
+  std::filesystem::create_directories(dir);
+  {
+    std::ofstream mtl(dir + "/benchmark.mtl");
+    mtl << "newmtl red\nKd 1 0 0\nnewmtl green\nKd 0 1 0\n"
+           "newmtl light\nKd 1 1 1\nKe 4 4 4\n";
+  }
+
+  std::string path = dir + "/benchmark.obj";
+  std::ofstream obj(path);
+  obj << "mtllib benchmark.mtl\n";
+
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> noise(-0.01f, 0.01f);
+  char line[128];
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      snprintf(line, sizeof(line), "v %f %f %f\n", x / float(size),
+               noise(random), y / float(size));
+      obj << line;
+      snprintf(line, sizeof(line), "vt %f %f\n", x / float(size),
+               y / float(size));
+      obj << line;
+      snprintf(line, sizeof(line), "vn %f %f %f\n", noise(random), 1.0f,
+               noise(random));
+      obj << line;
+    }
+  }
+
+  const char *materials[] = {"red", "green", "light"};
+  for (int y = 0; y + 1 < size; y++) {
+    obj << "usemtl " << materials[y % 3] << "\n";
+    for (int x = 0; x + 1 < size; x++) {
+      int a = y * size + x + 1;
+      int b = a + 1;
+      int c = a + size + 1;
+      int d = a + size;
+      if (x % 3 == 0) {
+        snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n",
+                 a, a, a, b, b, b, c, c, c, d, d, d);
+        obj << line;
+      } else {
+        snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a,
+                 a, b, b, b, c, c, c);
+        obj << line;
+        snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a,
+                 a, c, c, c, d, d, d);
+        obj << line;
+      }
+    }
+  }
+  return path;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::vector<std::string> paths;
+  std::string mtlBaseDir;
+  int runs = 3;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--mtl" && i + 1 < argc) {
+      mtlBaseDir = argv[++i];
+    } else if (arg == "--runs" && i + 1 < argc) {
+      runs = std::max(1, std::atoi(argv[++i]));
+    } else {
+      paths.push_back(arg);
+    }
+  }
+
+  if (paths.empty()) {
+    std::string dir =
+        (std::filesystem::temp_directory_path() / "toxengine-benchmark")
+            .string();
+    std::cout << "generating " << dir << "/benchmark.obj" << std::endl;
+    paths.push_back(generate(dir, 1000));
+    mtlBaseDir = dir;
+  }
+
+  bool failed = false;
+  for (const auto &path : paths) {
+    double megabytes = std::filesystem::file_size(path) / (1024.0 * 1024.0);
+
+    Mesh reference, mesh;
+    double tinyobjTime =
+        time(runs, [&] { reference = loadTinyObj(path, mtlBaseDir); });
+    double objLoaderTime =
+        time(runs, [&] { mesh = loadObjLoader(path, mtlBaseDir); });
+
+    bool same = identical(reference, mesh);
+    failed |= !same;
+
+    printf("%s: %.1f MB, %zu triangles\n", path.c_str(), megabytes,
+           reference.materialIds.size());
+    printf("  tinyobj   %8.1f ms %8.1f MB/s\n", tinyobjTime,
+           megabytes / tinyobjTime * 1000.0);
+    printf("  ObjLoader %8.1f ms %8.1f MB/s  %.1fx%s\n", objLoaderTime,
+           megabytes / objLoaderTime * 1000.0, tinyobjTime / objLoaderTime,
+           same ? "" : "  OUTPUT DIFFERS");
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
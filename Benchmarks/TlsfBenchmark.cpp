@@ -0,0 +1,158 @@
+#include "../Engine/Tlsf.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// Stress test of the TLSF allocator behind MemoryAllocator's blocks. A
+// random mix of allocations and frees runs twice over the same range:
+// once checked against a map of the live ranges (no overlap, offsets
+// aligned, everything coalescing back into one region once freed) and once
+// timed without the checks.
+//
+//   TlsfBenchmark [--ops <count>] [--seed <seed>]
+
+namespace {
+
+constexpr uint64_t RANGE = 256ull << 20;
+constexpr size_t MAX_LIVE = 2048;
+
+struct Op {
+  uint64_t size;
+  uint64_t alignment;
+  bool allocate;
+  uint32_t victim; // which live allocation a free picks
+};
+
+// sizes are log uniform between 256 B and 4 MiB like buffers and images,
+// alignments between 256 B and 64 KiB
+std::vector<Op> generate(size_t count, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<double> logSize(8.0, 22.0);
+  std::uniform_int_distribution<int> alignmentBits(8, 16);
+  std::uniform_int_distribution<uint32_t> victim;
+  std::bernoulli_distribution allocate(0.5);
+
+  std::vector<Op> ops(count);
+  for (auto &op : ops) {
+    op.size = static_cast<uint64_t>(std::exp2(logSize(random)));
+    op.alignment = uint64_t(1) << alignmentBits(random);
+    op.allocate = allocate(random);
+    op.victim = victim(random);
+  }
+  return ops;
+}
+
+struct Live {
+  uint32_t region;
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct Result {
+  size_t allocations = 0;
+  size_t failures = 0;
+  size_t peakLive = 0;
+  uint64_t peakUsed = 0;
+  bool valid = true;
+};
+
+// a free of a random live allocation, or an allocation, keeping between
+// none and MAX_LIVE allocations alive
+template <bool CHECKED> Result run(const std::vector<Op> &ops) {
+  Tlsf tlsf(RANGE);
+  std::vector<Live> live;
+  live.reserve(MAX_LIVE);
+  std::map<uint64_t, uint64_t> ranges; // offset -> end, checked runs only
+  Result result;
+
+  for (const auto &op : ops) {
+    bool allocate = live.empty() || (live.size() < MAX_LIVE && op.allocate);
+    if (allocate) {
+      uint64_t offset;
+      uint32_t region = tlsf.allocate(op.size, op.alignment, offset);
+      if (region == Tlsf::INVALID) {
+        result.failures++;
+        continue;
+      }
+      result.allocations++;
+      live.push_back({region, offset, op.size});
+
+      if (CHECKED) {
+        uint64_t end = offset + op.size;
+        auto next = ranges.lower_bound(offset);
+        bool overlaps = (next != ranges.end() && next->first < end) ||
+                        (next != ranges.begin() &&
+                         std::prev(next)->second > offset);
+        if (overlaps || offset % op.alignment != 0 || end > RANGE) {
+          result.valid = false;
+        }
+        ranges[offset] = end;
+      }
+    } else {
+      size_t index = op.victim % live.size();
+      tlsf.free(live[index].region);
+      if (CHECKED) {
+        ranges.erase(live[index].offset);
+      }
+      live[index] = live.back();
+      live.pop_back();
+    }
+
+    result.peakLive = std::max(result.peakLive, live.size());
+    result.peakUsed = std::max(result.peakUsed, tlsf.getUsed());
+  }
+
+  for (const auto &allocation : live) {
+    tlsf.free(allocation.region);
+  }
+  if (CHECKED && (tlsf.getAllocationCount() != 0 || tlsf.getUsed() != 0 ||
+                  tlsf.getFreeRegionCount() != 1 ||
+                  tlsf.getLargestFree() != tlsf.getSize())) {
+    result.valid = false;
+  }
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t count = 2000000;
+  uint32_t seed = 42;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string arg = argv[i];
+    if (arg == "--ops") {
+      count = std::strtoull(argv[i + 1], nullptr, 10);
+    } else if (arg == "--seed") {
+      seed = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+    }
+  }
+
+  std::vector<Op> ops = generate(count, seed);
+
+  Result checked = run<true>(ops);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  Result timed = run<false>(ops);
+  double nanoseconds = std::chrono::duration<double, std::nano>(
+                           std::chrono::high_resolution_clock::now() - start)
+                           .count();
+
+  printf("%zu ops on %llu MiB: %zu allocations, %zu failed\n", ops.size(),
+         static_cast<unsigned long long>(RANGE >> 20), timed.allocations,
+         timed.failures);
+  printf("  peak %zu live allocations, %llu MiB used\n", timed.peakLive,
+         static_cast<unsigned long long>(timed.peakUsed >> 20));
+  printf("  %.1f ns per op\n", nanoseconds / ops.size());
+  printf("  %s\n", checked.valid ? "no overlaps, fully coalesced"
+                                 : "INVALID ALLOCATOR STATE");
+
+  return checked.valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,194 @@
+#include "../Engine/ObjLoader.h"
+#include "../Engine/VertexDedup.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Compares VertexDedup against the std::unordered_map<Vertex, uint32_t>
+// loop Model::load used before it. Both number the unique vertices of the
+// same corner stream, the results are checked to agree and the fastest of
+// a few runs is reported. Without arguments grids of triangle corners are
+// generated, small enough for the table and large enough for the sort.
+//
+//   VertexDedupBenchmark [file.obj ...] [--runs <count>]
+
+namespace {
+
+// same layout as Vertex, without GLM
+struct Vertex {
+  float pos[3];
+  float color[3];
+  float texCoord[2];
+
+  bool operator==(const Vertex &other) const {
+    return std::equal(pos, pos + 3, other.pos) &&
+           std::equal(color, color + 3, other.color) &&
+           std::equal(texCoord, texCoord + 2, other.texCoord);
+  }
+};
+
+// the removed std::hash<Vertex>, with glm's hash_combine of the components
+// written out
+void hashCombine(size_t &seed, size_t hash) {
+  hash += 0x9e3779b9 + (seed << 6) + (seed >> 2);
+  seed ^= hash;
+}
+
+size_t hashFloats(const float *values, int count) {
+  size_t seed = 0;
+  for (int i = 0; i < count; i++) {
+    hashCombine(seed, std::hash<float>()(values[i]));
+  }
+  return seed;
+}
+
+struct LegacyHash {
+  size_t operator()(const Vertex &vertex) const {
+    return ((hashFloats(vertex.pos, 3) ^ (hashFloats(vertex.color, 3) << 1)) >>
+            1) ^
+           (hashFloats(vertex.texCoord, 2) << 1);
+  }
+};
+
+// the loop Model::load ran, two lookups per corner
+void dedupMap(const std::vector<Vertex> &corners, std::vector<Vertex> &vertices,
+              std::vector<uint32_t> &indices) {
+  std::unordered_map<Vertex, uint32_t, LegacyHash> uniqueVertices{};
+  for (const auto &vertex : corners) {
+    if (uniqueVertices.count(vertex) == 0) {
+      uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
+      vertices.push_back(vertex);
+    }
+    indices.push_back(uniqueVertices[vertex]);
+  }
+}
+
+// corners like Model::load builds them
+std::vector<Vertex> loadCorners(const std::string &path) {
+  ObjLoader obj(path);
+  std::vector<Vertex> corners(obj.indices.size());
+  for (size_t i = 0; i < obj.indices.size(); i++) {
+    const auto &index = obj.indices[i];
+    Vertex &vertex = corners[i];
+    for (int axis = 0; axis < 3; axis++) {
+      vertex.pos[axis] = obj.positions[3 * index.vertex + axis];
+      vertex.color[axis] = 1.0f;
+    }
+    if (index.texcoord >= 0) {
+      vertex.texCoord[0] = obj.texcoords[2 * index.texcoord + 0];
+      vertex.texCoord[1] = 1.0f - obj.texcoords[2 * index.texcoord + 1];
+    } else {
+      vertex.texCoord[0] = vertex.texCoord[1] = 0.0f;
+    }
+  }
+  return corners;
+}
+
+// two triangles per cell of a size x size grid of noisy heights, about six
+// corners per unique vertex
+std::vector<Vertex> generateCorners(int size) {
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> noise(0.0f, 0.01f);
+  std::vector<Vertex> grid(size * size);
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      grid[y * size + x] = {{x / float(size), noise(random), y / float(size)},
+                            {1.0f, 1.0f, 1.0f},
+                            {x / float(size), y / float(size)}};
+    }
+  }
+
+  std::vector<Vertex> corners;
+  corners.reserve(6 * (size - 1) * (size - 1));
+  for (int y = 0; y + 1 < size; y++) {
+    for (int x = 0; x + 1 < size; x++) {
+      int a = y * size + x;
+      int b = a + 1;
+      int c = a + size + 1;
+      int d = a + size;
+      for (int corner : {a, b, c, a, c, d}) {
+        corners.push_back(grid[corner]);
+      }
+    }
+  }
+  return corners;
+}
+
+// fastest of the runs in milliseconds
+double time(int runs, const std::function<void()> &fn) {
+  double best = 0.0;
+  for (int i = 0; i < runs; i++) {
+    auto start = std::chrono::high_resolution_clock::now();
+    fn();
+    double milliseconds =
+        std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - start)
+            .count();
+    best = i == 0 ? milliseconds : std::min(best, milliseconds);
+  }
+  return best;
+}
+
+bool run(const std::string &name, const std::vector<Vertex> &corners,
+         int runs) {
+  std::vector<Vertex> mapVertices;
+  std::vector<uint32_t> mapIndices;
+  double mapTime = time(runs, [&] {
+    mapVertices.clear();
+    mapIndices.clear();
+    dedupMap(corners, mapVertices, mapIndices);
+  });
+
+  std::vector<uint32_t> remap;
+  double dedupTime = time(runs, [&] {
+    VertexDedup dedup(corners.data(), corners.size(), sizeof(Vertex));
+    remap = std::move(dedup.remap);
+  });
+
+  // vertices are compared bytewise now, only +0.0 and -0.0 may split
+  bool same = remap == mapIndices;
+
+  printf("%s: %zu corners, %zu unique\n", name.c_str(), corners.size(),
+         mapVertices.size());
+  printf("  unordered_map %8.1f ms\n", mapTime);
+  printf("  VertexDedup   %8.1f ms  %.1fx%s\n", dedupTime, mapTime / dedupTime,
+         same ? "" : "  OUTPUT DIFFERS");
+  return same;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::vector<std::string> paths;
+  int runs = 3;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--runs" && i + 1 < argc) {
+      runs = std::max(1, std::atoi(argv[++i]));
+    } else {
+      paths.push_back(arg);
+    }
+  }
+
+  bool failed = false;
+  if (paths.empty()) {
+    for (int size : {130, 400, 710}) {
+      std::string name = "grid " + std::to_string(size) + "x" +
+                         std::to_string(size);
+      failed |= !run(name, generateCorners(size), runs);
+    }
+  }
+  for (const auto &path : paths) {
+    failed |= !run(path, loadCorners(path), runs);
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -2,12 +2,25 @@
 
 #include "Buffer.h"
 #include "Context.h"
+#include "ThreadPool.h"
 #include <memory>
+#include <stdexcept>
 
 AccelerationStructure::AccelerationStructure(
     Context &context, VkAccelerationStructureGeometryKHR geometry,
-    uint32_t primitiveCount, VkAccelerationStructureTypeKHR type)
-    : context(context) {
+    uint32_t primitiveCount, VkAccelerationStructureTypeKHR type, Build build,
+    bool compact)
+    : context(context), type(type), host(build == Build::Host),
+      compact(compact) {
+  VkAccelerationStructureBuildTypeKHR buildType =
+      host ? VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR
+           : VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR;
+
+  if (host) {
+    hostBuild = std::make_unique<HostBuild>();
+    hostBuild->geometry = geometry;
+  }
+
   VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo{};
   buildGeometryInfo.sType =
       VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
@@ -15,32 +28,22 @@ AccelerationStructure::AccelerationStructure(
   buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
   buildGeometryInfo.flags =
       VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+  if (compact) {
+    buildGeometryInfo.flags |=
+        VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+  }
   buildGeometryInfo.geometryCount = 1;
-  buildGeometryInfo.pGeometries = &geometry;
+  buildGeometryInfo.pGeometries = host ? &hostBuild->geometry : &geometry;
 
-  VkAccelerationStructureBuildSizesInfoKHR buildSizesInfo;
+  VkAccelerationStructureBuildSizesInfoKHR buildSizesInfo{};
   buildSizesInfo.sType =
       VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
-  vkGetAccelerationStructureBuildSizesKHR(
-      context.device->get(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-      &buildGeometryInfo, &primitiveCount, &buildSizesInfo);
-
-  buffer = std::make_unique<Buffer>(context, Buffer::Type::AccelStorage,
-                                    buildSizesInfo.accelerationStructureSize);
-
-  VkAccelerationStructureCreateInfoKHR asCreateInfo{};
-  asCreateInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-  asCreateInfo.buffer = buffer->get();
-  asCreateInfo.size = buildSizesInfo.accelerationStructureSize;
-  asCreateInfo.type = type;
-
-  vkCreateAccelerationStructureKHR(context.device->get(), &asCreateInfo,
-                                   nullptr, &accel);
+  vkGetAccelerationStructureBuildSizesKHR(context.device->get(), buildType,
+                                          &buildGeometryInfo, &primitiveCount,
+                                          &buildSizesInfo);
 
-  scratch = std::make_unique<Buffer>(context, Buffer::Type::Scratch,
-                                     buildSizesInfo.buildScratchSize);
+  createStorage(buildSizesInfo.accelerationStructureSize);
 
-  buildGeometryInfo.scratchData.deviceAddress = scratch->getDeviceAddress();
   buildGeometryInfo.dstAccelerationStructure = accel;
 
   VkAccelerationStructureBuildRangeInfoKHR offset{};
@@ -49,15 +52,91 @@ AccelerationStructure::AccelerationStructure(
   offset.primitiveOffset = 0;
   offset.transformOffset = 0;
 
+  accelInfo.sType =
+      VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+  accelInfo.accelerationStructureCount = 1;
+  accelInfo.pAccelerationStructures = &accel;
+
+  if (host) {
+    hostBuild->scratch.resize(buildSizesInfo.buildScratchSize);
+    buildGeometryInfo.scratchData.hostAddress = hostBuild->scratch.data();
+    hostBuild->buildGeometryInfo = buildGeometryInfo;
+    hostBuild->range = offset;
+    hostBuild->operation =
+        std::make_unique<DeferredOperation>(context.device->get());
+
+    const VkAccelerationStructureBuildRangeInfoKHR *p_range =
+        &hostBuild->range;
+    VkResult result = vkBuildAccelerationStructuresKHR(
+        context.device->get(), hostBuild->operation->get(), 1,
+        &hostBuild->buildGeometryInfo, &p_range);
+    hostBuild->operation->start(result, ThreadPool::shared().size());
+    return;
+  }
+
+  // only needed while building
+  Buffer scratch(context, Buffer::Type::Scratch,
+                 buildSizesInfo.buildScratchSize);
+
+  buildGeometryInfo.scratchData.deviceAddress = scratch.getDeviceAddress();
+
   VkAccelerationStructureBuildRangeInfoKHR *p_offset = &offset;
 
+  VkQueryPool queryPool = VK_NULL_HANDLE;
+  if (compact) {
+    VkQueryPoolCreateInfo queryPoolInfo{};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType =
+        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+    queryPoolInfo.queryCount = 1;
+    if (vkCreateQueryPool(context.device->get(), &queryPoolInfo, nullptr,
+                          &queryPool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create query pool!");
+    }
+  }
+
   VkCommandBuffer commandBuffer = context.device->beginSingleTimeCommands();
 
   vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildGeometryInfo,
                                       &p_offset);
 
+  if (compact) {
+    // the compacted size is written once the build is done
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier,
+        0, nullptr, 0, nullptr);
+    vkCmdResetQueryPool(commandBuffer, queryPool, 0, 1);
+    vkCmdWriteAccelerationStructuresPropertiesKHR(
+        commandBuffer, 1, &accel,
+        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, 0);
+  }
+
   context.device->endSingleTimeCommands(commandBuffer);
 
+  if (compact) {
+    VkDeviceSize compactedSize = 0;
+    if (vkGetQueryPoolResults(context.device->get(), queryPool, 0, 1,
+                              sizeof(compactedSize), &compactedSize,
+                              sizeof(compactedSize),
+                              VK_QUERY_RESULT_64_BIT |
+                                  VK_QUERY_RESULT_WAIT_BIT) != VK_SUCCESS) {
+      compactedSize = 0;
+    }
+    vkDestroyQueryPool(context.device->get(), queryPool, nullptr);
+    compactStorage(compactedSize);
+  }
+}
+
+AccelerationStructure::AccelerationStructure(
+    Context &context, VkAccelerationStructureTypeKHR type, VkDeviceSize size)
+    : context(context), type(type), host(false), compact(false) {
+  createStorage(size);
+
   accelInfo.sType =
       VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
   accelInfo.accelerationStructureCount = 1;
@@ -65,5 +144,92 @@ AccelerationStructure::AccelerationStructure(
 }
 
 AccelerationStructure::~AccelerationStructure() {
+  // a host build still writes to it
+  hostBuild.reset();
   vkDestroyAccelerationStructureKHR(context.device->get(), accel, nullptr);
 }
+
+void AccelerationStructure::createStorage(VkDeviceSize size) {
+  this->size = size;
+  Buffer::Type storage =
+      host ? Buffer::Type::AccelStorageHost : Buffer::Type::AccelStorage;
+  buffer = std::make_unique<Buffer>(context, storage, size);
+
+  VkAccelerationStructureCreateInfoKHR asCreateInfo{};
+  asCreateInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+  asCreateInfo.buffer = buffer->get();
+  asCreateInfo.size = size;
+  asCreateInfo.type = type;
+
+  if (vkCreateAccelerationStructureKHR(context.device->get(), &asCreateInfo,
+                                       nullptr, &accel) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create acceleration structure!");
+  }
+}
+
+VkDeviceSize AccelerationStructure::queryHostCompactedSize() {
+  VkDeviceSize compactedSize = 0;
+  if (vkWriteAccelerationStructuresPropertiesKHR(
+          context.device->get(), 1, &accel,
+          VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+          sizeof(compactedSize), &compactedSize,
+          sizeof(compactedSize)) != VK_SUCCESS) {
+    return 0;
+  }
+  return compactedSize;
+}
+
+void AccelerationStructure::compactStorage(VkDeviceSize compactedSize) {
+  if (compactedSize == 0 || compactedSize >= size) {
+    return;
+  }
+
+  VkAccelerationStructureKHR original = accel;
+  std::unique_ptr<Buffer> originalBuffer = std::move(buffer);
+  createStorage(compactedSize);
+
+  VkCopyAccelerationStructureInfoKHR copyInfo{};
+  copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+  copyInfo.src = original;
+  copyInfo.dst = accel;
+  copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+
+  if (host) {
+    // a plain copy, not worth deferring
+    if (vkCopyAccelerationStructureKHR(context.device->get(), VK_NULL_HANDLE,
+                                       &copyInfo) != VK_SUCCESS) {
+      throw std::runtime_error("failed to compact acceleration structure!");
+    }
+  } else {
+    VkCommandBuffer commandBuffer = context.device->beginSingleTimeCommands();
+    vkCmdCopyAccelerationStructureKHR(commandBuffer, &copyInfo);
+    context.device->endSingleTimeCommands(commandBuffer);
+  }
+
+  vkDestroyAccelerationStructureKHR(context.device->get(), original, nullptr);
+  originalBuffer.reset();
+}
+
+void AccelerationStructure::wait() {
+  if (!hostBuild) {
+    return;
+  }
+
+  VkResult result = hostBuild->operation->wait();
+  hostBuild.reset();
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to build acceleration structure!");
+  }
+
+  if (compact) {
+    compactStorage(queryHostCompactedSize());
+  }
+}
+VkDeviceAddress AccelerationStructure::getDeviceAddress() {
+  VkAccelerationStructureDeviceAddressInfoKHR addressInfo{};
+  addressInfo.sType =
+      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+  addressInfo.accelerationStructure = accel;
+  return vkGetAccelerationStructureDeviceAddressKHR(context.device->get(),
+                                                    &addressInfo);
+}
@@ -2,30 +2,75 @@
 #define TOXENGINE_ENGINE_ACCELERATIONSTRUCTURE_H_
 
 #include "Buffer.h"
+#include "DeferredOperation.h"
 
 #include <vulkan/vulkan.h>
 
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 class Context;
 
 class AccelerationStructure {
 public:
+  enum class Build {
+    Device,
+    // the geometry holds host addresses, the build runs on the shared
+    // thread pool and needs accelerationStructureHostCommands
+    Host
+  };
+
+  // compacted structures are copied into a right sized buffer once built,
+  // worth it for static geometry
   AccelerationStructure(Context &context,
                         VkAccelerationStructureGeometryKHR geometry,
                         uint32_t primitiveCount,
-                        VkAccelerationStructureTypeKHR type);
+                        VkAccelerationStructureTypeKHR type,
+                        Build build = Build::Device, bool compact = false);
   ~AccelerationStructure();
 
+  // blocks until a host build is done, its geometry data has to stay
+  // valid until then
+  void wait();
+
+  VkDeviceAddress getDeviceAddress();
+  VkDeviceSize getSize() { return size; }
+
   std::unique_ptr<Buffer> buffer;
 
   VkAccelerationStructureKHR accel;
   VkWriteDescriptorSetAccelerationStructureKHR accelInfo;
 
 private:
+  friend class AccelerationStructureBuilder;
+  friend class Scene;
+
+  // storage only, the builder records the build
+  AccelerationStructure(Context &context, VkAccelerationStructureTypeKHR type,
+                        VkDeviceSize size);
+
   Context &context;
-  std::unique_ptr<Buffer> scratch;
+  VkAccelerationStructureTypeKHR type;
+  bool host;
+  bool compact;
+  VkDeviceSize size;
+
+  void createStorage(VkDeviceSize size);
+  // replaces accel and buffer with a right sized copy of the built one,
+  // device builds query the size in their build command buffer
+  void compactStorage(VkDeviceSize compactedSize);
+  VkDeviceSize queryHostCompactedSize();
+
+  // a host build still running, referenced by its build info
+  struct HostBuild {
+    VkAccelerationStructureGeometryKHR geometry;
+    VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo;
+    VkAccelerationStructureBuildRangeInfoKHR range;
+    std::vector<uint8_t> scratch;
+    std::unique_ptr<DeferredOperation> operation;
+  };
+  std::unique_ptr<HostBuild> hostBuild;
 };
 
 #endif // TOXENGINE_ENGINE_ACCELERATIONSTRUCTURE_H_
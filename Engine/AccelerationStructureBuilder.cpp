@@ -0,0 +1,466 @@
+#include "AccelerationStructureBuilder.h"
+
+#include "Buffer.h"
+#include "Context.h"
+#include "Hash.h"
+#include "MappedFile.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// orders a batch's builds after the previous batch's, they reuse its
+// scratch memory
+void buildBarrier(VkCommandBuffer commandBuffer) {
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+  barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+                          VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+  vkCmdPipelineBarrier(
+      commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+      VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier,
+      0, nullptr, 0, nullptr);
+}
+
+} // namespace
+
+AccelerationStructureBuilder::AccelerationStructureBuilder(Context &context)
+    : context(context) {
+  VkPhysicalDeviceAccelerationStructurePropertiesKHR asProperties{};
+  asProperties.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+  VkPhysicalDeviceProperties2 properties{};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &asProperties;
+  vkGetPhysicalDeviceProperties2(context.physicalDevice->get(), &properties);
+  scratchAlignment = std::max<VkDeviceSize>(
+      asProperties.minAccelerationStructureScratchOffsetAlignment, 1);
+}
+
+std::unique_ptr<AccelerationStructure>
+AccelerationStructureBuilder::add(
+    const VkAccelerationStructureGeometryKHR &geometry,
+    uint32_t primitiveCount, bool compact) {
+  VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo{};
+  buildGeometryInfo.sType =
+      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+  buildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+  buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+  buildGeometryInfo.flags =
+      VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+  if (compact) {
+    buildGeometryInfo.flags |=
+        VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+  }
+  buildGeometryInfo.geometryCount = 1;
+  buildGeometryInfo.pGeometries = &geometry;
+
+  VkAccelerationStructureBuildSizesInfoKHR buildSizesInfo{};
+  buildSizesInfo.sType =
+      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+  vkGetAccelerationStructureBuildSizesKHR(
+      context.device->get(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+      &buildGeometryInfo, &primitiveCount, &buildSizesInfo);
+
+  std::unique_ptr<AccelerationStructure> structure(new AccelerationStructure(
+      context, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+      buildSizesInfo.accelerationStructureSize));
+
+  Entry entry{};
+  entry.structure = structure.get();
+  entry.geometry = geometry;
+  entry.range.primitiveCount = primitiveCount;
+  entry.scratchSize =
+      alignUp(buildSizesInfo.buildScratchSize, scratchAlignment);
+  entry.compact = compact;
+  entries.push_back(entry);
+
+  return structure;
+}
+
+std::unique_ptr<AccelerationStructure>
+AccelerationStructureBuilder::load(const std::string &path, uint64_t key) {
+  MappedFile file(path);
+  if (!file.isOpen()) {
+    return nullptr;
+  }
+
+  Header header;
+  if (file.size() < sizeof(header)) {
+    return nullptr;
+  }
+  memcpy(&header, file.data(), sizeof(header));
+  const uint8_t *data = file.data() + sizeof(header);
+  // the serialized data starts with the driver and compatibility uuids,
+  // followed by its serialized and deserialized size
+  const VkDeviceSize prefix = 2 * VK_UUID_SIZE + 2 * sizeof(uint64_t);
+  if (header.magic != MAGIC || header.version != VERSION ||
+      header.key != key || header.dataSize != file.size() - sizeof(header) ||
+      header.dataSize < prefix ||
+      hash::bytes(data, header.dataSize) != header.dataHash) {
+    if (enableStats) {
+      std::cout << "acceleration structure cache: " << path << " is stale"
+                << std::endl;
+    }
+    return nullptr;
+  }
+
+  VkAccelerationStructureVersionInfoKHR versionInfo{};
+  versionInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR;
+  versionInfo.pVersionData = data;
+  VkAccelerationStructureCompatibilityKHR compatibility;
+  vkGetDeviceAccelerationStructureCompatibilityKHR(
+      context.device->get(), &versionInfo, &compatibility);
+  if (compatibility != VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR) {
+    if (enableStats) {
+      std::cout << "acceleration structure cache: " << path
+                << " was written by another device or driver" << std::endl;
+    }
+    return nullptr;
+  }
+
+  uint64_t deserializedSize;
+  memcpy(&deserializedSize, data + 2 * VK_UUID_SIZE + sizeof(uint64_t),
+         sizeof(deserializedSize));
+
+  std::unique_ptr<AccelerationStructure> structure(new AccelerationStructure(
+      context, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+      deserializedSize));
+
+  Restore pending{};
+  pending.structure = structure.get();
+  pending.data = std::make_unique<Buffer>(
+      context, Buffer::Type::AccelInput,
+      header.dataSize + SERIALIZED_ALIGNMENT);
+  VkDeviceAddress address = pending.data->getDeviceAddress();
+  pending.address = alignUp(address, SERIALIZED_ALIGNMENT);
+  pending.data->upload(data, header.dataSize, pending.address - address);
+  restores.push_back(std::move(pending));
+
+  return structure;
+}
+
+void AccelerationStructureBuilder::save(AccelerationStructure &structure,
+                                        const std::string &path,
+                                        uint64_t key) {
+  saves.push_back({&structure, path, key});
+}
+
+void AccelerationStructureBuilder::build() {
+  if (!restores.empty()) {
+    restore();
+  }
+  if (!entries.empty()) {
+    buildEntries();
+  }
+  if (!saves.empty()) {
+    serialize();
+  }
+}
+
+void AccelerationStructureBuilder::restore() {
+  VkCommandBuffer commandBuffer = context.device->beginSingleTimeCommands();
+  for (const Restore &pending : restores) {
+    VkCopyMemoryToAccelerationStructureInfoKHR copyInfo{};
+    copyInfo.sType =
+        VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR;
+    copyInfo.src.deviceAddress = pending.address;
+    copyInfo.dst = pending.structure->accel;
+    copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+    vkCmdCopyMemoryToAccelerationStructureKHR(commandBuffer, &copyInfo);
+  }
+  context.device->endSingleTimeCommands(commandBuffer);
+
+  if (enableStats) {
+    std::cout << "restored " << restores.size()
+              << " acceleration structures from disk" << std::endl;
+  }
+  restores.clear();
+}
+
+void AccelerationStructureBuilder::buildEntries() {
+  // the builds read the uploaded vertex and index buffers
+  context.device->getUploader().flush();
+
+  VkDeviceSize largest = 0;
+  VkDeviceSize total = 0;
+  for (const Entry &entry : entries) {
+    largest = std::max(largest, entry.scratchSize);
+    total += entry.scratchSize;
+  }
+  VkDeviceSize arenaSize = std::max(largest, std::min(total, SCRATCH_BUDGET));
+
+  // the buffer address itself only has the allocator's alignment
+  Buffer scratch(context, Buffer::Type::Scratch,
+                 arenaSize + scratchAlignment);
+  VkDeviceAddress scratchAddress =
+      alignUp(scratch.getDeviceAddress(), scratchAlignment);
+
+  std::vector<VkAccelerationStructureBuildGeometryInfoKHR> infos(
+      entries.size());
+  std::vector<const VkAccelerationStructureBuildRangeInfoKHR *> ranges(
+      entries.size());
+  std::vector<size_t> compacted;
+
+  VkCommandBuffer commandBuffer = context.device->beginSingleTimeCommands();
+
+  uint32_t batchCount = 0;
+  size_t first = 0;
+  while (first < entries.size()) {
+    // as many builds as fit into the arena side by side
+    size_t last = first;
+    VkDeviceSize offset = 0;
+    while (last < entries.size() &&
+           offset + entries[last].scratchSize <= arenaSize) {
+      Entry &entry = entries[last];
+
+      VkAccelerationStructureBuildGeometryInfoKHR &info = infos[last];
+      info.sType =
+          VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+      info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+      info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+      info.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+      if (entry.compact) {
+        info.flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+        compacted.push_back(last);
+      }
+      info.geometryCount = 1;
+      info.pGeometries = &entry.geometry;
+      info.dstAccelerationStructure = entry.structure->accel;
+      info.scratchData.deviceAddress = scratchAddress + offset;
+      ranges[last] = &entry.range;
+
+      offset += entry.scratchSize;
+      last++;
+    }
+
+    if (batchCount > 0) {
+      buildBarrier(commandBuffer);
+    }
+    vkCmdBuildAccelerationStructuresKHR(
+        commandBuffer, static_cast<uint32_t>(last - first), &infos[first],
+        &ranges[first]);
+    batchCount++;
+    first = last;
+  }
+
+  VkQueryPool queryPool = VK_NULL_HANDLE;
+  std::vector<VkAccelerationStructureKHR> queried;
+  if (!compacted.empty()) {
+    for (size_t index : compacted) {
+      queried.push_back(entries[index].structure->accel);
+    }
+
+    VkQueryPoolCreateInfo queryPoolInfo{};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType =
+        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+    queryPoolInfo.queryCount = static_cast<uint32_t>(queried.size());
+    if (vkCreateQueryPool(context.device->get(), &queryPoolInfo, nullptr,
+                          &queryPool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create query pool!");
+    }
+
+    buildBarrier(commandBuffer);
+    vkCmdResetQueryPool(commandBuffer, queryPool, 0,
+                        static_cast<uint32_t>(queried.size()));
+    vkCmdWriteAccelerationStructuresPropertiesKHR(
+        commandBuffer, static_cast<uint32_t>(queried.size()), queried.data(),
+        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, 0);
+  }
+
+  context.device->endSingleTimeCommands(commandBuffer);
+
+  if (enableStats) {
+    std::cout << "built " << entries.size() << " acceleration structures in "
+              << batchCount << " batches with " << arenaSize / 1024
+              << " KB of scratch" << std::endl;
+  }
+
+  if (queryPool != VK_NULL_HANDLE) {
+    std::vector<VkDeviceSize> sizes(queried.size());
+    VkResult result = vkGetQueryPoolResults(
+        context.device->get(), queryPool, 0,
+        static_cast<uint32_t>(queried.size()),
+        sizes.size() * sizeof(VkDeviceSize), sizes.data(),
+        sizeof(VkDeviceSize),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    vkDestroyQueryPool(context.device->get(), queryPool, nullptr);
+
+    if (result == VK_SUCCESS) {
+      compact(compacted, sizes);
+    }
+  }
+
+  entries.clear();
+}
+
+void AccelerationStructureBuilder::compact(
+    const std::vector<size_t> &compacted,
+    const std::vector<VkDeviceSize> &sizes) {
+  struct Original {
+    VkAccelerationStructureKHR accel;
+    std::unique_ptr<Buffer> buffer;
+  };
+  std::vector<Original> originals;
+  VkDeviceSize before = 0;
+  VkDeviceSize after = 0;
+
+  VkCommandBuffer commandBuffer = context.device->beginSingleTimeCommands();
+  for (size_t i = 0; i < compacted.size(); i++) {
+    AccelerationStructure *structure = entries[compacted[i]].structure;
+    before += structure->size;
+    if (sizes[i] == 0 || sizes[i] >= structure->size) {
+      after += structure->size;
+      continue;
+    }
+
+    originals.push_back({structure->accel, std::move(structure->buffer)});
+    structure->createStorage(sizes[i]);
+    after += sizes[i];
+
+    VkCopyAccelerationStructureInfoKHR copyInfo{};
+    copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+    copyInfo.src = originals.back().accel;
+    copyInfo.dst = structure->accel;
+    copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+    vkCmdCopyAccelerationStructureKHR(commandBuffer, &copyInfo);
+  }
+  context.device->endSingleTimeCommands(commandBuffer);
+
+  for (Original &original : originals) {
+    vkDestroyAccelerationStructureKHR(context.device->get(), original.accel,
+                                      nullptr);
+  }
+
+  if (enableStats) {
+    std::cout << "compacted " << compacted.size()
+              << " acceleration structures from " << before / 1024
+              << " KB to " << after / 1024 << " KB" << std::endl;
+  }
+}
+
+void AccelerationStructureBuilder::serialize() {
+  std::vector<VkAccelerationStructureKHR> structures;
+  for (const Save &save : saves) {
+    structures.push_back(save.structure->accel);
+  }
+  uint32_t count = static_cast<uint32_t>(structures.size());
+
+  VkQueryPoolCreateInfo queryPoolInfo{};
+  queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  queryPoolInfo.queryType =
+      VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+  queryPoolInfo.queryCount = count;
+  VkQueryPool queryPool;
+  if (vkCreateQueryPool(context.device->get(), &queryPoolInfo, nullptr,
+                        &queryPool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create query pool!");
+  }
+
+  VkCommandBuffer commandBuffer = context.device->beginSingleTimeCommands();
+  vkCmdResetQueryPool(commandBuffer, queryPool, 0, count);
+  vkCmdWriteAccelerationStructuresPropertiesKHR(
+      commandBuffer, count, structures.data(),
+      VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR, queryPool,
+      0);
+  context.device->endSingleTimeCommands(commandBuffer);
+
+  std::vector<VkDeviceSize> sizes(count);
+  VkResult result = vkGetQueryPoolResults(
+      context.device->get(), queryPool, 0, count,
+      sizes.size() * sizeof(VkDeviceSize), sizes.data(), sizeof(VkDeviceSize),
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+  vkDestroyQueryPool(context.device->get(), queryPool, nullptr);
+  if (result != VK_SUCCESS) {
+    saves.clear();
+    return;
+  }
+
+  std::vector<std::unique_ptr<Buffer>> buffers;
+  std::vector<VkDeviceSize> offsets;
+  commandBuffer = context.device->beginSingleTimeCommands();
+  for (uint32_t i = 0; i < count; i++) {
+    buffers.push_back(std::make_unique<Buffer>(
+        context, Buffer::Type::AccelInput, sizes[i] + SERIALIZED_ALIGNMENT));
+    VkDeviceAddress address = buffers.back()->getDeviceAddress();
+    VkDeviceAddress aligned = alignUp(address, SERIALIZED_ALIGNMENT);
+    offsets.push_back(aligned - address);
+
+    VkCopyAccelerationStructureToMemoryInfoKHR copyInfo{};
+    copyInfo.sType =
+        VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR;
+    copyInfo.src = structures[i];
+    copyInfo.dst.deviceAddress = aligned;
+    copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+    vkCmdCopyAccelerationStructureToMemoryKHR(commandBuffer, &copyInfo);
+  }
+
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr,
+                       0, nullptr);
+  context.device->endSingleTimeCommands(commandBuffer);
+
+  VkDeviceSize total = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    const uint8_t *mapped =
+        static_cast<const uint8_t *>(buffers[i]->getMapped()) + offsets[i];
+    if (!write(saves[i], mapped, sizes[i])) {
+      std::cerr << "failed to write acceleration structure cache "
+                << saves[i].path << std::endl;
+    }
+    total += sizes[i];
+  }
+
+  if (enableStats) {
+    std::cout << "serialized " << count << " acceleration structures ("
+              << total / 1024 << " KB)" << std::endl;
+  }
+  saves.clear();
+}
+
+bool AccelerationStructureBuilder::write(const Save &save, const void *data,
+                                         VkDeviceSize size) {
+  Header header{};
+  header.magic = MAGIC;
+  header.version = VERSION;
+  header.key = save.key;
+  header.dataSize = size;
+  header.dataHash = hash::bytes(data, size);
+
+  // write to a temporary file first so a crash never leaves a partial cache
+  std::string tmpPath = save.path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      return false;
+    }
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(static_cast<const char *>(data), size);
+
+    if (!file.good()) {
+      file.close();
+      std::remove(tmpPath.c_str());
+      return false;
+    }
+  }
+
+  return std::rename(tmpPath.c_str(), save.path.c_str()) == 0;
+}
@@ -0,0 +1,100 @@
+#ifndef TOXENGINE_ENGINE_ACCELERATIONSTRUCTUREBUILDER_H_
+#define TOXENGINE_ENGINE_ACCELERATIONSTRUCTUREBUILDER_H_
+
+#include "AccelerationStructure.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Context;
+
+// Collects bottom level structures and builds them on the gpu in one
+// submission. Builds share one scratch arena, they are split into batches
+// whose scratch fits into it and a barrier separates batches reusing the
+// same memory. Compaction of all structures takes one more submission.
+// Built structures can be serialized to disk and restored on the next
+// start instead of being built again, as long as the driver accepts them.
+class AccelerationStructureBuilder {
+public:
+  // upper bound for the scratch arena unless a single build needs more
+  static constexpr VkDeviceSize SCRATCH_BUDGET = 64ull << 20;
+
+  explicit AccelerationStructureBuilder(Context &context);
+
+  AccelerationStructureBuilder(const AccelerationStructureBuilder &) =
+      delete;
+  AccelerationStructureBuilder &
+  operator=(const AccelerationStructureBuilder &) = delete;
+
+  // the structure is usable after the next build() and has to live until
+  // then, just like the buffers the geometry points to
+  std::unique_ptr<AccelerationStructure>
+  add(const VkAccelerationStructureGeometryKHR &geometry,
+      uint32_t primitiveCount, bool compact = true);
+
+  // a structure serialized by save() with the same key, restored on the
+  // next build(), nullptr when there is no cache the device can use
+  std::unique_ptr<AccelerationStructure> load(const std::string &path,
+                                              uint64_t key);
+  // serialized once the next build() and compaction are done, the
+  // structure has to live until then
+  void save(AccelerationStructure &structure, const std::string &path,
+            uint64_t key);
+
+  // flushes the uploader, restores, builds and saves everything queued so
+  // far
+  void build();
+
+private:
+  static constexpr uint32_t MAGIC = 0x41584f54; // "TOXA"
+  static constexpr uint32_t VERSION = 1;
+  // required for the device addresses of serialized data
+  static constexpr VkDeviceSize SERIALIZED_ALIGNMENT = 256;
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t dataSize;
+    uint64_t dataHash;
+  };
+
+  struct Entry {
+    AccelerationStructure *structure;
+    VkAccelerationStructureGeometryKHR geometry;
+    VkAccelerationStructureBuildRangeInfoKHR range;
+    VkDeviceSize scratchSize;
+    bool compact;
+  };
+
+  struct Restore {
+    AccelerationStructure *structure;
+    std::unique_ptr<Buffer> data;
+    VkDeviceAddress address;
+  };
+
+  struct Save {
+    AccelerationStructure *structure;
+    std::string path;
+    uint64_t key;
+  };
+
+  Context &context;
+  VkDeviceSize scratchAlignment;
+  std::vector<Entry> entries;
+  std::vector<Restore> restores;
+  std::vector<Save> saves;
+
+  void restore();
+  void buildEntries();
+  void serialize();
+  bool write(const Save &save, const void *data, VkDeviceSize size);
+  void compact(const std::vector<size_t> &compacted,
+               const std::vector<VkDeviceSize> &sizes);
+};
+
+#endif // TOXENGINE_ENGINE_ACCELERATIONSTRUCTUREBUILDER_H_
@@ -0,0 +1,270 @@
+#include "AssetCache.h"
+
+#include "Hash.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+constexpr uint64_t SECTION_ALIGNMENT = 16;
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+} // namespace
+
+std::string AssetCache::path(const std::string &sourcePath,
+                             const std::string &kind) {
+  return sourcePath + "." + kind + ".toxcache";
+}
+
+bool AssetCache::stat(const std::string &path, Fingerprint &source) {
+  std::error_code error;
+  auto size = std::filesystem::file_size(path, error);
+  if (error) {
+    return false;
+  }
+  auto time = std::filesystem::last_write_time(path, error);
+  if (error) {
+    return false;
+  }
+
+  source.size = static_cast<uint64_t>(size);
+  source.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    time.time_since_epoch())
+                    .count();
+  return true;
+}
+
+bool AssetCache::hashFile(const std::string &path, uint64_t &hash) {
+  MappedFile source(path);
+  if (!source.isOpen()) {
+    // empty files can't be mapped
+    std::error_code error;
+    if (std::filesystem::file_size(path, error) != 0 || error) {
+      return false;
+    }
+    hash = hash::bytes(nullptr, 0);
+    return true;
+  }
+
+  hash = hash::bytes(source.data(), source.size());
+  return true;
+}
+
+bool AssetCache::fingerprint(const std::string &sourcePath,
+                             Fingerprint &fingerprint) {
+  return stat(sourcePath, fingerprint) &&
+         hashFile(sourcePath, fingerprint.hash);
+}
+
+bool AssetCache::matches(const std::string &sourcePath,
+                         const Fingerprint &fingerprint) {
+  Fingerprint source;
+  if (!stat(sourcePath, source) || source.size != fingerprint.size) {
+    return false;
+  }
+
+  // a touched but unchanged source keeps its cache
+  if (source.time != fingerprint.time) {
+    return hashFile(sourcePath, source.hash) &&
+           source.hash == fingerprint.hash;
+  }
+  return true;
+}
+
+AssetCache::AssetCache(const std::string &sourcePath, const std::string &kind,
+                       uint32_t variant) {
+  file = std::make_unique<MappedFile>(path(sourcePath, kind));
+  if (!file->isOpen() || file->size() < sizeof(Header)) {
+    unmap();
+    return;
+  }
+
+  const Header *header = reinterpret_cast<const Header *>(file->data());
+  if (header->magic != MAGIC || header->version != VERSION ||
+      header->variant != variant ||
+      !matches(sourcePath, {header->sourceSize, header->sourceTime,
+                            header->sourceHash})) {
+    unmap();
+    return;
+  }
+
+  sectionCount = header->sectionCount;
+  if (sizeof(Header) + sectionCount * sizeof(SectionEntry) > file->size()) {
+    unmap();
+    return;
+  }
+
+  sections = reinterpret_cast<const SectionEntry *>(file->data() +
+                                                    sizeof(Header));
+  for (uint32_t i = 0; i < sectionCount; i++) {
+    if (sections[i].offset > file->size() ||
+        sections[i].size > file->size() - sections[i].offset) {
+      unmap();
+      return;
+    }
+  }
+
+  if (!dependenciesMatch()) {
+    unmap();
+  }
+}
+
+bool AssetCache::dependenciesMatch() const {
+  const uint8_t *p = static_cast<const uint8_t *>(data(Section::Dependencies));
+  size_t remaining = size(Section::Dependencies);
+  while (remaining > 0) {
+    if (remaining < sizeof(DependencyEntry)) {
+      return false;
+    }
+    DependencyEntry entry;
+    memcpy(&entry, p, sizeof(entry));
+    size_t entrySize = alignUp(sizeof(entry) + entry.pathLength, 8);
+    if (entrySize > remaining) {
+      return false;
+    }
+
+    std::string dependency(reinterpret_cast<const char *>(p + sizeof(entry)),
+                           entry.pathLength);
+    if (entry.present) {
+      if (!matches(dependency, {entry.size, entry.time, entry.hash})) {
+        return false;
+      }
+    } else {
+      std::error_code error;
+      if (std::filesystem::exists(dependency, error)) {
+        return false;
+      }
+    }
+
+    p += entrySize;
+    remaining -= entrySize;
+  }
+  return true;
+}
+
+AssetCache::~AssetCache() { unmap(); }
+
+void AssetCache::unmap() {
+  file.reset();
+  sections = nullptr;
+  sectionCount = 0;
+}
+
+bool AssetCache::has(Section section) const {
+  for (uint32_t i = 0; i < sectionCount; i++) {
+    if (sections[i].section == section) {
+      return true;
+    }
+  }
+  return false;
+}
+
+const void *AssetCache::data(Section section) const {
+  for (uint32_t i = 0; i < sectionCount; i++) {
+    if (sections[i].section == section) {
+      return file->data() + sections[i].offset;
+    }
+  }
+  return nullptr;
+}
+
+size_t AssetCache::size(Section section) const {
+  for (uint32_t i = 0; i < sectionCount; i++) {
+    if (sections[i].section == section) {
+      return static_cast<size_t>(sections[i].size);
+    }
+  }
+  return 0;
+}
+
+void AssetCache::Writer::add(Section section, const void *data, size_t size) {
+  entries.push_back({section, data, size});
+}
+
+void AssetCache::Writer::addDependency(const std::string &path) {
+  DependencyEntry entry{};
+  Fingerprint dependency;
+  if (fingerprint(path, dependency)) {
+    entry = {dependency.size, dependency.time, dependency.hash, 1, 0};
+  }
+  entry.pathLength = static_cast<uint32_t>(path.size());
+
+  size_t offset = dependencyData.size();
+  dependencyData.resize(offset + alignUp(sizeof(entry) + path.size(), 8));
+  memcpy(dependencyData.data() + offset, &entry, sizeof(entry));
+  memcpy(dependencyData.data() + offset + sizeof(entry), path.data(),
+         path.size());
+}
+
+bool AssetCache::Writer::write(const std::string &sourcePath,
+                               const std::string &kind, uint32_t variant) {
+  Fingerprint source;
+  if (!fingerprint(sourcePath, source)) {
+    return false;
+  }
+
+  std::vector<Entry> sections = entries;
+  if (!dependencyData.empty()) {
+    sections.push_back(
+        {Section::Dependencies, dependencyData.data(), dependencyData.size()});
+  }
+
+  Header header{};
+  header.magic = MAGIC;
+  header.version = VERSION;
+  header.variant = variant;
+  header.sectionCount = static_cast<uint32_t>(sections.size());
+  header.sourceSize = source.size;
+  header.sourceTime = source.time;
+  header.sourceHash = source.hash;
+
+  std::vector<SectionEntry> table(sections.size());
+  uint64_t offset =
+      alignUp(sizeof(Header) + sections.size() * sizeof(SectionEntry),
+              SECTION_ALIGNMENT);
+  for (size_t i = 0; i < sections.size(); i++) {
+    table[i].section = sections[i].section;
+    table[i].reserved = 0;
+    table[i].offset = offset;
+    table[i].size = sections[i].size;
+    offset = alignUp(offset + sections[i].size, SECTION_ALIGNMENT);
+  }
+
+  // write to a temporary file first so readers never map a partial cache
+  std::string cachePath = path(sourcePath, kind);
+  std::string tmpPath = cachePath + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      return false;
+    }
+
+    const char padding[SECTION_ALIGNMENT] = {};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(table.data()),
+               table.size() * sizeof(SectionEntry));
+    uint64_t written = sizeof(header) + table.size() * sizeof(SectionEntry);
+
+    for (size_t i = 0; i < sections.size(); i++) {
+      file.write(padding, table[i].offset - written);
+      file.write(static_cast<const char *>(sections[i].data),
+                 sections[i].size);
+      written = table[i].offset + sections[i].size;
+    }
+
+    if (!file.good()) {
+      file.close();
+      std::remove(tmpPath.c_str());
+      return false;
+    }
+  }
+
+  return std::rename(tmpPath.c_str(), cachePath.c_str()) == 0;
+}
@@ -0,0 +1,127 @@
+#ifndef TOXENGINE_ENGINE_ASSETCACHE_H_
+#define TOXENGINE_ENGINE_ASSETCACHE_H_
+
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Versioned binary cache for imported assets. The cache file lives next to
+// its source (<source>.<kind>.toxcache) and is memory-mapped on load, so a
+// warm start reads the imported data without any parsing. A cache is stale
+// when the format version or variant changes, or when the source or one of
+// the files it depends on differs in size, or in mtime and content hash.
+class AssetCache {
+public:
+  enum class Section : uint32_t {
+    Vertices,
+    Indices,
+    Faces,
+    Bounds,
+    Decode,
+    Lods,
+    Dependencies
+  };
+
+  // identifies one version of a source file
+  struct Fingerprint {
+    uint64_t size;
+    int64_t time;
+    uint64_t hash;
+  };
+
+  struct Bounds {
+    float min[3];
+    float max[3];
+  };
+
+  class Writer {
+  public:
+    void add(Section section, const void *data, size_t size);
+    // another file read while importing the source, e.g. a material
+    // library. Missing files are recorded too, creating one invalidates
+    void addDependency(const std::string &path);
+    bool write(const std::string &sourcePath, const std::string &kind,
+               uint32_t variant = 0);
+
+  private:
+    struct Entry {
+      Section section;
+      const void *data;
+      size_t size;
+    };
+    std::vector<Entry> entries;
+    std::vector<uint8_t> dependencyData;
+  };
+
+  AssetCache(const std::string &sourcePath, const std::string &kind,
+             uint32_t variant = 0);
+  ~AssetCache();
+
+  AssetCache(const AssetCache &) = delete;
+  AssetCache &operator=(const AssetCache &) = delete;
+
+  bool isValid() const { return file != nullptr; }
+  bool has(Section section) const;
+  const void *data(Section section) const;
+  size_t size(Section section) const;
+
+  template <typename T> const T *get(Section section) const {
+    return static_cast<const T *>(data(section));
+  }
+  template <typename T> size_t count(Section section) const {
+    return size(section) / sizeof(T);
+  }
+
+  static std::string path(const std::string &sourcePath,
+                          const std::string &kind);
+  static bool fingerprint(const std::string &sourcePath,
+                          Fingerprint &fingerprint);
+  // same size, and same mtime or content hash
+  static bool matches(const std::string &sourcePath,
+                      const Fingerprint &fingerprint);
+
+private:
+  static constexpr uint32_t MAGIC = 0x43584f54; // "TOXC"
+  static constexpr uint32_t VERSION = 2;
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t variant;
+    uint32_t sectionCount;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint64_t sourceHash;
+  };
+
+  struct SectionEntry {
+    Section section;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  // followed by the path, the next entry starts 8 byte aligned
+  struct DependencyEntry {
+    uint64_t size;
+    int64_t time;
+    uint64_t hash;
+    uint32_t present;
+    uint32_t pathLength;
+  };
+
+  static bool stat(const std::string &path, Fingerprint &source);
+  static bool hashFile(const std::string &path, uint64_t &hash);
+  bool dependenciesMatch() const;
+  void unmap();
+
+  std::unique_ptr<MappedFile> file;
+  const SectionEntry *sections = nullptr;
+  uint32_t sectionCount = 0;
+};
+
+#endif // TOXENGINE_ENGINE_ASSETCACHE_H_
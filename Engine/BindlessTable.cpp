@@ -0,0 +1,156 @@
+#include "BindlessTable.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+namespace {
+
+// descriptors the pipelines bind next to the table, they count against
+// the same limits
+constexpr uint32_t RESERVED_DESCRIPTORS = 8;
+
+uint32_t available(uint32_t limit) {
+  return limit > RESERVED_DESCRIPTORS ? limit - RESERVED_DESCRIPTORS : 0;
+}
+
+} // namespace
+
+BindlessTable::BindlessTable(
+    VkDevice device, const VkPhysicalDeviceDescriptorIndexingProperties &limits)
+    : device(device) {
+  // the set is visible to every stage, so every stage has to fit it
+  bufferCapacity = std::min(
+      {MAX_BUFFERS,
+       available(limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers),
+       available(limits.maxDescriptorSetUpdateAfterBindStorageBuffers)});
+  textureCapacity = std::min(
+      {MAX_TEXTURES,
+       available(limits.maxPerStageDescriptorUpdateAfterBindSampledImages),
+       available(limits.maxPerStageDescriptorUpdateAfterBindSamplers),
+       available(limits.maxDescriptorSetUpdateAfterBindSampledImages),
+       available(limits.maxDescriptorSetUpdateAfterBindSamplers)});
+
+  // both arrays share the per stage resource limit, textures get at most a
+  // quarter of it when it is short
+  uint32_t resources = available(limits.maxPerStageUpdateAfterBindResources);
+  if (bufferCapacity + textureCapacity > resources) {
+    textureCapacity = std::min(textureCapacity, resources / 4);
+    bufferCapacity = std::min(bufferCapacity, resources - textureCapacity);
+  }
+
+  std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+  bindings[0].binding = BUFFER_BINDING;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  bindings[0].descriptorCount = bufferCapacity;
+  bindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+  bindings[1].binding = TEXTURE_BINDING;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[1].descriptorCount = textureCapacity;
+  bindings[1].stageFlags = VK_SHADER_STAGE_ALL;
+
+  VkDescriptorBindingFlags flags =
+      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+      VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+  std::array<VkDescriptorBindingFlags, 2> bindingFlags = {flags, flags};
+
+  VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+  bindingFlagsInfo.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+  bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+  bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.pNext = &bindingFlagsInfo;
+  layoutInfo.flags =
+      VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create bindless descriptor set "
+                             "layout!");
+  }
+
+  std::array<VkDescriptorPoolSize, 2> poolSizes{};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[0].descriptorCount = std::max(bufferCapacity, 1u);
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[1].descriptorCount = std::max(textureCapacity, 1u);
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = 1;
+
+  if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create bindless descriptor pool!");
+  }
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = pool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &layout;
+
+  if (vkAllocateDescriptorSets(device, &allocInfo, &set) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate bindless descriptor set!");
+  }
+}
+
+BindlessTable::~BindlessTable() {
+  vkDestroyDescriptorPool(device, pool, nullptr);
+  vkDestroyDescriptorSetLayout(device, layout, nullptr);
+}
+
+uint32_t BindlessTable::addBuffer(VkBuffer buffer) {
+  if (bufferCount >= bufferCapacity) {
+    throw std::runtime_error("failed to add buffer, bindless table is full!");
+  }
+
+  VkDescriptorBufferInfo bufferInfo{};
+  bufferInfo.buffer = buffer;
+  bufferInfo.range = VK_WHOLE_SIZE;
+
+  VkWriteDescriptorSet descriptorWrite{};
+  descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrite.dstSet = set;
+  descriptorWrite.dstBinding = BUFFER_BINDING;
+  descriptorWrite.dstArrayElement = bufferCount;
+  descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptorWrite.descriptorCount = 1;
+  descriptorWrite.pBufferInfo = &bufferInfo;
+  vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+
+  return bufferCount++;
+}
+
+uint32_t BindlessTable::addTexture(VkImageView imageView, VkSampler sampler) {
+  if (textureCount >= textureCapacity) {
+    throw std::runtime_error("failed to add texture, bindless table is "
+                             "full!");
+  }
+
+  VkDescriptorImageInfo imageInfo{};
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  imageInfo.imageView = imageView;
+  imageInfo.sampler = sampler;
+
+  VkWriteDescriptorSet descriptorWrite{};
+  descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrite.dstSet = set;
+  descriptorWrite.dstBinding = TEXTURE_BINDING;
+  descriptorWrite.dstArrayElement = textureCount;
+  descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrite.descriptorCount = 1;
+  descriptorWrite.pImageInfo = &imageInfo;
+  vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+
+  return textureCount++;
+}
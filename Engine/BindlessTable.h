@@ -0,0 +1,48 @@
+#ifndef TOXENGINE_ENGINE_BINDLESSTABLE_H_
+#define TOXENGINE_ENGINE_BINDLESSTABLE_H_
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+
+// One descriptor set with every storage buffer and texture the shaders
+// index by slot, bound once by any pipeline that uses it. The arrays are
+// partially bound and update after bind, new slots are written while
+// frames in flight still use the set and nothing is ever rewritten.
+class BindlessTable {
+public:
+  // upper bounds, the arrays shrink to the device's update after bind
+  // limits
+  static constexpr uint32_t MAX_BUFFERS = 1 << 16;
+  static constexpr uint32_t MAX_TEXTURES = 1 << 14;
+
+  static constexpr uint32_t BUFFER_BINDING = 0;
+  static constexpr uint32_t TEXTURE_BINDING = 1;
+
+  BindlessTable(VkDevice device,
+                const VkPhysicalDeviceDescriptorIndexingProperties &limits);
+  ~BindlessTable();
+
+  BindlessTable(const BindlessTable &) = delete;
+  BindlessTable &operator=(const BindlessTable &) = delete;
+
+  VkDescriptorSetLayout getLayout() { return layout; }
+  VkDescriptorSet get() { return set; }
+
+  // return the slot the shaders index with
+  uint32_t addBuffer(VkBuffer buffer);
+  uint32_t addTexture(VkImageView imageView, VkSampler sampler);
+
+private:
+  VkDevice device;
+  VkDescriptorSetLayout layout;
+  VkDescriptorPool pool;
+  VkDescriptorSet set;
+
+  uint32_t bufferCapacity;
+  uint32_t textureCapacity;
+  uint32_t bufferCount = 0;
+  uint32_t textureCount = 0;
+};
+
+#endif // TOXENGINE_ENGINE_BINDLESSTABLE_H_
@@ -0,0 +1,541 @@
+#include "BlockEncoder.h"
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TOXENGINE_BLOCKENCODER_SSE2
+#endif
+
+namespace {
+
+constexpr int POWER_ITERATIONS = 8;
+constexpr int REFINE_ITERATIONS = 2;
+
+constexpr float BC1_WEIGHTS[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+constexpr int32_t BC7_WEIGHTS[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                     34, 38, 43, 47, 51, 55, 60, 64};
+
+// 4x4 texels, edge blocks repeat the last row and column
+struct Block {
+  alignas(16) uint8_t texels[16][4];
+};
+
+struct Endpoints {
+  float lo[4];
+  float hi[4];
+};
+
+struct BitWriter {
+  uint8_t *out;
+  size_t position = 0;
+
+  void put(uint32_t value, int bits) {
+    for (int b = 0; b < bits; b++, position++) {
+      if ((value >> b) & 1) {
+        out[position / 8] |= static_cast<uint8_t>(1 << (position % 8));
+      }
+    }
+  }
+};
+
+float clamp255(float value) { return std::min(std::max(value, 0.0f), 255.0f); }
+
+void loadBlock(const uint8_t *pixels, const MipChain::Level &level,
+               uint32_t bx, uint32_t by, Block &block) {
+  for (uint32_t y = 0; y < 4; y++) {
+    uint32_t py = std::min(4 * by + y, level.height - 1);
+    for (uint32_t x = 0; x < 4; x++) {
+      uint32_t px = std::min(4 * bx + x, level.width - 1);
+      memcpy(block.texels[4 * y + x],
+             pixels + (size_t(py) * level.width + px) * 4, 4);
+    }
+  }
+}
+
+void blockBounds(const Block &block, uint8_t *min, uint8_t *max) {
+#ifdef TOXENGINE_BLOCKENCODER_SSE2
+  const __m128i *rows = reinterpret_cast<const __m128i *>(block.texels);
+  __m128i lo = _mm_min_epu8(_mm_min_epu8(rows[0], rows[1]),
+                            _mm_min_epu8(rows[2], rows[3]));
+  __m128i hi = _mm_max_epu8(_mm_max_epu8(rows[0], rows[1]),
+                            _mm_max_epu8(rows[2], rows[3]));
+  lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 8));
+  lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 4));
+  hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 8));
+  hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 4));
+
+  int32_t packed = _mm_cvtsi128_si32(lo);
+  memcpy(min, &packed, 4);
+  packed = _mm_cvtsi128_si32(hi);
+  memcpy(max, &packed, 4);
+#else
+  for (int c = 0; c < 4; c++) {
+    min[c] = 255;
+    max[c] = 0;
+    for (int i = 0; i < 16; i++) {
+      min[c] = std::min(min[c], block.texels[i][c]);
+      max[c] = std::max(max[c], block.texels[i][c]);
+    }
+  }
+#endif
+}
+
+// extremes of the texels projected on the principal axis, found by power
+// iteration on the covariance starting from the bounding box diagonal
+void principalEndpoints(const Block &block, int channels, Endpoints &e) {
+  uint8_t min[4], max[4];
+  blockBounds(block, min, max);
+
+  float mean[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < channels; c++) {
+      mean[c] += block.texels[i][c];
+    }
+  }
+  for (int c = 0; c < 4; c++) {
+    mean[c] = c < channels ? mean[c] / 16.0f : 255.0f;
+  }
+
+  float covariance[4][4] = {};
+  for (int i = 0; i < 16; i++) {
+    float d[4];
+    for (int c = 0; c < channels; c++) {
+      d[c] = block.texels[i][c] - mean[c];
+    }
+    for (int a = 0; a < channels; a++) {
+      for (int b = 0; b < channels; b++) {
+        covariance[a][b] += d[a] * d[b];
+      }
+    }
+  }
+
+  float axis[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  for (int c = 0; c < channels; c++) {
+    axis[c] = static_cast<float>(max[c] - min[c]);
+  }
+  for (int iteration = 0; iteration < POWER_ITERATIONS; iteration++) {
+    float next[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    float length = 0.0f;
+    for (int a = 0; a < channels; a++) {
+      for (int b = 0; b < channels; b++) {
+        next[a] += covariance[a][b] * axis[b];
+      }
+      length = std::max(length, std::fabs(next[a]));
+    }
+    if (length <= 0.0f) {
+      break;
+    }
+    for (int c = 0; c < channels; c++) {
+      axis[c] = next[c] / length;
+    }
+  }
+
+  float length2 = 0.0f;
+  for (int c = 0; c < channels; c++) {
+    length2 += axis[c] * axis[c];
+  }
+
+  float tMin = 0.0f;
+  float tMax = 0.0f;
+  if (length2 > 0.0f) {
+    tMin = std::numeric_limits<float>::max();
+    tMax = -tMin;
+    for (int i = 0; i < 16; i++) {
+      float t = 0.0f;
+      for (int c = 0; c < channels; c++) {
+        t += (block.texels[i][c] - mean[c]) * axis[c];
+      }
+      tMin = std::min(tMin, t);
+      tMax = std::max(tMax, t);
+    }
+    tMin /= length2;
+    tMax /= length2;
+  }
+
+  for (int c = 0; c < 4; c++) {
+    e.lo[c] = clamp255(mean[c] + axis[c] * tMin);
+    e.hi[c] = clamp255(mean[c] + axis[c] * tMax);
+  }
+}
+
+// nearest palette entry for every texel, returns the summed squared error
+uint32_t fitIndices(const Block &block, const int32_t (*palette)[4],
+                    int paletteSize, bool alpha, uint8_t *indices) {
+#ifdef TOXENGINE_BLOCKENCODER_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i mask = alpha ? _mm_set1_epi16(-1)
+                             : _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+
+  // two texels as 16 bit channels per register
+  const __m128i *rows = reinterpret_cast<const __m128i *>(block.texels);
+  __m128i texels[8];
+  for (int r = 0; r < 4; r++) {
+    texels[2 * r] = _mm_and_si128(_mm_unpacklo_epi8(rows[r], zero), mask);
+    texels[2 * r + 1] = _mm_and_si128(_mm_unpackhi_epi8(rows[r], zero), mask);
+  }
+
+  __m128i best[4];
+  __m128i bestIndex[4];
+  for (int r = 0; r < 4; r++) {
+    best[r] = _mm_set1_epi32(std::numeric_limits<int32_t>::max());
+    bestIndex[r] = zero;
+  }
+
+  for (int p = 0; p < paletteSize; p++) {
+    const int32_t *entry = palette[p];
+    __m128i color = _mm_and_si128(
+        _mm_setr_epi16(
+            static_cast<int16_t>(entry[0]), static_cast<int16_t>(entry[1]),
+            static_cast<int16_t>(entry[2]), static_cast<int16_t>(entry[3]),
+            static_cast<int16_t>(entry[0]), static_cast<int16_t>(entry[1]),
+            static_cast<int16_t>(entry[2]), static_cast<int16_t>(entry[3])),
+        mask);
+    __m128i index = _mm_set1_epi32(p);
+
+    for (int r = 0; r < 4; r++) {
+      __m128i d0 = _mm_sub_epi16(texels[2 * r], color);
+      __m128i d1 = _mm_sub_epi16(texels[2 * r + 1], color);
+      __m128i m0 = _mm_madd_epi16(d0, d0);
+      __m128i m1 = _mm_madd_epi16(d1, d1);
+      m0 = _mm_add_epi32(m0, _mm_shuffle_epi32(m0, _MM_SHUFFLE(2, 3, 0, 1)));
+      m1 = _mm_add_epi32(m1, _mm_shuffle_epi32(m1, _MM_SHUFFLE(2, 3, 0, 1)));
+      __m128i error = _mm_castps_si128(
+          _mm_shuffle_ps(_mm_castsi128_ps(m0), _mm_castsi128_ps(m1),
+                         _MM_SHUFFLE(2, 0, 2, 0)));
+
+      __m128i better = _mm_cmplt_epi32(error, best[r]);
+      best[r] = _mm_or_si128(_mm_and_si128(better, error),
+                             _mm_andnot_si128(better, best[r]));
+      bestIndex[r] = _mm_or_si128(_mm_and_si128(better, index),
+                                  _mm_andnot_si128(better, bestIndex[r]));
+    }
+  }
+
+  alignas(16) int32_t errors[16];
+  alignas(16) int32_t chosen[16];
+  for (int r = 0; r < 4; r++) {
+    _mm_store_si128(reinterpret_cast<__m128i *>(errors + 4 * r), best[r]);
+    _mm_store_si128(reinterpret_cast<__m128i *>(chosen + 4 * r),
+                    bestIndex[r]);
+  }
+
+  uint32_t total = 0;
+  for (int i = 0; i < 16; i++) {
+    total += errors[i];
+    indices[i] = static_cast<uint8_t>(chosen[i]);
+  }
+  return total;
+#else
+  int channels = alpha ? 4 : 3;
+  uint32_t total = 0;
+  for (int i = 0; i < 16; i++) {
+    int32_t best = std::numeric_limits<int32_t>::max();
+    for (int p = 0; p < paletteSize; p++) {
+      int32_t error = 0;
+      for (int c = 0; c < channels; c++) {
+        int32_t d = block.texels[i][c] - palette[p][c];
+        error += d * d;
+      }
+      if (error < best) {
+        best = error;
+        indices[i] = static_cast<uint8_t>(p);
+      }
+    }
+    total += best;
+  }
+  return total;
+#endif
+}
+
+// endpoints minimizing the squared error for fixed interpolation weights
+bool leastSquares(const Block &block, const uint8_t *indices,
+                  const float *weights, int channels, float *e0, float *e1) {
+  float a = 0.0f, b = 0.0f, c = 0.0f;
+  float x[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  float y[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  for (int i = 0; i < 16; i++) {
+    float w = weights[indices[i]];
+    float v = 1.0f - w;
+    a += v * v;
+    b += v * w;
+    c += w * w;
+    for (int ch = 0; ch < channels; ch++) {
+      x[ch] += v * block.texels[i][ch];
+      y[ch] += w * block.texels[i][ch];
+    }
+  }
+
+  float det = a * c - b * b;
+  if (std::fabs(det) < 1e-6f) {
+    return false;
+  }
+  for (int ch = 0; ch < 4; ch++) {
+    e0[ch] = ch < channels ? clamp255((c * x[ch] - b * y[ch]) / det) : 255.0f;
+    e1[ch] = ch < channels ? clamp255((a * y[ch] - b * x[ch]) / det) : 255.0f;
+  }
+  return true;
+}
+
+uint16_t pack565(const float *color) {
+  int r = static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f);
+  int g = static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f);
+  int b = static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f);
+  return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void unpack565(uint16_t packed, int32_t *color) {
+  int32_t r = (packed >> 11) & 31;
+  int32_t g = (packed >> 5) & 63;
+  int32_t b = packed & 31;
+  color[0] = (r << 3) | (r >> 2);
+  color[1] = (g << 2) | (g >> 4);
+  color[2] = (b << 3) | (b >> 2);
+  color[3] = 255;
+}
+
+// four color mode needs c0 > c1, equal endpoints use a single color
+uint32_t tryBc1(const Block &block, uint16_t &c0, uint16_t &c1,
+                uint8_t *indices) {
+  if (c0 < c1) {
+    std::swap(c0, c1);
+  }
+
+  int32_t palette[4][4];
+  unpack565(c0, palette[0]);
+  unpack565(c1, palette[1]);
+  for (int c = 0; c < 4; c++) {
+    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+  }
+  return fitIndices(block, palette, c0 == c1 ? 1 : 4, false, indices);
+}
+
+void encodeBc1(const Block &block, uint8_t *out) {
+  Endpoints e;
+  principalEndpoints(block, 3, e);
+
+  uint8_t indices[16];
+  uint16_t c0 = pack565(e.hi);
+  uint16_t c1 = pack565(e.lo);
+  uint32_t error = tryBc1(block, c0, c1, indices);
+
+  for (int iteration = 0; iteration < REFINE_ITERATIONS && error > 0;
+       iteration++) {
+    float e0[4], e1[4];
+    if (!leastSquares(block, indices, BC1_WEIGHTS, 3, e0, e1)) {
+      break;
+    }
+    uint8_t candidate[16];
+    uint16_t n0 = pack565(e0);
+    uint16_t n1 = pack565(e1);
+    uint32_t candidateError = tryBc1(block, n0, n1, candidate);
+    if (candidateError >= error) {
+      break;
+    }
+    error = candidateError;
+    c0 = n0;
+    c1 = n1;
+    memcpy(indices, candidate, sizeof(indices));
+  }
+
+  uint32_t bits = 0;
+  for (int i = 0; i < 16; i++) {
+    bits |= uint32_t(indices[i]) << (2 * i);
+  }
+  out[0] = static_cast<uint8_t>(c0);
+  out[1] = static_cast<uint8_t>(c0 >> 8);
+  out[2] = static_cast<uint8_t>(c1);
+  out[3] = static_cast<uint8_t>(c1 >> 8);
+  memcpy(out + 4, &bits, 4);
+}
+
+void encodeBc4(const Block &block, int channel, uint8_t lo, uint8_t hi,
+               uint8_t *out) {
+  // eight value mode, index 0 is hi, 1 is lo and 2..7 step from hi to lo
+  uint64_t bits = 0;
+  if (hi > lo) {
+    int range = hi - lo;
+    for (int i = 0; i < 16; i++) {
+      int step = ((block.texels[i][channel] - lo) * 7 + range / 2) / range;
+      uint64_t index = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+      bits |= index << (3 * i);
+    }
+  }
+
+  out[0] = hi;
+  out[1] = lo;
+  for (int b = 0; b < 6; b++) {
+    out[2 + b] = static_cast<uint8_t>(bits >> (8 * b));
+  }
+}
+
+void encodeBc5(const Block &block, uint8_t *out) {
+  uint8_t min[4], max[4];
+  blockBounds(block, min, max);
+  encodeBc4(block, 0, min[0], max[0], out);
+  encodeBc4(block, 1, min[1], max[1], out + 8);
+}
+
+struct Bc7Endpoint {
+  uint8_t color[4]; // 7 bits
+  uint8_t pbit;
+};
+
+// 7 bit endpoint together with the shared bit that reconstructs it best
+Bc7Endpoint quantizeBc7(const float *value) {
+  Bc7Endpoint best{};
+  float bestError = std::numeric_limits<float>::max();
+  for (uint8_t pbit = 0; pbit < 2; pbit++) {
+    Bc7Endpoint candidate{};
+    candidate.pbit = pbit;
+    float error = 0.0f;
+    for (int c = 0; c < 4; c++) {
+      int q = static_cast<int>((value[c] - pbit) / 2.0f + 0.5f);
+      q = std::min(std::max(q, 0), 127);
+      candidate.color[c] = static_cast<uint8_t>(q);
+      float d = static_cast<float>((q << 1) | pbit) - value[c];
+      error += d * d;
+    }
+    if (error < bestError) {
+      bestError = error;
+      best = candidate;
+    }
+  }
+  return best;
+}
+
+uint32_t tryBc7(const Block &block, const Bc7Endpoint &e0,
+                const Bc7Endpoint &e1, uint8_t *indices) {
+  int32_t palette[16][4];
+  for (int c = 0; c < 4; c++) {
+    int32_t a = (e0.color[c] << 1) | e0.pbit;
+    int32_t b = (e1.color[c] << 1) | e1.pbit;
+    for (int i = 0; i < 16; i++) {
+      palette[i][c] =
+          ((64 - BC7_WEIGHTS[i]) * a + BC7_WEIGHTS[i] * b + 32) >> 6;
+    }
+  }
+  return fitIndices(block, palette, 16, true, indices);
+}
+
+// mode 6 only
+void encodeBc7(const Block &block, uint8_t *out) {
+  static const float weights[16] = {
+      0 / 64.0f,  4 / 64.0f,  9 / 64.0f,  13 / 64.0f, 17 / 64.0f, 21 / 64.0f,
+      26 / 64.0f, 30 / 64.0f, 34 / 64.0f, 38 / 64.0f, 43 / 64.0f, 47 / 64.0f,
+      51 / 64.0f, 55 / 64.0f, 60 / 64.0f, 64 / 64.0f};
+
+  Endpoints e;
+  principalEndpoints(block, 4, e);
+
+  uint8_t indices[16];
+  Bc7Endpoint e0 = quantizeBc7(e.lo);
+  Bc7Endpoint e1 = quantizeBc7(e.hi);
+  uint32_t error = tryBc7(block, e0, e1, indices);
+
+  for (int iteration = 0; iteration < REFINE_ITERATIONS && error > 0;
+       iteration++) {
+    float lo[4], hi[4];
+    if (!leastSquares(block, indices, weights, 4, lo, hi)) {
+      break;
+    }
+    uint8_t candidate[16];
+    Bc7Endpoint n0 = quantizeBc7(lo);
+    Bc7Endpoint n1 = quantizeBc7(hi);
+    uint32_t candidateError = tryBc7(block, n0, n1, candidate);
+    if (candidateError >= error) {
+      break;
+    }
+    error = candidateError;
+    e0 = n0;
+    e1 = n1;
+    memcpy(indices, candidate, sizeof(indices));
+  }
+
+  // the first index is stored without its top bit
+  if (indices[0] & 8) {
+    std::swap(e0, e1);
+    for (int i = 0; i < 16; i++) {
+      indices[i] = 15 - indices[i];
+    }
+  }
+
+  memset(out, 0, 16);
+  BitWriter writer{out};
+  writer.put(1 << 6, 7);
+  for (int c = 0; c < 4; c++) {
+    writer.put(e0.color[c], 7);
+    writer.put(e1.color[c], 7);
+  }
+  writer.put(e0.pbit, 1);
+  writer.put(e1.pbit, 1);
+  for (int i = 0; i < 16; i++) {
+    writer.put(indices[i], i == 0 ? 3 : 4);
+  }
+}
+
+} // namespace
+
+size_t BlockEncoder::blockSize(TextureFormat format) {
+  switch (format) {
+  case TextureFormat::Bc1:
+    return 8;
+  case TextureFormat::Bc5:
+  case TextureFormat::Bc7:
+    return 16;
+  default:
+    throw std::runtime_error("failed to encode blocks, unsupported format!");
+  }
+}
+
+BlockEncoder::BlockEncoder(TextureFormat format, const MipChain &chain) {
+  size_t size = blockSize(format);
+  void (*encode)(const Block &, uint8_t *) =
+      format == TextureFormat::Bc1   ? encodeBc1
+      : format == TextureFormat::Bc5 ? encodeBc5
+                                     : encodeBc7;
+
+  // one task per block row of every level
+  struct Row {
+    uint32_t level;
+    uint32_t y;
+  };
+  std::vector<Row> rows;
+
+  levels.resize(chain.levels.size());
+  uint64_t offset = 0;
+  for (size_t i = 0; i < levels.size(); i++) {
+    const MipChain::Level &source = chain.levels[i];
+    uint32_t blocksX = (source.width + 3) / 4;
+    uint32_t blocksY = (source.height + 3) / 4;
+
+    levels[i] = {source.width, source.height, offset,
+                 uint64_t(blocksX) * blocksY * size};
+    offset += levels[i].size;
+    for (uint32_t y = 0; y < blocksY; y++) {
+      rows.push_back({static_cast<uint32_t>(i), y});
+    }
+  }
+  blocks.resize(offset);
+
+  ThreadPool::shared().parallelFor(rows.size(), [&](size_t r) {
+    const MipChain::Level &source = chain.levels[rows[r].level];
+    const uint8_t *pixels = chain.pixels.data() + source.offset;
+    uint32_t blocksX = (source.width + 3) / 4;
+    uint8_t *out = blocks.data() + levels[rows[r].level].offset +
+                   size_t(rows[r].y) * blocksX * size;
+
+    Block block;
+    for (uint32_t x = 0; x < blocksX; x++) {
+      loadBlock(pixels, source, x, rows[r].y, block);
+      encode(block, out + x * size);
+    }
+  });
+}
@@ -0,0 +1,29 @@
+#ifndef TOXENGINE_ENGINE_BLOCKENCODER_H_
+#define TOXENGINE_ENGINE_BLOCKENCODER_H_
+
+#include "../App/ITOXEngine.h"
+#include "MipChain.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Encodes every level of a mip chain to 4x4 blocks, blocks are spread over
+// the thread pool:
+// - BC1 stores rgb with two 565 endpoints and 2 bit indices
+// - BC5 stores red and green as two BC4 blocks with 3 bit indices
+// - BC7 only uses mode 6, one rgba subset with 7 bit endpoints plus a
+//   shared bit each and 4 bit indices
+// Endpoints start at the extremes of the principal axis and are refined by
+// least squares on the chosen indices.
+class BlockEncoder {
+public:
+  BlockEncoder(TextureFormat format, const MipChain &chain);
+
+  static size_t blockSize(TextureFormat format);
+
+  std::vector<MipChain::Level> levels; // offsets into blocks
+  std::vector<uint8_t> blocks;
+};
+
+#endif // TOXENGINE_ENGINE_BLOCKENCODER_H_
@@ -2,12 +2,20 @@
 
 #include "TOXEngine.h"
 
+#include <cstdint>
 #include <cstring>
 
 Buffer::Buffer(Context &context, Type type, VkDeviceSize size, const void *data)
     : context(context) {
+  MemoryAllocator &allocator = context.device->getAllocator();
+  // mesh data skips the staging copy when the host can write device memory
+  VkMemoryPropertyFlags direct = allocator.hasDirectUpload()
+                                     ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+                                     : 0;
   VkBufferUsageFlags usage;
   VkMemoryPropertyFlags properties;
+  VkMemoryPropertyFlags preferred = 0;
   switch (type) {
   case Type::Scratch:
     usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
@@ -15,11 +23,17 @@ Buffer::Buffer(Context &context, Type type, VkDeviceSize size, const void *data)
     properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     break;
   case Type::Staging:
-    staging = true;
     usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
     properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
     break;
+  case Type::Readback:
+    // written by copies or shaders
+    usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    break;
   case Type::Vertex:
     usage =
         VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
@@ -27,6 +41,7 @@ Buffer::Buffer(Context &context, Type type, VkDeviceSize size, const void *data)
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
     properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    preferred = direct;
     break;
   case Type::Index:
     usage =
@@ -35,6 +50,7 @@ Buffer::Buffer(Context &context, Type type, VkDeviceSize size, const void *data)
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
     properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    preferred = direct;
     break;
   case Type::Face:
     usage =
@@ -43,6 +59,25 @@ Buffer::Buffer(Context &context, Type type, VkDeviceSize size, const void *data)
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
     properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    preferred = direct;
+    break;
+  case Type::Storage:
+    usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    preferred = direct;
+    break;
+  case Type::Instance:
+    usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    break;
+  case Type::Indirect:
+    usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+    properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     break;
   case Type::Uniform:
     usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
@@ -62,6 +97,13 @@ Buffer::Buffer(Context &context, Type type, VkDeviceSize size, const void *data)
             VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
     properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     break;
+  case Type::AccelStorageHost:
+    usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    break;
   case Type::ShaderBindingTable:
     usage = VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR |
             VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
@@ -80,27 +122,7 @@ Buffer::Buffer(Context &context, Type type, VkDeviceSize size, const void *data)
     throw std::runtime_error("failed to create buffer!");
   }
 
-  VkMemoryAllocateFlagsInfo flagsInfo = {};
-  flagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
-  flagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
-
-  VkMemoryRequirements memRequirements;
-  vkGetBufferMemoryRequirements(context.device->get(), buffer,
-                                &memRequirements);
-
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = context.physicalDevice->findMemoryType(
-      memRequirements.memoryTypeBits, properties);
-  allocInfo.pNext = &flagsInfo;
-
-  if (vkAllocateMemory(context.device->get(), &allocInfo, nullptr, &memory) !=
-      VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate buffer memory!");
-  }
-
-  vkBindBufferMemory(context.device->get(), buffer, memory, 0);
+  allocation = allocator.allocate(buffer, properties, preferred);
 
   if (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
     VkBufferDeviceAddressInfo bufferDeviceAddressInfo;
@@ -113,29 +135,19 @@ Buffer::Buffer(Context &context, Type type, VkDeviceSize size, const void *data)
   }
 
   if (data) {
-    void *mapped;
-    vkMapMemory(context.device->get(), memory, 0, size, 0, &mapped);
-    memcpy(mapped, data, size);
-    vkUnmapMemory(context.device->get(), memory);
+    upload(data, size);
   }
 }
 
 Buffer::~Buffer() {
-  if (!staging)
-    cleanup();
-}
-
-void Buffer::cleanup() {
   vkDestroyBuffer(context.device->get(), buffer, nullptr);
-  vkFreeMemory(context.device->get(), memory, nullptr);
+  context.device->getAllocator().free(allocation);
 }
 
-void Buffer::copy(Buffer other, VkDeviceSize size) {
-  VkCommandBuffer commandBuffer = context.device->beginSingleTimeCommands();
-
-  VkBufferCopy copyRegion{};
-  copyRegion.size = size;
-  vkCmdCopyBuffer(commandBuffer, other.buffer, buffer, 1, &copyRegion);
-
-  context.device->endSingleTimeCommands(commandBuffer);
+void Buffer::upload(const void *data, VkDeviceSize size, VkDeviceSize offset) {
+  if (allocation.mapped) {
+    memcpy(static_cast<uint8_t *>(allocation.mapped) + offset, data, size);
+  } else {
+    context.device->getUploader().upload(buffer, data, size, offset);
+  }
 }
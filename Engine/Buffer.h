@@ -1,6 +1,8 @@
 #ifndef TOXENGINE_ENGINE_BUFFER_H_
 #define TOXENGINE_ENGINE_BUFFER_H_
 
+#include "MemoryAllocator.h"
+
 #include <vulkan/vulkan.h>
 
 #include <memory>
@@ -12,37 +14,47 @@ public:
   enum class Type {
     Scratch,
     Staging,
+    Readback,
     Vertex,
     Index,
     Face,
+    // read only shader data uploaded once
+    Storage,
+    // per instance tables, written in place
+    Instance,
+    // written by compute passes and read by indirect draws
+    Indirect,
     Uniform,
     AccelInput,
     AccelStorage,
+    // host builds need host visible memory
+    AccelStorageHost,
     ShaderBindingTable
   };
 
+  // data is uploaded like with upload()
   Buffer(Context &context, Type type, VkDeviceSize size,
          const void *data = nullptr);
   ~Buffer();
 
+  Buffer(const Buffer &) = delete;
+  Buffer &operator=(const Buffer &) = delete;
+
   VkBuffer get() { return buffer; }
-  VkDeviceMemory getDeviceMemory() { return memory; }
   VkDeviceAddress getDeviceAddress() { return deviceAddress; }
+  // persistently mapped pointer, nullptr for device local buffers
+  void *getMapped() { return allocation.mapped; }
 
-  void copy(Buffer other, VkDeviceSize size);
-  void store(void *data, VkDeviceSize size);
-
-  void cleanup();
+  // written in place when the buffer is mapped, otherwise copied by the
+  // upload manager and only usable on the gpu after its next flush
+  void upload(const void *data, VkDeviceSize size, VkDeviceSize offset = 0);
 
 private:
   Context &context;
 
   VkBuffer buffer;
-  VkDeviceMemory memory;
+  MemoryAllocator::Allocation allocation;
   VkDeviceAddress deviceAddress = 0;
-
-  bool staging = false; // staging buffers need to be explicitly cleaned
-                        // otherwise there are validation layer complaints
 };
 
 #endif // TOXENGINE_ENGINE_BUFFER_H_
@@ -33,7 +33,11 @@ public:
       VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
       VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,
       VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
-      VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME};
+      VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME,
+      // core in vulkan 1.2 but its feature bit only exists in
+      // VkPhysicalDeviceVulkan12Features, which can't be chained next to
+      // the per feature structs the device is created with
+      VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME};
 
   GLFWwindow *window;
   bool framebufferResized = false;
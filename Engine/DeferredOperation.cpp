@@ -0,0 +1,71 @@
+#include "DeferredOperation.h"
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+DeferredOperation::DeferredOperation(VkDevice device) : device(device) {
+  if (vkCreateDeferredOperationKHR(device, nullptr, &operation) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create deferred operation!");
+  }
+}
+
+DeferredOperation::~DeferredOperation() {
+  wait();
+  vkDestroyDeferredOperationKHR(device, operation, nullptr);
+}
+
+void DeferredOperation::start(VkResult result, unsigned maxThreads) {
+  if (result == VK_OPERATION_NOT_DEFERRED_KHR) {
+    // the driver did the work right away
+    this->result = VK_SUCCESS;
+    return;
+  } else if (result != VK_OPERATION_DEFERRED_KHR) {
+    this->result = result;
+    return;
+  }
+  deferred = true;
+
+  ThreadPool &pool = ThreadPool::shared();
+  unsigned joinerCount =
+      std::min({vkGetDeferredOperationMaxConcurrencyKHR(device, operation),
+                maxThreads, pool.size()});
+
+  VkDevice device = this->device;
+  VkDeferredOperationKHR operation = this->operation;
+  for (unsigned i = 0; i < joinerCount; i++) {
+    joiners.push_back(pool.submit([device, operation]() {
+      // THREAD_IDLE asks to join again later, THREAD_DONE and SUCCESS mean
+      // this thread is not needed anymore
+      while (vkDeferredOperationJoinKHR(device, operation) ==
+             VK_THREAD_IDLE_KHR) {
+        std::this_thread::yield();
+      }
+    }));
+  }
+}
+
+VkResult DeferredOperation::wait() {
+  if (!deferred) {
+    return result;
+  }
+
+  // pool workers may still be busy with other tasks, help out until done
+  while (vkGetDeferredOperationResultKHR(device, operation) == VK_NOT_READY) {
+    VkResult join = vkDeferredOperationJoinKHR(device, operation);
+    if (join == VK_THREAD_DONE_KHR || join == VK_THREAD_IDLE_KHR) {
+      std::this_thread::yield();
+    }
+  }
+  for (auto &joiner : joiners) {
+    joiner.wait();
+  }
+  joiners.clear();
+
+  result = vkGetDeferredOperationResultKHR(device, operation);
+  deferred = false;
+  return result;
+}
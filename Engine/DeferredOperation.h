@@ -0,0 +1,38 @@
+#ifndef TOXENGINE_ENGINE_DEFERREDOPERATION_H_
+#define TOXENGINE_ENGINE_DEFERREDOPERATION_H_
+
+#include <vulkan/vulkan.h>
+
+#include <future>
+#include <vector>
+
+// VkDeferredOperationKHR whose work is picked up by workers of the shared
+// thread pool while the creating thread goes on with something else.
+// Whatever the deferred command reads has to outlive wait().
+class DeferredOperation {
+public:
+  explicit DeferredOperation(VkDevice device);
+  // waits for the operation
+  ~DeferredOperation();
+
+  DeferredOperation(const DeferredOperation &) = delete;
+  DeferredOperation &operator=(const DeferredOperation &) = delete;
+
+  VkDeferredOperationKHR get() { return operation; }
+
+  // takes the result of the command deferred on get() and lets up to
+  // maxThreads pool workers join it
+  void start(VkResult result, unsigned maxThreads);
+  // joins from the calling thread until the operation completed and
+  // returns the result of the deferred command
+  VkResult wait();
+
+private:
+  VkDevice device;
+  VkDeferredOperationKHR operation = VK_NULL_HANDLE;
+  bool deferred = false;
+  VkResult result = VK_SUCCESS;
+  std::vector<std::future<void>> joiners;
+};
+
+#endif // TOXENGINE_ENGINE_DEFERREDOPERATION_H_
@@ -1,6 +1,7 @@
 #include "Device.h"
 
 #include "PhysicalDevice.h"
+#include "Stats.h"
 #include "TOXEngine.h"
 
 #include "vendor/nvvk/extensions_vk.hpp"
@@ -8,6 +9,12 @@
 #include <cstdint>
 #include <set>
 
+namespace {
+
+const char *PIPELINE_CACHE_PATH = "../resources/shaders/pipelines.toxcache";
+
+} // namespace
+
 Device::Device(Context *context, std::shared_ptr<PhysicalDevice> physicalDevice)
     : context(context), physicalDevice(physicalDevice) {
   create();
@@ -21,6 +28,9 @@ void Device::create() {
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
   std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(),
                                             indices.presentFamily.value()};
+  uint32_t transferFamily =
+      indices.transferFamily.value_or(indices.graphicsFamily.value());
+  uniqueQueueFamilies.insert(transferFamily);
 
   float queuePriority = 1.0f;
   for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -34,12 +44,39 @@ void Device::create() {
 
   VkPhysicalDeviceFeatures deviceFeatures{};
   deviceFeatures.samplerAnisotropy = VK_TRUE;
+  // the rasterizer's culled draws are one indirect draw per object with
+  // the object index as first instance
+  deviceFeatures.multiDrawIndirect = VK_TRUE;
+  deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+  // optional, textures fall back to uncompressed formats
+  deviceFeatures.textureCompressionBC =
+      physicalDevice->getFeatures().textureCompressionBC;
 
   VkPhysicalDeviceBufferDeviceAddressFeatures bda_features = {};
   bda_features.sType =
       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES;
   bda_features.bufferDeviceAddress = VK_TRUE;
 
+  // core in vulkan 1.2, uploads signal a timeline the renderer waits on
+  VkPhysicalDeviceTimelineSemaphoreFeatures timeline_features = {};
+  timeline_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+  timeline_features.timelineSemaphore = VK_TRUE;
+  bda_features.pNext = &timeline_features;
+
+  // core in vulkan 1.2, the bindless table needs it
+  VkPhysicalDeviceDescriptorIndexingFeatures indexing_features = {};
+  indexing_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+  indexing_features.runtimeDescriptorArray = VK_TRUE;
+  indexing_features.descriptorBindingPartiallyBound = VK_TRUE;
+  indexing_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+  indexing_features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+  indexing_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+  indexing_features.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+  indexing_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+  timeline_features.pNext = &indexing_features;
+
   VkPhysicalDeviceRayTracingPipelineFeaturesKHR rt_features = {};
   rt_features.sType =
       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR;
@@ -50,6 +87,12 @@ void Device::create() {
   as_features.sType =
       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
   as_features.accelerationStructure = VK_TRUE;
+  // optional, acceleration structures are built on the gpu without it
+  hostAccelerationStructureBuilds =
+      physicalDevice->getAccelerationStructureFeatures()
+          .accelerationStructureHostCommands;
+  as_features.accelerationStructureHostCommands =
+      hostAccelerationStructureBuilds;
   as_features.pNext = &rt_features;
 
   VkDeviceCreateInfo createInfo{};
@@ -84,9 +127,32 @@ void Device::create() {
 
   vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
   vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+  vkGetDeviceQueue(device, transferFamily, 0, &transferQueue);
+
+  allocator = std::make_unique<MemoryAllocator>(*context, device);
+  uploader = std::make_unique<UploadManager>(
+      device, *allocator, indices.graphicsFamily.value(), graphicsQueue,
+      transferFamily, transferQueue);
+  pipelineCache = std::make_unique<PipelineCache>(
+      device, physicalDevice->get(), PIPELINE_CACHE_PATH);
+  accelerationStructureBuilder =
+      std::make_unique<AccelerationStructureBuilder>(*context);
+  bindlessTable = std::make_unique<BindlessTable>(
+      device, physicalDevice->getDescriptorIndexingProperties());
 }
 
 Device::~Device() {
+  bindlessTable.reset();
+  accelerationStructureBuilder.reset();
+  pipelineCache.reset();
+  if (enableStats) {
+    uploader->printStats();
+  }
+  uploader.reset();
+  if (enableStats) {
+    allocator->printStats();
+  }
+  allocator.reset();
   vkDestroyCommandPool(device, commandPool, nullptr);
   vkDestroyDevice(device, nullptr);
 }
@@ -142,15 +208,17 @@ void Device::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
 }
 
 VkImageView Device::createImageView(VkImage image, VkFormat format,
-                                    VkImageAspectFlags aspectFlags) {
+                                    VkImageAspectFlags aspectFlags,
+                                    uint32_t mipLevels,
+                                    uint32_t baseMipLevel) {
   VkImageViewCreateInfo viewInfo{};
   viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
   viewInfo.image = image;
   viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
   viewInfo.format = format;
   viewInfo.subresourceRange.aspectMask = aspectFlags;
-  viewInfo.subresourceRange.baseMipLevel = 0;
-  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+  viewInfo.subresourceRange.levelCount = mipLevels;
   viewInfo.subresourceRange.baseArrayLayer = 0;
   viewInfo.subresourceRange.layerCount = 1;
 
@@ -188,7 +256,7 @@ void Device::copyImage(VkImage srcImage, VkImage dstImage, VkExtent2D extent,
 void Device::transitionImageLayout(VkImage image, VkImageLayout oldLayout,
                                    VkImageLayout newLayout,
                                    VkCommandBuffer commandBuffer,
-                                   bool raytracing) {
+                                   bool raytracing, uint32_t levelCount) {
   VkImageMemoryBarrier barrier{};
   barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
   barrier.oldLayout = oldLayout;
@@ -198,7 +266,7 @@ void Device::transitionImageLayout(VkImage image, VkImageLayout oldLayout,
   barrier.image = image;
   barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
   barrier.subresourceRange.baseMipLevel = 0;
-  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.levelCount = levelCount;
   barrier.subresourceRange.baseArrayLayer = 0;
   barrier.subresourceRange.layerCount = 1;
 
@@ -215,7 +283,7 @@ void Device::transitionImageLayout(VkImage image, VkImageLayout oldLayout,
 
     } else if (oldLayout == VK_IMAGE_LAYOUT_GENERAL &&
                newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
-      barrier.srcAccessMask = 0;
+      barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
       barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
     } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
@@ -225,9 +293,11 @@ void Device::transitionImageLayout(VkImage image, VkImageLayout oldLayout,
 
     } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL &&
                newLayout == VK_IMAGE_LAYOUT_GENERAL) {
+      // the next frame reads back what this one accumulated
       barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-      barrier.dstAccessMask = 0;
-      
+      barrier.dstAccessMask =
+          VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
     } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
                newLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR) {
       barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
@@ -249,6 +319,13 @@ void Device::transitionImageLayout(VkImage image, VkImageLayout oldLayout,
       barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
       barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
+      sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+      destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL &&
+               newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
       sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
       destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
     } else {
@@ -1,7 +1,12 @@
 #ifndef TOXENGINE_ENGINE_DEVICE_H_
 #define TOXENGINE_ENGINE_DEVICE_H_
 
+#include "AccelerationStructureBuilder.h"
+#include "BindlessTable.h"
+#include "MemoryAllocator.h"
 #include "PhysicalDevice.h"
+#include "PipelineCache.h"
+#include "UploadManager.h"
 
 #include <vulkan/vulkan.h>
 
@@ -18,17 +23,33 @@ public:
   VkDevice get() { return device; }
   VkQueue getGraphicsQueue() { return graphicsQueue; }
   VkQueue getPresentQueue() { return presentQueue; }
+  // the graphics queue when there is no dedicated transfer family
+  VkQueue getTransferQueue() { return transferQueue; }
   VkCommandPool getCommandPool() { return commandPool; }
+  MemoryAllocator &getAllocator() { return *allocator; }
+  UploadManager &getUploader() { return *uploader; }
+  VkPipelineCache getPipelineCache() { return pipelineCache->get(); }
+  AccelerationStructureBuilder &getAccelerationStructureBuilder() {
+    return *accelerationStructureBuilder;
+  }
+  BindlessTable &getBindlessTable() { return *bindlessTable; }
+  // vkBuildAccelerationStructuresKHR and friends can be used
+  bool hasHostAccelerationStructureBuilds() {
+    return hostAccelerationStructureBuilds;
+  }
   void waitIdle();
   VkCommandBuffer beginSingleTimeCommands();
   void endSingleTimeCommands(VkCommandBuffer commandBuffer);
   VkImageView createImageView(VkImage image, VkFormat format,
-                              VkImageAspectFlags aspectFlags);
+                              VkImageAspectFlags aspectFlags,
+                              uint32_t mipLevels = 1,
+                              uint32_t baseMipLevel = 0);
   void copyImage(VkImage srcImage, VkImage dstImage, VkExtent2D extent,
                  VkCommandBuffer commandBuffer);
   void transitionImageLayout(VkImage image, VkImageLayout oldLayout,
                              VkImageLayout newLayout,
-                             VkCommandBuffer commandBuffer, bool raytracing = false);
+                             VkCommandBuffer commandBuffer, bool raytracing = false,
+                             uint32_t levelCount = 1);
 
 private:
   void create();
@@ -39,8 +60,15 @@ private:
   VkDevice device;
   VkQueue graphicsQueue;
   VkQueue presentQueue;
+  VkQueue transferQueue;
   VkCommandPool commandPool;
   std::shared_ptr<PhysicalDevice> physicalDevice;
+  std::unique_ptr<MemoryAllocator> allocator;
+  std::unique_ptr<UploadManager> uploader;
+  std::unique_ptr<PipelineCache> pipelineCache;
+  std::unique_ptr<AccelerationStructureBuilder> accelerationStructureBuilder;
+  std::unique_ptr<BindlessTable> bindlessTable;
+  bool hostAccelerationStructureBuilds = false;
 };
 
 #endif // TOXENGINE_ENGINE_DEVICE_H_
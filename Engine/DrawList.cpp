@@ -0,0 +1,55 @@
+#include "DrawList.h"
+
+#include "Context.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+DrawList::DrawList(Context &context) : context(context) {
+  for (size_t i = 0; i < context.MAX_FRAMES_IN_FLIGHT; i++) {
+    objects.push_back(std::make_unique<Buffer>(
+        context, Buffer::Type::Instance, sizeof(Object) * MAX_OBJECTS));
+  }
+  dirty.resize(objects.size(), {0, 0});
+}
+
+uint32_t DrawList::add(const glm::mat4 &transform) {
+  if (data.size() >= MAX_OBJECTS) {
+    throw std::runtime_error("failed to add object, draw list is full!");
+  }
+  data.push_back({transform});
+  uint32_t object = static_cast<uint32_t>(data.size() - 1);
+  markDirty(object);
+  return object;
+}
+
+void DrawList::setTransform(uint32_t object, const glm::mat4 &transform) {
+  if (object >= data.size()) {
+    throw std::runtime_error("failed to set transform, unknown object!");
+  }
+  data[object].transform = transform;
+  markDirty(object);
+}
+
+void DrawList::update(uint32_t currentFrame) {
+  Range &range = dirty[currentFrame];
+  if (range.begin == range.end) {
+    return;
+  }
+  // the frame's fence was waited on, nothing reads this buffer anymore
+  objects[currentFrame]->upload(&data[range.begin],
+                                sizeof(Object) * (range.end - range.begin),
+                                sizeof(Object) * range.begin);
+  range = {0, 0};
+}
+
+void DrawList::markDirty(uint32_t object) {
+  for (Range &range : dirty) {
+    if (range.begin == range.end) {
+      range = {object, object + 1};
+    } else {
+      range.begin = std::min(range.begin, object);
+      range.end = std::max(range.end, object + 1);
+    }
+  }
+}
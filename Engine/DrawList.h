@@ -0,0 +1,63 @@
+#ifndef TOXENGINE_ENGINE_DRAWLIST_H_
+#define TOXENGINE_ENGINE_DRAWLIST_H_
+
+#include "Buffer.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Context;
+
+// Instances of the rasterized model. The cull pass reads every object from
+// a persistently mapped storage buffer, tests its bounding sphere against
+// the frustum and writes the visible ones as indirect draws, so recording
+// a frame costs the same whatever the object count. Transforms are kept on
+// the host and copied into the recorded frame's own buffer, frames in
+// flight keep reading the ones they were recorded with. Each buffer only
+// receives the range of objects changed since it was last written.
+class DrawList {
+public:
+  static constexpr uint32_t MAX_OBJECTS = 1 << 17;
+
+  // matches the cull and vertex shaders' object buffer
+  struct Object {
+    glm::mat4 transform;
+  };
+
+  explicit DrawList(Context &context);
+
+  DrawList(const DrawList &) = delete;
+  DrawList &operator=(const DrawList &) = delete;
+
+  // returns the object index
+  uint32_t add(const glm::mat4 &transform);
+  void setTransform(uint32_t object, const glm::mat4 &transform);
+
+  // copies the objects from the first to the last one changed since the
+  // frame's buffer was last written, its fence has to be waited on
+  void update(uint32_t currentFrame);
+
+  uint32_t getCount() const { return static_cast<uint32_t>(data.size()); }
+  Buffer &getObjects(uint32_t currentFrame) { return *objects[currentFrame]; }
+
+private:
+  Context &context;
+
+  // objects [begin, end) a frame's buffer is missing
+  struct Range {
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  std::vector<Object> data;
+  // one per frame in flight
+  std::vector<std::unique_ptr<Buffer>> objects;
+  std::vector<Range> dirty;
+
+  void markDirty(uint32_t object);
+};
+
+#endif // TOXENGINE_ENGINE_DRAWLIST_H_
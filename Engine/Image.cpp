@@ -2,8 +2,9 @@
 
 #include "TOXEngine.h"
 
-Image::Image(Context &context, uint32_t width, uint32_t height, Type type)
-    : context(context) {
+Image::Image(Context &context, uint32_t width, uint32_t height, Type type,
+             uint32_t mipLevels, VkFormat textureFormat)
+    : context(context), mipLevels(mipLevels) {
   VkImageTiling tiling;
   VkImageUsageFlags usage;
   VkMemoryPropertyFlags properties;
@@ -13,15 +14,25 @@ Image::Image(Context &context, uint32_t width, uint32_t height, Type type)
         {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT,
          VK_FORMAT_D24_UNORM_S8_UINT},
         VK_IMAGE_TILING_OPTIMAL,
-        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT |
+            VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
     tiling = VK_IMAGE_TILING_OPTIMAL;
-    usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    // read back to build the depth pyramid
+    usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+            VK_IMAGE_USAGE_SAMPLED_BIT;
+    properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    break;
+  case Type::DepthPyramid:
+    format = VK_FORMAT_R32_SFLOAT;
+    tiling = VK_IMAGE_TILING_OPTIMAL;
+    usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
     properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     break;
   case Type::Texture:
-    format = VK_FORMAT_R8G8B8A8_SRGB;
+    format = textureFormat;
     tiling = VK_IMAGE_TILING_OPTIMAL;
-    usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+            VK_IMAGE_USAGE_SAMPLED_BIT;
     properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     break;
   case Type::RTOutputImage:
@@ -39,7 +50,7 @@ Image::Image(Context &context, uint32_t width, uint32_t height, Type type)
   imageInfo.extent.width = width;
   imageInfo.extent.height = height;
   imageInfo.extent.depth = 1;
-  imageInfo.mipLevels = 1;
+  imageInfo.mipLevels = mipLevels;
   imageInfo.arrayLayers = 1;
   imageInfo.format = format;
   imageInfo.tiling = tiling;
@@ -53,30 +64,17 @@ Image::Image(Context &context, uint32_t width, uint32_t height, Type type)
     throw std::runtime_error("failed to create image!");
   }
 
-  VkMemoryRequirements memRequirements;
-  vkGetImageMemoryRequirements(context.device->get(), image, &memRequirements);
-
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = context.physicalDevice->findMemoryType(
-      memRequirements.memoryTypeBits, properties);
-
-  if (vkAllocateMemory(context.device->get(), &allocInfo, nullptr, &memory) !=
-      VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate image memory!");
-  }
-
-  vkBindImageMemory(context.device->get(), image, memory, 0);
+  allocation = context.device->getAllocator().allocate(image, properties);
 }
 
 Image::~Image() {
   vkDestroyImage(context.device->get(), image, nullptr);
-  vkFreeMemory(context.device->get(), memory, nullptr);
+  context.device->getAllocator().free(allocation);
 }
 
 VkImageView Image::createImageView(VkImageAspectFlags aspectFlags) {
-  return context.device->createImageView(image, format, aspectFlags);
+  return context.device->createImageView(image, format, aspectFlags,
+                                         mipLevels);
 }
 
 void Image::transitionLayout(VkImageLayout oldLayout, VkImageLayout newLayout, bool raytracing) {
@@ -90,25 +88,72 @@ void Image::transitionLayout(VkImageLayout oldLayout, VkImageLayout newLayout, b
 void Image::transitionLayout(VkImageLayout oldLayout, VkImageLayout newLayout,
                              VkCommandBuffer commandBuffer, bool raytracing) {
   context.device->transitionImageLayout(image, oldLayout, newLayout,
-                                        commandBuffer, raytracing);
+                                        commandBuffer, raytracing, mipLevels);
 }
 
-void Image::copyBuffer(VkBuffer buffer, uint32_t width, uint32_t height) {
+void Image::copyToBuffer(VkBuffer buffer,
+                         const std::vector<VkBufferImageCopy> &regions) {
   VkCommandBuffer commandBuffer = context.device->beginSingleTimeCommands();
 
-  VkBufferImageCopy region{};
-  region.bufferOffset = 0;
-  region.bufferRowLength = 0;
-  region.bufferImageHeight = 0;
-  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  region.imageSubresource.mipLevel = 0;
-  region.imageSubresource.baseArrayLayer = 0;
-  region.imageSubresource.layerCount = 1;
-  region.imageOffset = {0, 0, 0};
-  region.imageExtent = {width, height, 1};
-
-  vkCmdCopyBufferToImage(commandBuffer, buffer, image,
-                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+  vkCmdCopyImageToBuffer(commandBuffer, image,
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer,
+                         static_cast<uint32_t>(regions.size()),
+                         regions.data());
+
+  context.device->endSingleTimeCommands(commandBuffer);
+}
+
+void Image::generateMipmaps(uint32_t width, uint32_t height) {
+  VkCommandBuffer commandBuffer = context.device->beginSingleTimeCommands();
+
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.image = image;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+  int32_t mipWidth = static_cast<int32_t>(width);
+  int32_t mipHeight = static_cast<int32_t>(height);
+  for (uint32_t i = 1; i < mipLevels; i++) {
+    // the previous level is complete, read from it
+    barrier.subresourceRange.baseMipLevel = i - 1;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+
+    VkImageBlit blit{};
+    blit.srcOffsets[0] = {0, 0, 0};
+    blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
+    blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.srcSubresource.mipLevel = i - 1;
+    blit.srcSubresource.baseArrayLayer = 0;
+    blit.srcSubresource.layerCount = 1;
+    mipWidth = mipWidth > 1 ? mipWidth / 2 : 1;
+    mipHeight = mipHeight > 1 ? mipHeight / 2 : 1;
+    blit.dstOffsets[0] = {0, 0, 0};
+    blit.dstOffsets[1] = {mipWidth, mipHeight, 1};
+    blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.dstSubresource.mipLevel = i;
+    blit.dstSubresource.baseArrayLayer = 0;
+    blit.dstSubresource.layerCount = 1;
+
+    vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                   VK_FILTER_LINEAR);
+  }
+
+  barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
 
   context.device->endSingleTimeCommands(commandBuffer);
 }
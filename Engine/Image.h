@@ -1,34 +1,47 @@
 #ifndef TOXENGINE_ENGINE_IMAGE_H_
 #define TOXENGINE_ENGINE_IMAGE_H_
 
+#include "MemoryAllocator.h"
+
 #include <vulkan/vulkan.h>
 
 #include <cstdint>
+#include <vector>
 
 class Context;
 
 class Image {
 public:
-  enum class Type { Depth, Texture, RTOutputImage };
+  // the depth pyramid holds the farthest depth of each texel's area, every
+  // level is written by a compute pass
+  enum class Type { Depth, DepthPyramid, Texture, RTOutputImage };
 
-  Image(Context &context, uint32_t width, uint32_t height, Type type);
+  Image(Context &context, uint32_t width, uint32_t height, Type type,
+        uint32_t mipLevels = 1,
+        VkFormat textureFormat = VK_FORMAT_R8G8B8A8_SRGB);
   ~Image();
 
   VkImage get() { return image; }
   VkFormat getFormat() { return format; }
+  uint32_t getMipLevels() { return mipLevels; }
   VkImageView createImageView(VkImageAspectFlags aspectFlags);
   void transitionLayout(VkImageLayout oldLayout, VkImageLayout newLayout,
                         bool raytracing = false);
   void transitionLayout(VkImageLayout oldLayout, VkImageLayout newLayout,
                         VkCommandBuffer commandBuffer, bool raytracing = false);
-  void copyBuffer(VkBuffer buffer, uint32_t width, uint32_t height);
+  void copyToBuffer(VkBuffer buffer,
+                    const std::vector<VkBufferImageCopy> &regions);
+  // fills levels 1.. by linear blits from level 0 in TRANSFER_DST_OPTIMAL,
+  // afterwards every level is in TRANSFER_SRC_OPTIMAL
+  void generateMipmaps(uint32_t width, uint32_t height);
 
 private:
   Context &context;
 
   VkImage image;
-  VkDeviceMemory memory;
+  MemoryAllocator::Allocation allocation;
   VkFormat format;
+  uint32_t mipLevels;
 };
 
 #endif // TOXENGINE_ENGINE_IMAGE_H_
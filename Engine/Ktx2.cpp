@@ -0,0 +1,280 @@
+#include "Ktx2.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+const uint8_t IDENTIFIER[12] = {0xab, 'K', 'T',  'X',  ' ',  '2',
+                                '0',  0xbb, '\r', '\n', 0x1a, '\n'};
+
+struct Header {
+  uint8_t identifier[12];
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t layerCount;
+  uint32_t faceCount;
+  uint32_t levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset;
+  uint32_t dfdByteLength;
+  uint32_t kvdByteOffset;
+  uint32_t kvdByteLength;
+  uint64_t sgdByteOffset;
+  uint64_t sgdByteLength;
+};
+static_assert(sizeof(Header) == 80, "ktx2 header must be packed");
+
+struct LevelIndex {
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+// data format descriptor values from the Khronos Data Format spec
+constexpr uint32_t MODEL_RGBSDA = 1;
+constexpr uint32_t MODEL_BC1A = 128;
+constexpr uint32_t MODEL_BC5 = 132;
+constexpr uint32_t MODEL_BC7 = 134;
+constexpr uint32_t PRIMARIES_BT709 = 1;
+constexpr uint32_t TRANSFER_LINEAR = 1;
+constexpr uint32_t TRANSFER_SRGB = 2;
+constexpr uint32_t CHANNEL_ALPHA = 15;
+constexpr uint32_t QUALIFIER_LINEAR = 1 << 4;
+
+struct Sample {
+  uint32_t bitOffset;
+  uint32_t bitLength;
+  uint32_t channel;
+  uint32_t upper;
+};
+
+uint32_t alignUp(uint32_t value, uint32_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// basic data format descriptor including the leading total size
+bool describe(VkFormat format, std::vector<uint32_t> &dfd,
+              uint32_t &blockBytes) {
+  uint32_t model;
+  uint32_t transfer = TRANSFER_LINEAR;
+  uint32_t blockDimension = 0;
+  std::vector<Sample> samples;
+
+  switch (format) {
+  case VK_FORMAT_R8G8B8A8_SRGB:
+    transfer = TRANSFER_SRGB;
+    [[fallthrough]];
+  case VK_FORMAT_R8G8B8A8_UNORM:
+    model = MODEL_RGBSDA;
+    blockBytes = 4;
+    samples = {{0, 8, 0, 255},
+               {8, 8, 1, 255},
+               {16, 8, 2, 255},
+               {24, 8, CHANNEL_ALPHA, 255}};
+    break;
+  case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    transfer = TRANSFER_SRGB;
+    [[fallthrough]];
+  case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    model = MODEL_BC1A;
+    blockBytes = 8;
+    blockDimension = 0x00000303;
+    samples = {{0, 64, 0, 0xffffffff}};
+    break;
+  case VK_FORMAT_BC5_UNORM_BLOCK:
+    model = MODEL_BC5;
+    blockBytes = 16;
+    blockDimension = 0x00000303;
+    samples = {{0, 64, 0, 0xffffffff}, {64, 64, 1, 0xffffffff}};
+    break;
+  case VK_FORMAT_BC7_SRGB_BLOCK:
+    transfer = TRANSFER_SRGB;
+    [[fallthrough]];
+  case VK_FORMAT_BC7_UNORM_BLOCK:
+    model = MODEL_BC7;
+    blockBytes = 16;
+    blockDimension = 0x00000303;
+    samples = {{0, 128, 0, 0xffffffff}};
+    break;
+  default:
+    return false;
+  }
+
+  uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+  dfd = {4 + blockSize,
+         0,
+         2 | (blockSize << 16),
+         model | (PRIMARIES_BT709 << 8) | (transfer << 16),
+         blockDimension,
+         blockBytes,
+         0};
+  for (const Sample &sample : samples) {
+    uint32_t channel = sample.channel;
+    if (transfer == TRANSFER_SRGB && channel == CHANNEL_ALPHA) {
+      channel |= QUALIFIER_LINEAR;
+    }
+    dfd.push_back(sample.bitOffset | ((sample.bitLength - 1) << 16) |
+                  (channel << 24));
+    dfd.push_back(0);
+    dfd.push_back(0);
+    dfd.push_back(sample.upper);
+  }
+  return true;
+}
+
+} // namespace
+
+Ktx2::Ktx2(const std::string &path) {
+  file = std::make_unique<MappedFile>(path);
+  if (!file->isOpen() || file->size() < sizeof(Header)) {
+    file.reset();
+    return;
+  }
+
+  const Header *header = reinterpret_cast<const Header *>(file->data());
+  if (memcmp(header->identifier, IDENTIFIER, sizeof(IDENTIFIER)) != 0 ||
+      header->supercompressionScheme != 0 || header->pixelDepth != 0 ||
+      header->layerCount > 1 || header->faceCount != 1 ||
+      header->levelCount == 0 ||
+      sizeof(Header) + header->levelCount * sizeof(LevelIndex) >
+          file->size() ||
+      uint64_t(header->kvdByteOffset) + header->kvdByteLength >
+          file->size()) {
+    file.reset();
+    return;
+  }
+
+  const LevelIndex *index =
+      reinterpret_cast<const LevelIndex *>(file->data() + sizeof(Header));
+  levels.resize(header->levelCount);
+  for (uint32_t i = 0; i < header->levelCount; i++) {
+    if (index[i].byteOffset + index[i].byteLength > file->size()) {
+      file.reset();
+      levels.clear();
+      return;
+    }
+    levels[i] = {std::max(header->pixelWidth >> i, 1u),
+                 std::max(header->pixelHeight >> i, 1u), index[i].byteOffset,
+                 index[i].byteLength};
+  }
+
+  format = static_cast<VkFormat>(header->vkFormat);
+  kvdOffset = header->kvdByteOffset;
+  kvdLength = header->kvdByteLength;
+}
+
+const void *Ktx2::value(const std::string &key, size_t &size) const {
+  const uint8_t *entry = file->data() + kvdOffset;
+  const uint8_t *end = entry + kvdLength;
+
+  while (entry + sizeof(uint32_t) <= end) {
+    uint32_t length;
+    memcpy(&length, entry, sizeof(length));
+    const char *pair = reinterpret_cast<const char *>(entry + sizeof(length));
+    if (length > static_cast<size_t>(end - entry) - sizeof(length)) {
+      break;
+    }
+
+    size_t keyLength = strnlen(pair, length);
+    if (keyLength < length && key == std::string(pair, keyLength)) {
+      size = length - keyLength - 1;
+      return pair + keyLength + 1;
+    }
+    entry += alignUp(sizeof(length) + length, 4);
+  }
+  return nullptr;
+}
+
+bool Ktx2::write(const std::string &path, VkFormat format,
+                 const std::vector<MipChain::Level> &levels,
+                 const uint8_t *data,
+                 const std::vector<KeyValue> &keyValues) {
+  std::vector<uint32_t> dfd;
+  uint32_t blockBytes;
+  if (levels.empty() || !describe(format, dfd, blockBytes)) {
+    return false;
+  }
+
+  std::vector<KeyValue> sorted = keyValues;
+  std::sort(sorted.begin(), sorted.end(),
+            [](const KeyValue &a, const KeyValue &b) { return a.key < b.key; });
+  std::vector<uint8_t> kvd;
+  for (const KeyValue &keyValue : sorted) {
+    uint32_t length =
+        static_cast<uint32_t>(keyValue.key.size() + 1 + keyValue.size);
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&length);
+    kvd.insert(kvd.end(), bytes, bytes + sizeof(length));
+    kvd.insert(kvd.end(), keyValue.key.begin(), keyValue.key.end());
+    kvd.push_back(0);
+    bytes = static_cast<const uint8_t *>(keyValue.data);
+    kvd.insert(kvd.end(), bytes, bytes + keyValue.size);
+    kvd.resize(alignUp(static_cast<uint32_t>(kvd.size()), 4), 0);
+  }
+
+  Header header{};
+  memcpy(header.identifier, IDENTIFIER, sizeof(IDENTIFIER));
+  header.vkFormat = format;
+  header.typeSize = 1;
+  header.pixelWidth = levels[0].width;
+  header.pixelHeight = levels[0].height;
+  header.faceCount = 1;
+  header.levelCount = static_cast<uint32_t>(levels.size());
+  header.dfdByteOffset = static_cast<uint32_t>(
+      sizeof(Header) + levels.size() * sizeof(LevelIndex));
+  header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+  if (!kvd.empty()) {
+    header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+    header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+  }
+
+  // smallest level first, aligned to the texel block which is a multiple
+  // of four bytes for every supported format
+  uint64_t dataOffset = header.dfdByteOffset + header.dfdByteLength +
+                        header.kvdByteLength;
+  std::vector<LevelIndex> index(levels.size());
+  uint64_t offset = dataOffset;
+  for (size_t i = levels.size(); i-- > 0;) {
+    offset = (offset + blockBytes - 1) / blockBytes * blockBytes;
+    index[i] = {offset, levels[i].size, levels[i].size};
+    offset += levels[i].size;
+  }
+
+  // write to a temporary file first so readers never map a partial file
+  std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      return false;
+    }
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(index.data()),
+               index.size() * sizeof(LevelIndex));
+    file.write(reinterpret_cast<const char *>(dfd.data()),
+               header.dfdByteLength);
+    file.write(reinterpret_cast<const char *>(kvd.data()), kvd.size());
+    uint64_t written = dataOffset;
+
+    const char padding[16] = {};
+    for (size_t i = levels.size(); i-- > 0;) {
+      file.write(padding, index[i].byteOffset - written);
+      file.write(reinterpret_cast<const char *>(data + levels[i].offset),
+                 levels[i].size);
+      written = index[i].byteOffset + levels[i].size;
+    }
+
+    if (!file.good()) {
+      file.close();
+      std::remove(tmpPath.c_str());
+      return false;
+    }
+  }
+
+  return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,53 @@
+#ifndef TOXENGINE_ENGINE_KTX2_H_
+#define TOXENGINE_ENGINE_KTX2_H_
+
+#include "MappedFile.h"
+#include "MipChain.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// KTX 2.0 container for a single 2D image with mips and without
+// supercompression. The file is memory-mapped, level offsets point into it
+// so the whole file can be staged and copied level by level.
+class Ktx2 {
+public:
+  struct KeyValue {
+    std::string key;
+    const void *data;
+    size_t size;
+  };
+
+  Ktx2(const std::string &path);
+
+  Ktx2(const Ktx2 &) = delete;
+  Ktx2 &operator=(const Ktx2 &) = delete;
+
+  bool isValid() const { return file != nullptr; }
+  VkFormat getFormat() const { return format; }
+  const std::vector<MipChain::Level> &getLevels() const { return levels; }
+  const uint8_t *data() const { return file->data(); }
+  size_t size() const { return file->size(); }
+  // value of a key/value entry, nullptr when missing
+  const void *value(const std::string &key, size_t &size) const;
+
+  // levels index into data, only 8 bit RGBA and BC1, BC5 and BC7 formats
+  static bool write(const std::string &path, VkFormat format,
+                    const std::vector<MipChain::Level> &levels,
+                    const uint8_t *data,
+                    const std::vector<KeyValue> &keyValues);
+
+private:
+  std::unique_ptr<MappedFile> file;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  std::vector<MipChain::Level> levels;
+  uint32_t kvdOffset = 0;
+  uint32_t kvdLength = 0;
+};
+
+#endif // TOXENGINE_ENGINE_KTX2_H_
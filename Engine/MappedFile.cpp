@@ -0,0 +1,37 @@
+#include "MappedFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return;
+  }
+
+  size_t size = static_cast<size_t>(st.st_size);
+  void *result = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (result == MAP_FAILED) {
+    return;
+  }
+  madvise(result, size, MADV_WILLNEED);
+
+  mapped = static_cast<const uint8_t *>(result);
+  mappedSize = size;
+}
+
+MappedFile::~MappedFile() {
+  if (mapped) {
+    munmap(const_cast<uint8_t *>(mapped), mappedSize);
+  }
+}
@@ -0,0 +1,26 @@
+#ifndef TOXENGINE_ENGINE_MAPPEDFILE_H_
+#define TOXENGINE_ENGINE_MAPPEDFILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// read only memory mapping of a whole file
+class MappedFile {
+public:
+  MappedFile(const std::string &path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool isOpen() const { return mapped != nullptr; }
+  const uint8_t *data() const { return mapped; }
+  size_t size() const { return mappedSize; }
+
+private:
+  const uint8_t *mapped = nullptr;
+  size_t mappedSize = 0;
+};
+
+#endif // TOXENGINE_ENGINE_MAPPEDFILE_H_
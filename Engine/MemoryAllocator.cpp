@@ -0,0 +1,270 @@
+#include "MemoryAllocator.h"
+
+#include "Stats.h"
+#include "TOXEngine.h"
+
+#include <algorithm>
+#include <iostream>
+
+struct MemoryAllocator::Block {
+  VkDeviceMemory memory;
+  uint32_t memoryType;
+  bool optimal;
+  void *mapped;
+  Tlsf tlsf;
+};
+
+MemoryAllocator::MemoryAllocator(Context &context, VkDevice device)
+    : context(context), device(device) {
+  vkGetPhysicalDeviceMemoryProperties(context.physicalDevice->get(),
+                                      &memoryProperties);
+
+  // without resizable bar the host visible part of a discrete gpu is a
+  // separate 256 MiB heap, too small to hold meshes
+  uint32_t memoryType;
+  if (context.physicalDevice->findMemoryType(
+          ~0u,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+          memoryType)) {
+    VkDeviceSize largest = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+      if (memoryProperties.memoryHeaps[i].flags &
+          VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+        largest = std::max(largest, memoryProperties.memoryHeaps[i].size);
+      }
+    }
+    uint32_t heap = memoryProperties.memoryTypes[memoryType].heapIndex;
+    directUpload = memoryProperties.memoryHeaps[heap].size == largest;
+  }
+  if (enableStats && directUpload) {
+    std::cout << "device local memory is host visible, uploading directly"
+              << std::endl;
+  }
+}
+
+MemoryAllocator::~MemoryAllocator() {
+  for (auto &block : blocks) {
+    vkFreeMemory(device, block->memory, nullptr);
+  }
+}
+
+MemoryAllocator::Allocation
+MemoryAllocator::allocate(VkBuffer buffer, VkMemoryPropertyFlags properties,
+                          VkMemoryPropertyFlags preferred) {
+  VkBufferMemoryRequirementsInfo2 info{};
+  info.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+  info.buffer = buffer;
+
+  VkMemoryDedicatedRequirements dedicatedRequirements{};
+  dedicatedRequirements.sType =
+      VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+  VkMemoryRequirements2 requirements{};
+  requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+  requirements.pNext = &dedicatedRequirements;
+  vkGetBufferMemoryRequirements2(device, &info, &requirements);
+
+  VkMemoryDedicatedAllocateInfo dedicated{};
+  dedicated.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+  dedicated.buffer = buffer;
+
+  Allocation allocation = allocate(
+      requirements.memoryRequirements, properties, preferred, false, dedicated,
+      dedicatedRequirements.prefersDedicatedAllocation ||
+          dedicatedRequirements.requiresDedicatedAllocation);
+  vkBindBufferMemory(device, buffer, allocation.memory,
+                     allocation.offset);
+  return allocation;
+}
+
+MemoryAllocator::Allocation
+MemoryAllocator::allocate(VkImage image, VkMemoryPropertyFlags properties) {
+  VkImageMemoryRequirementsInfo2 info{};
+  info.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+  info.image = image;
+
+  VkMemoryDedicatedRequirements dedicatedRequirements{};
+  dedicatedRequirements.sType =
+      VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+  VkMemoryRequirements2 requirements{};
+  requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+  requirements.pNext = &dedicatedRequirements;
+  vkGetImageMemoryRequirements2(device, &info, &requirements);
+
+  VkMemoryDedicatedAllocateInfo dedicated{};
+  dedicated.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+  dedicated.image = image;
+
+  Allocation allocation = allocate(
+      requirements.memoryRequirements, properties, 0, true, dedicated,
+      dedicatedRequirements.prefersDedicatedAllocation ||
+          dedicatedRequirements.requiresDedicatedAllocation);
+  vkBindImageMemory(device, image, allocation.memory,
+                    allocation.offset);
+  return allocation;
+}
+
+MemoryAllocator::Allocation
+MemoryAllocator::allocate(const VkMemoryRequirements &requirements,
+                          VkMemoryPropertyFlags properties,
+                          VkMemoryPropertyFlags preferred, bool optimal,
+                          const VkMemoryDedicatedAllocateInfo &dedicated,
+                          bool prefersDedicated) {
+  uint32_t memoryType;
+  if (!preferred || !context.physicalDevice->findMemoryType(
+                        requirements.memoryTypeBits, properties | preferred,
+                        memoryType)) {
+    memoryType = context.physicalDevice->findMemoryType(
+        requirements.memoryTypeBits, properties);
+  }
+  VkDeviceSize heapSize =
+      memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType]
+                                       .heapIndex]
+          .size;
+  VkDeviceSize blockSize = std::min(BLOCK_SIZE, heapSize / 8);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  Allocation allocation;
+
+  if (prefersDedicated || requirements.size > blockSize / 2) {
+    allocation.memory = allocateMemory(requirements.size, memoryType, !optimal,
+                                       &dedicated, &allocation.mapped);
+    allocation.size = requirements.size;
+    dedicatedCount++;
+    dedicatedBytes += requirements.size;
+    return allocation;
+  }
+
+  uint64_t offset;
+  for (auto &block : blocks) {
+    if (block->memoryType != memoryType || block->optimal != optimal) {
+      continue;
+    }
+    uint32_t region = block->tlsf.allocate(requirements.size,
+                                           requirements.alignment, offset);
+    if (region != Tlsf::INVALID) {
+      allocation.block = block.get();
+      allocation.region = region;
+      break;
+    }
+  }
+
+  if (!allocation.block) {
+    void *mapped = nullptr;
+    VkDeviceMemory memory =
+        allocateMemory(blockSize, memoryType, !optimal, nullptr, &mapped);
+    blocks.push_back(std::unique_ptr<Block>(
+        new Block{memory, memoryType, optimal, mapped, Tlsf(blockSize)}));
+
+    allocation.block = blocks.back().get();
+    allocation.region = allocation.block->tlsf.allocate(
+        requirements.size, requirements.alignment, offset);
+    if (allocation.region == Tlsf::INVALID) {
+      throw std::runtime_error("failed to sub-allocate device memory!");
+    }
+  }
+
+  allocation.memory = allocation.block->memory;
+  allocation.offset = offset;
+  allocation.size = requirements.size;
+  if (allocation.block->mapped) {
+    allocation.mapped =
+        static_cast<uint8_t *>(allocation.block->mapped) + offset;
+  }
+  return allocation;
+}
+
+VkDeviceMemory
+MemoryAllocator::allocateMemory(VkDeviceSize size, uint32_t memoryType,
+                                bool deviceAddress,
+                                const VkMemoryDedicatedAllocateInfo *dedicated,
+                                void **mapped) {
+  VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+  if (dedicated) {
+    dedicatedInfo = *dedicated;
+  }
+
+  VkMemoryAllocateFlagsInfo flagsInfo{};
+  flagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+  flagsInfo.flags = deviceAddress ? VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT : 0;
+  flagsInfo.pNext = dedicated ? &dedicatedInfo : nullptr;
+
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = size;
+  allocInfo.memoryTypeIndex = memoryType;
+  allocInfo.pNext = &flagsInfo;
+
+  VkDeviceMemory memory;
+  if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate device memory!");
+  }
+
+  *mapped = nullptr;
+  if (memoryProperties.memoryTypes[memoryType].propertyFlags &
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped);
+  }
+  return memory;
+}
+
+void MemoryAllocator::free(Allocation &allocation) {
+  if (allocation.memory == VK_NULL_HANDLE) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!allocation.block) {
+    vkFreeMemory(device, allocation.memory, nullptr);
+    dedicatedCount--;
+    dedicatedBytes -= allocation.size;
+    allocation = Allocation();
+    return;
+  }
+
+  Block *block = allocation.block;
+  block->tlsf.free(allocation.region);
+  allocation = Allocation();
+
+  // keep one empty block per memory type around for the next allocation
+  if (block->tlsf.getAllocationCount() == 0) {
+    for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+      Block *other = it->get();
+      if (other != block && other->memoryType == block->memoryType &&
+          other->optimal == block->optimal &&
+          other->tlsf.getAllocationCount() == 0) {
+        vkFreeMemory(device, other->memory, nullptr);
+        blocks.erase(it);
+        break;
+      }
+    }
+  }
+}
+
+MemoryAllocator::Stats MemoryAllocator::getStats() {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  Stats stats{};
+  stats.blockCount = static_cast<uint32_t>(blocks.size());
+  stats.dedicatedCount = dedicatedCount;
+  stats.allocationCount = dedicatedCount;
+  stats.dedicatedBytes = dedicatedBytes;
+  for (auto &block : blocks) {
+    stats.allocationCount += block->tlsf.getAllocationCount();
+    stats.blockBytes += block->tlsf.getSize();
+    stats.usedBytes += block->tlsf.getUsed();
+  }
+  return stats;
+}
+
+void MemoryAllocator::printStats() {
+  Stats stats = getStats();
+  std::cout << "device memory: " << stats.allocationCount << " allocations in "
+            << stats.blockCount << " blocks ("
+            << stats.usedBytes / (1 << 20) << " of "
+            << stats.blockBytes / (1 << 20) << " MiB used) and "
+            << stats.dedicatedCount << " dedicated ("
+            << stats.dedicatedBytes / (1 << 20) << " MiB)" << std::endl;
+}
@@ -0,0 +1,84 @@
+#ifndef TOXENGINE_ENGINE_MEMORYALLOCATOR_H_
+#define TOXENGINE_ENGINE_MEMORYALLOCATOR_H_
+
+#include "Tlsf.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Context;
+
+// Sub-allocates buffers and images from large device memory blocks, one
+// set of blocks per memory type. Buffers and optimal images never share a
+// block, which keeps them bufferImageGranularity apart. Resources larger
+// than half a block and those the driver prefers dedicated get their own
+// allocation. Host visible memory stays mapped for its whole lifetime.
+class MemoryAllocator {
+public:
+  // smaller on heaps below eight blocks
+  static constexpr VkDeviceSize BLOCK_SIZE = 64ull << 20;
+
+  struct Block;
+
+  struct Allocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void *mapped = nullptr;
+    Block *block = nullptr; // nullptr for dedicated allocations
+    uint32_t region = Tlsf::INVALID;
+  };
+
+  struct Stats {
+    uint32_t blockCount;
+    uint32_t dedicatedCount;
+    uint32_t allocationCount;
+    VkDeviceSize blockBytes;
+    VkDeviceSize usedBytes;
+    VkDeviceSize dedicatedBytes;
+  };
+
+  MemoryAllocator(Context &context, VkDevice device);
+  ~MemoryAllocator();
+
+  // allocate and bind memory, preferred properties are dropped when no
+  // memory type has them
+  Allocation allocate(VkBuffer buffer, VkMemoryPropertyFlags properties,
+                      VkMemoryPropertyFlags preferred = 0);
+  Allocation allocate(VkImage image, VkMemoryPropertyFlags properties);
+  void free(Allocation &allocation);
+
+  // device local memory can be written by the host without limits, the
+  // case with resizable bar and unified memory
+  bool hasDirectUpload() { return directUpload; }
+
+  Stats getStats();
+  void printStats();
+
+private:
+  Context &context;
+  VkDevice device;
+  std::mutex mutex;
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  bool directUpload = false;
+
+  std::vector<std::unique_ptr<Block>> blocks;
+  uint32_t dedicatedCount = 0;
+  VkDeviceSize dedicatedBytes = 0;
+
+  Allocation allocate(const VkMemoryRequirements &requirements,
+                      VkMemoryPropertyFlags properties,
+                      VkMemoryPropertyFlags preferred, bool optimal,
+                      const VkMemoryDedicatedAllocateInfo &dedicated,
+                      bool prefersDedicated);
+  VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryType,
+                                bool deviceAddress,
+                                const VkMemoryDedicatedAllocateInfo *dedicated,
+                                void **mapped);
+};
+
+#endif // TOXENGINE_ENGINE_MEMORYALLOCATOR_H_
@@ -0,0 +1,312 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+constexpr uint32_t UNUSED = std::numeric_limits<uint32_t>::max();
+
+// cache timestamps, a vertex is cached while it is at most CACHE_SIZE
+// insertions old, resetting is a jump in time
+struct CacheState {
+  std::vector<uint32_t> stamps;
+  uint32_t time = MeshOptimizer::CACHE_SIZE + 1;
+
+  explicit CacheState(size_t vertexCount) : stamps(vertexCount, 0) {}
+
+  bool cached(uint32_t vertex) const {
+    return time - stamps[vertex] <= MeshOptimizer::CACHE_SIZE;
+  }
+
+  unsigned insert(const uint32_t *triangle) {
+    unsigned misses = 0;
+    for (int corner = 0; corner < 3; corner++) {
+      if (!cached(triangle[corner])) {
+        stamps[triangle[corner]] = time++;
+        misses++;
+      }
+    }
+    return misses;
+  }
+
+  void reset() { time += MeshOptimizer::CACHE_SIZE + 1; }
+};
+
+} // namespace
+
+MeshOptimizer::MeshOptimizer(std::vector<uint32_t> &indices,
+                             size_t vertexCount, const float *positions,
+                             size_t positionStride, float overdrawThreshold)
+    : vertexCount(vertexCount),
+      positions(reinterpret_cast<const uint8_t *>(positions)),
+      positionStride(positionStride) {
+  before = analyze(indices, vertexCount);
+
+  std::vector<size_t> clusters;
+  tipsify(indices, clusters);
+  splitClusters(indices, clusters, overdrawThreshold);
+  sortClusters(indices, clusters);
+  optimizeFetch(indices);
+
+  after = analyze(indices, vertexCount);
+}
+
+const float *MeshOptimizer::position(uint32_t vertex) const {
+  return reinterpret_cast<const float *>(positions + vertex * positionStride);
+}
+
+MeshOptimizer::Stats
+MeshOptimizer::analyze(const std::vector<uint32_t> &indices,
+                       size_t vertexCount) {
+  uint32_t cache[CACHE_SIZE];
+  std::fill(cache, cache + CACHE_SIZE, UNUSED);
+  size_t head = 0;
+  size_t misses = 0;
+
+  for (uint32_t index : indices) {
+    if (std::find(cache, cache + CACHE_SIZE, index) == cache + CACHE_SIZE) {
+      cache[head] = index;
+      head = (head + 1) % CACHE_SIZE;
+      misses++;
+    }
+  }
+
+  Stats stats{};
+  if (!indices.empty()) {
+    stats.acmr = misses / (indices.size() / 3.0f);
+  }
+  if (vertexCount > 0) {
+    stats.atvr = misses / static_cast<float>(vertexCount);
+  }
+  return stats;
+}
+
+void MeshOptimizer::tipsify(std::vector<uint32_t> &indices,
+                            std::vector<size_t> &clusters) const {
+  size_t triangleCount = indices.size() / 3;
+
+  // vertex -> triangle adjacency
+  std::vector<uint32_t> live(vertexCount, 0);
+  for (uint32_t index : indices) {
+    live[index]++;
+  }
+  std::vector<uint32_t> offsets(vertexCount + 1, 0);
+  for (size_t v = 0; v < vertexCount; v++) {
+    offsets[v + 1] = offsets[v] + live[v];
+  }
+  std::vector<uint32_t> adjacency(indices.size());
+  std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+  for (size_t i = 0; i < indices.size(); i++) {
+    adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+  }
+
+  CacheState cache(vertexCount);
+  std::vector<bool> emitted(triangleCount, false);
+  std::vector<uint32_t> deadEnds;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> output;
+  output.reserve(indices.size());
+  size_t cursor = 0;
+
+  auto skipDeadEnd = [&]() -> int64_t {
+    while (!deadEnds.empty()) {
+      uint32_t vertex = deadEnds.back();
+      deadEnds.pop_back();
+      if (live[vertex] > 0) {
+        return vertex;
+      }
+    }
+    while (cursor < vertexCount) {
+      if (live[cursor] > 0) {
+        return static_cast<int64_t>(cursor);
+      }
+      cursor++;
+    }
+    return -1;
+  };
+
+  clusters.assign(1, 0);
+  int64_t fanning = skipDeadEnd();
+  while (fanning >= 0) {
+    candidates.clear();
+    for (uint32_t a = offsets[fanning]; a < offsets[fanning + 1]; a++) {
+      uint32_t triangle = adjacency[a];
+      if (emitted[triangle]) {
+        continue;
+      }
+      const uint32_t *corners = &indices[3 * triangle];
+      for (int corner = 0; corner < 3; corner++) {
+        uint32_t vertex = corners[corner];
+        output.push_back(vertex);
+        deadEnds.push_back(vertex);
+        candidates.push_back(vertex);
+        live[vertex]--;
+      }
+      cache.insert(corners);
+      emitted[triangle] = true;
+    }
+
+    // oldest cached vertex that stays cached while its fan is emitted
+    int64_t next = -1;
+    int64_t bestPriority = -1;
+    for (uint32_t vertex : candidates) {
+      if (live[vertex] == 0) {
+        continue;
+      }
+      int64_t priority = 0;
+      int64_t age = cache.time - cache.stamps[vertex];
+      if (age + 2 * live[vertex] <= CACHE_SIZE) {
+        priority = age;
+      }
+      if (priority > bestPriority) {
+        bestPriority = priority;
+        next = vertex;
+      }
+    }
+
+    // jumping elsewhere breaks cache continuity, start a new cluster
+    if (next < 0) {
+      next = skipDeadEnd();
+      if (next >= 0 && output.size() / 3 > clusters.back()) {
+        clusters.push_back(output.size() / 3);
+      }
+    }
+    fanning = next;
+  }
+
+  clusters.push_back(triangleCount);
+  indices.swap(output);
+}
+
+void MeshOptimizer::splitClusters(const std::vector<uint32_t> &indices,
+                                  std::vector<size_t> &clusters,
+                                  float threshold) const {
+  // cut each cluster as soon as its prefix is almost as cache efficient as
+  // the whole cluster, more clusters give the overdraw sort more freedom
+  CacheState cache(vertexCount);
+  std::vector<size_t> split;
+
+  for (size_t c = 0; c + 1 < clusters.size(); c++) {
+    size_t begin = clusters[c];
+    size_t end = clusters[c + 1];
+
+    cache.reset();
+    size_t misses = 0;
+    for (size_t t = begin; t < end; t++) {
+      misses += cache.insert(&indices[3 * t]);
+    }
+    float clusterAcmr = misses / static_cast<float>(end - begin);
+
+    cache.reset();
+    misses = 0;
+    size_t start = begin;
+    split.push_back(begin);
+    for (size_t t = begin; t + 1 < end; t++) {
+      misses += cache.insert(&indices[3 * t]);
+      if (misses <= threshold * clusterAcmr * (t + 1 - start)) {
+        split.push_back(t + 1);
+        cache.reset();
+        misses = 0;
+        start = t + 1;
+      }
+    }
+  }
+
+  split.push_back(clusters.back());
+  clusters.swap(split);
+}
+
+void MeshOptimizer::sortClusters(std::vector<uint32_t> &indices,
+                                 const std::vector<size_t> &clusters) const {
+  double meshCentroid[3] = {0.0, 0.0, 0.0};
+  for (size_t v = 0; v < vertexCount; v++) {
+    for (int axis = 0; axis < 3; axis++) {
+      meshCentroid[axis] += position(static_cast<uint32_t>(v))[axis];
+    }
+  }
+  for (int axis = 0; axis < 3; axis++) {
+    meshCentroid[axis] /= std::max<size_t>(vertexCount, 1);
+  }
+
+  // clusters facing away from the center are likely to occlude the rest
+  size_t clusterCount = clusters.size() - 1;
+  std::vector<float> sortKey(clusterCount);
+  for (size_t c = 0; c < clusterCount; c++) {
+    double normal[3] = {0.0, 0.0, 0.0};
+    double centroid[3] = {0.0, 0.0, 0.0};
+    double area = 0.0;
+
+    for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+      const float *p0 = position(indices[3 * t + 0]);
+      const float *p1 = position(indices[3 * t + 1]);
+      const float *p2 = position(indices[3 * t + 2]);
+
+      double e1[3], e2[3];
+      for (int axis = 0; axis < 3; axis++) {
+        e1[axis] = p1[axis] - p0[axis];
+        e2[axis] = p2[axis] - p0[axis];
+      }
+      double n[3] = {e1[1] * e2[2] - e1[2] * e2[1],
+                     e1[2] * e2[0] - e1[0] * e2[2],
+                     e1[0] * e2[1] - e1[1] * e2[0]};
+      double triangleArea = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+      for (int axis = 0; axis < 3; axis++) {
+        normal[axis] += n[axis];
+        centroid[axis] +=
+            (p0[axis] + p1[axis] + p2[axis]) / 3.0 * triangleArea;
+      }
+      area += triangleArea;
+    }
+
+    double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] +
+                              normal[2] * normal[2]);
+    if (area <= 0.0 || length <= 0.0) {
+      sortKey[c] = 0.0f;
+      continue;
+    }
+
+    double key = 0.0;
+    for (int axis = 0; axis < 3; axis++) {
+      key += (centroid[axis] / area - meshCentroid[axis]) * normal[axis];
+    }
+    sortKey[c] = static_cast<float>(key / length);
+  }
+
+  std::vector<size_t> order(clusterCount);
+  for (size_t c = 0; c < clusterCount; c++) {
+    order[c] = c;
+  }
+  std::stable_sort(order.begin(), order.end(), [&sortKey](size_t a, size_t b) {
+    return sortKey[a] > sortKey[b];
+  });
+
+  std::vector<uint32_t> sorted;
+  sorted.reserve(indices.size());
+  for (size_t c : order) {
+    sorted.insert(sorted.end(), indices.begin() + 3 * clusters[c],
+                  indices.begin() + 3 * clusters[c + 1]);
+  }
+  indices.swap(sorted);
+}
+
+void MeshOptimizer::optimizeFetch(std::vector<uint32_t> &indices) {
+  remap.assign(vertexCount, UNUSED);
+  uint32_t next = 0;
+  for (uint32_t &index : indices) {
+    if (remap[index] == UNUSED) {
+      remap[index] = next++;
+    }
+    index = remap[index];
+  }
+
+  // unreferenced vertices keep their relative order at the end
+  for (size_t v = 0; v < vertexCount; v++) {
+    if (remap[v] == UNUSED) {
+      remap[v] = next++;
+    }
+  }
+}
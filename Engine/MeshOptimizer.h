@@ -0,0 +1,59 @@
+#ifndef TOXENGINE_ENGINE_MESHOPTIMIZER_H_
+#define TOXENGINE_ENGINE_MESHOPTIMIZER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Reorders an indexed triangle list for the GPU in three steps:
+// - Tipsify (Sander et al. 2007) for post-transform vertex cache reuse
+// - clusters split where the cache state breaks are sorted so outward
+//   facing ones draw first, which reduces overdraw
+// - vertices are renumbered in order of first use for linear fetch
+class MeshOptimizer {
+public:
+  static constexpr unsigned CACHE_SIZE = 16;
+
+  struct Stats {
+    float acmr; // average cache miss ratio, misses per triangle
+    float atvr; // average transformed vertex ratio, misses per vertex
+  };
+
+  // positions are read as three floats every positionStride bytes
+  MeshOptimizer(std::vector<uint32_t> &indices, size_t vertexCount,
+                const float *positions, size_t positionStride,
+                float overdrawThreshold = 1.05f);
+
+  std::vector<uint32_t> remap; // old vertex -> new vertex
+  Stats before;
+  Stats after;
+
+  template <typename T> void apply(std::vector<T> &vertices) const {
+    std::vector<T> reordered(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+      reordered[remap[i]] = vertices[i];
+    }
+    vertices.swap(reordered);
+  }
+
+  // FIFO cache simulation with CACHE_SIZE entries
+  static Stats analyze(const std::vector<uint32_t> &indices,
+                       size_t vertexCount);
+
+private:
+  size_t vertexCount;
+  const uint8_t *positions;
+  size_t positionStride;
+
+  const float *position(uint32_t vertex) const;
+
+  void tipsify(std::vector<uint32_t> &indices,
+               std::vector<size_t> &clusters) const;
+  void splitClusters(const std::vector<uint32_t> &indices,
+                     std::vector<size_t> &clusters, float threshold) const;
+  void sortClusters(std::vector<uint32_t> &indices,
+                    const std::vector<size_t> &clusters) const;
+  void optimizeFetch(std::vector<uint32_t> &indices);
+};
+
+#endif // TOXENGINE_ENGINE_MESHOPTIMIZER_H_
@@ -0,0 +1,442 @@
+#include "MeshSimplifier.h"
+
+#include "VertexDedup.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <utility>
+
+namespace {
+
+constexpr uint32_t UNSET = std::numeric_limits<uint32_t>::max();
+
+void cross(const float *p0, const float *p1, const float *p2, double *n) {
+  double e1[3], e2[3];
+  for (int axis = 0; axis < 3; axis++) {
+    e1[axis] = p1[axis] - p0[axis];
+    e2[axis] = p2[axis] - p0[axis];
+  }
+  n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+  n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+  n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+double normalize(double *v) {
+  double length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+  if (length > 0.0) {
+    v[0] /= length;
+    v[1] /= length;
+    v[2] /= length;
+  }
+  return length;
+}
+
+struct Edge {
+  uint32_t count = 0;
+  uint32_t triangle;
+  uint32_t first; // vertices at the lower and higher position id
+  uint32_t second;
+  bool seam = false;
+};
+
+} // namespace
+
+MeshSimplifier::Quadric &
+MeshSimplifier::Quadric::operator+=(const Quadric &other) {
+  a2 += other.a2;
+  ab += other.ab;
+  ac += other.ac;
+  ad += other.ad;
+  b2 += other.b2;
+  bc += other.bc;
+  bd += other.bd;
+  c2 += other.c2;
+  cd += other.cd;
+  d2 += other.d2;
+  weight += other.weight;
+  return *this;
+}
+
+double MeshSimplifier::Quadric::evaluate(const float *p) const {
+  if (weight <= 0.0) {
+    return 0.0;
+  }
+  double x = p[0], y = p[1], z = p[2];
+  double error = a2 * x * x + b2 * y * y + c2 * z * z +
+                 2.0 * (ab * x * y + ac * x * z + bc * y * z) +
+                 2.0 * (ad * x + bd * y + cd * z) + d2;
+  return std::max(error, 0.0) / weight;
+}
+
+MeshSimplifier::MeshSimplifier(const std::vector<uint32_t> &indices,
+                               size_t vertexCount, const float *positions,
+                               size_t positionStride)
+    : positions(reinterpret_cast<const uint8_t *>(positions)),
+      positionStride(positionStride), triangles(indices),
+      alive(indices.size() / 3, true), aliveCount(indices.size() / 3),
+      vertexTriangles(vertexCount) {
+  std::vector<float> packed(vertexCount * 3);
+  for (size_t v = 0; v < vertexCount; v++) {
+    const float *p = position(static_cast<uint32_t>(v));
+    std::copy(p, p + 3, &packed[v * 3]);
+  }
+  VertexDedup dedup(packed.data(), vertexCount, 3 * sizeof(float));
+  positionId = std::move(dedup.remap);
+
+  size_t positionCount = dedup.unique.size();
+  wedges.resize(positionCount);
+  for (size_t v = 0; v < vertexCount; v++) {
+    wedges[positionId[v]].push_back(static_cast<uint32_t>(v));
+  }
+  kinds.assign(positionCount, Kind::Manifold);
+  quadrics.assign(positionCount, Quadric{});
+  removed.assign(positionCount, false);
+  version.assign(positionCount, 0);
+
+  // area weighted plane quadrics and position level edges
+  std::map<std::pair<uint32_t, uint32_t>, Edge> edges;
+  for (size_t t = 0; t < aliveCount; t++) {
+    const uint32_t *corners = &triangles[3 * t];
+    double n[3];
+    cross(position(corners[0]), position(corners[1]), position(corners[2]),
+          n);
+    double area = 0.5 * normalize(n);
+
+    for (int corner = 0; corner < 3; corner++) {
+      uint32_t a = corners[corner];
+      uint32_t b = corners[(corner + 1) % 3];
+      vertexTriangles[a].push_back(static_cast<uint32_t>(t));
+      addPlane(positionId[a], n, position(corners[0]), area);
+
+      if (positionId[a] > positionId[b]) {
+        std::swap(a, b);
+      }
+      Edge &edge = edges[{positionId[a], positionId[b]}];
+      if (edge.count == 0) {
+        edge.triangle = static_cast<uint32_t>(t);
+        edge.first = a;
+        edge.second = b;
+      } else if (edge.first != a || edge.second != b) {
+        edge.seam = true;
+      }
+      edge.count++;
+    }
+  }
+
+  // borders and seams keep their shape through planes perpendicular to the
+  // adjacent triangle, vertices where they end or branch are locked
+  std::vector<uint32_t> borderEdges(positionCount, 0);
+  std::vector<uint32_t> seamEdges(positionCount, 0);
+  std::vector<bool> nonManifold(positionCount, false);
+  for (const auto &entry : edges) {
+    const Edge &edge = entry.second;
+    uint32_t a = entry.first.first;
+    uint32_t b = entry.first.second;
+
+    if (edge.count > 2) {
+      nonManifold[a] = nonManifold[b] = true;
+      continue;
+    }
+    if (edge.count == 2 && !edge.seam) {
+      continue;
+    }
+
+    borderEdges[a] += edge.count == 1;
+    borderEdges[b] += edge.count == 1;
+    seamEdges[a] += edge.seam;
+    seamEdges[b] += edge.seam;
+
+    const uint32_t *corners = &triangles[3 * edge.triangle];
+    double n[3], direction[3], plane[3];
+    cross(position(corners[0]), position(corners[1]), position(corners[2]),
+          n);
+    normalize(n);
+    for (int axis = 0; axis < 3; axis++) {
+      direction[axis] = positionOf(b)[axis] - positionOf(a)[axis];
+    }
+    plane[0] = direction[1] * n[2] - direction[2] * n[1];
+    plane[1] = direction[2] * n[0] - direction[0] * n[2];
+    plane[2] = direction[0] * n[1] - direction[1] * n[0];
+    double length = normalize(direction);
+    normalize(plane);
+
+    addPlane(a, plane, positionOf(a), length * length);
+    addPlane(b, plane, positionOf(a), length * length);
+  }
+
+  for (size_t p = 0; p < positionCount; p++) {
+    size_t wedgeCount = wedges[p].size();
+    if (nonManifold[p]) {
+      kinds[p] = Kind::Locked;
+    } else if (borderEdges[p] == 0 && seamEdges[p] == 0) {
+      kinds[p] = wedgeCount == 1 ? Kind::Manifold : Kind::Locked;
+    } else if (borderEdges[p] == 2 && seamEdges[p] == 0 && wedgeCount == 1) {
+      kinds[p] = Kind::Border;
+    } else if (seamEdges[p] == 2 && borderEdges[p] == 0 && wedgeCount == 2) {
+      kinds[p] = Kind::Seam;
+    } else {
+      kinds[p] = Kind::Locked;
+    }
+  }
+
+  for (size_t p = 0; p < positionCount; p++) {
+    updateCandidate(static_cast<uint32_t>(p));
+  }
+}
+
+const float *MeshSimplifier::position(uint32_t vertex) const {
+  return reinterpret_cast<const float *>(positions + vertex * positionStride);
+}
+
+const float *MeshSimplifier::positionOf(uint32_t id) const {
+  return position(wedges[id][0]);
+}
+
+const std::vector<uint32_t> &MeshSimplifier::liveTriangles(uint32_t vertex) {
+  auto &list = vertexTriangles[vertex];
+  list.erase(std::remove_if(list.begin(), list.end(),
+                            [this](uint32_t t) { return !alive[t]; }),
+             list.end());
+  return list;
+}
+
+void MeshSimplifier::addPlane(uint32_t id, const double *normal,
+                              const float *point, double weight) {
+  double a = normal[0], b = normal[1], c = normal[2];
+  double d = -(a * point[0] + b * point[1] + c * point[2]);
+  Quadric q{a * a * weight, a * b * weight, a * c * weight, a * d * weight,
+            b * b * weight, b * c * weight, b * d * weight, c * c * weight,
+            c * d * weight, d * d * weight, weight};
+  quadrics[id] += q;
+}
+
+bool MeshSimplifier::findWedgeMap(uint32_t from, uint32_t to,
+                                  std::vector<uint32_t> &map) {
+  // every wedge has to land on the wedge it shares an edge with, distinct
+  // wedges on distinct ones so the uv seam survives
+  map.assign(wedges[from].size(), UNSET);
+  for (size_t i = 0; i < wedges[from].size(); i++) {
+    for (uint32_t t : liveTriangles(wedges[from][i])) {
+      for (int corner = 0; corner < 3; corner++) {
+        uint32_t vertex = triangles[3 * t + corner];
+        if (positionId[vertex] != to) {
+          continue;
+        }
+        if (map[i] != UNSET && map[i] != vertex) {
+          return false;
+        }
+        map[i] = vertex;
+      }
+    }
+    if (map[i] == UNSET) {
+      return false;
+    }
+    for (size_t j = 0; j < i; j++) {
+      if (map[j] == map[i]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool MeshSimplifier::isValid(uint32_t from, uint32_t to,
+                             std::vector<uint32_t> &map) {
+  if (from == to || removed[from] || removed[to] ||
+      !findWedgeMap(from, to, map)) {
+    return false;
+  }
+
+  std::vector<uint32_t> fromNeighbours, toNeighbours;
+  size_t shared = 0;
+
+  for (uint32_t vertex : wedges[from]) {
+    for (uint32_t t : liveTriangles(vertex)) {
+      const uint32_t *corners = &triangles[3 * t];
+      bool hasTo = false;
+      for (int corner = 0; corner < 3; corner++) {
+        uint32_t id = positionId[corners[corner]];
+        if (id == to) {
+          hasTo = true;
+        } else if (id != from) {
+          fromNeighbours.push_back(id);
+        }
+      }
+      if (hasTo) {
+        shared++;
+        continue;
+      }
+
+      // reject collapses that flip a remaining triangle
+      const float *p[3];
+      for (int corner = 0; corner < 3; corner++) {
+        p[corner] = position(corners[corner]);
+      }
+      double before[3], after[3];
+      cross(p[0], p[1], p[2], before);
+      for (int corner = 0; corner < 3; corner++) {
+        if (corners[corner] == vertex) {
+          p[corner] = positionOf(to);
+        }
+      }
+      cross(p[0], p[1], p[2], after);
+      if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <=
+          0.0) {
+        return false;
+      }
+    }
+  }
+
+  // borders and seams only collapse along themselves
+  if ((kinds[from] == Kind::Border && shared != 1) ||
+      (kinds[from] == Kind::Seam && shared != 2)) {
+    return false;
+  }
+
+  for (uint32_t vertex : wedges[to]) {
+    for (uint32_t t : liveTriangles(vertex)) {
+      for (int corner = 0; corner < 3; corner++) {
+        uint32_t id = positionId[triangles[3 * t + corner]];
+        if (id != to && id != from) {
+          toNeighbours.push_back(id);
+        }
+      }
+    }
+  }
+
+  // link condition, only the vertices opposite the collapsed edge may be
+  // neighbours of both ends
+  std::sort(fromNeighbours.begin(), fromNeighbours.end());
+  fromNeighbours.erase(
+      std::unique(fromNeighbours.begin(), fromNeighbours.end()),
+      fromNeighbours.end());
+  std::sort(toNeighbours.begin(), toNeighbours.end());
+  toNeighbours.erase(std::unique(toNeighbours.begin(), toNeighbours.end()),
+                     toNeighbours.end());
+
+  size_t common = 0;
+  for (uint32_t neighbour : fromNeighbours) {
+    common += std::binary_search(toNeighbours.begin(), toNeighbours.end(),
+                                 neighbour);
+  }
+  return common <= shared;
+}
+
+void MeshSimplifier::updateCandidate(uint32_t id) {
+  version[id]++;
+  if (removed[id] || kinds[id] == Kind::Locked) {
+    return;
+  }
+
+  std::vector<uint32_t> targets;
+  for (uint32_t vertex : wedges[id]) {
+    for (uint32_t t : liveTriangles(vertex)) {
+      for (int corner = 0; corner < 3; corner++) {
+        uint32_t target = positionId[triangles[3 * t + corner]];
+        if (target != id) {
+          targets.push_back(target);
+        }
+      }
+    }
+  }
+  std::sort(targets.begin(), targets.end());
+  targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+  std::vector<std::pair<double, uint32_t>> candidates;
+  for (uint32_t target : targets) {
+    Quadric q = quadrics[id];
+    q += quadrics[target];
+    candidates.emplace_back(q.evaluate(positionOf(target)), target);
+  }
+  std::sort(candidates.begin(), candidates.end());
+
+  std::vector<uint32_t> map;
+  for (const auto &candidate : candidates) {
+    if (isValid(id, candidate.second, map)) {
+      heap.push_back({candidate.first, id, candidate.second, version[id]});
+      std::push_heap(heap.begin(), heap.end());
+      return;
+    }
+  }
+}
+
+void MeshSimplifier::collapse(uint32_t from, uint32_t to,
+                              const std::vector<uint32_t> &map) {
+  for (size_t i = 0; i < wedges[from].size(); i++) {
+    uint32_t vertex = wedges[from][i];
+    uint32_t target = map[i];
+
+    for (uint32_t t : liveTriangles(vertex)) {
+      uint32_t *corners = &triangles[3 * t];
+      bool degenerate = false;
+      for (int corner = 0; corner < 3; corner++) {
+        degenerate |= positionId[corners[corner]] == to;
+      }
+      if (degenerate) {
+        alive[t] = false;
+        aliveCount--;
+        continue;
+      }
+      for (int corner = 0; corner < 3; corner++) {
+        if (corners[corner] == vertex) {
+          corners[corner] = target;
+        }
+      }
+      vertexTriangles[target].push_back(t);
+    }
+    vertexTriangles[vertex].clear();
+  }
+
+  quadrics[to] += quadrics[from];
+  removed[from] = true;
+  version[from]++;
+
+  // costs around the target changed with its quadric and neighbourhood
+  std::vector<uint32_t> neighbours;
+  for (uint32_t vertex : wedges[to]) {
+    for (uint32_t t : liveTriangles(vertex)) {
+      for (int corner = 0; corner < 3; corner++) {
+        neighbours.push_back(positionId[triangles[3 * t + corner]]);
+      }
+    }
+  }
+  std::sort(neighbours.begin(), neighbours.end());
+  neighbours.erase(std::unique(neighbours.begin(), neighbours.end()),
+                   neighbours.end());
+  for (uint32_t id : neighbours) {
+    updateCandidate(id);
+  }
+}
+
+float MeshSimplifier::simplify(size_t targetIndexCount,
+                               std::vector<uint32_t> &result) {
+  std::vector<uint32_t> map;
+  while (aliveCount * 3 > targetIndexCount && !heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end());
+    Collapse next = heap.back();
+    heap.pop_back();
+
+    if (next.version != version[next.from]) {
+      continue;
+    }
+    if (!isValid(next.from, next.to, map)) {
+      updateCandidate(next.from);
+      continue;
+    }
+
+    maxCost = std::max(maxCost, next.cost);
+    collapse(next.from, next.to, map);
+  }
+
+  result.clear();
+  result.reserve(aliveCount * 3);
+  for (size_t t = 0; t < alive.size(); t++) {
+    if (alive[t]) {
+      result.insert(result.end(), &triangles[3 * t], &triangles[3 * t] + 3);
+    }
+  }
+
+  return static_cast<float>(std::sqrt(maxCost));
+}
@@ -0,0 +1,77 @@
+#ifndef TOXENGINE_ENGINE_MESHSIMPLIFIER_H_
+#define TOXENGINE_ENGINE_MESHSIMPLIFIER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Quadric error metric simplifier (Garland and Heckbert 1997) using half
+// edge collapses, so every level of detail indexes the original vertices
+// and all levels can share one vertex buffer. Collapses work on positions:
+// vertices split by a uv seam move together along the seam, border
+// vertices only move along the border and corners are locked. Calls
+// continue where the previous one stopped, which gives a chain of
+// successively coarser levels.
+class MeshSimplifier {
+public:
+  // positions are read as three floats every positionStride bytes
+  MeshSimplifier(const std::vector<uint32_t> &indices, size_t vertexCount,
+                 const float *positions, size_t positionStride);
+
+  // collapses edges until at most targetIndexCount indices are left or no
+  // valid collapse remains, returns the geometric error reached so far in
+  // model units
+  float simplify(size_t targetIndexCount, std::vector<uint32_t> &result);
+
+private:
+  enum class Kind : uint8_t { Manifold, Border, Seam, Locked };
+
+  struct Quadric {
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+    double weight;
+
+    Quadric &operator+=(const Quadric &other);
+    // weighted mean squared distance to the accumulated planes
+    double evaluate(const float *p) const;
+  };
+
+  struct Collapse {
+    double cost;
+    uint32_t from; // position ids
+    uint32_t to;
+    uint32_t version;
+
+    bool operator<(const Collapse &other) const { return cost > other.cost; }
+  };
+
+  const uint8_t *positions;
+  size_t positionStride;
+
+  std::vector<uint32_t> triangles;
+  std::vector<bool> alive;
+  size_t aliveCount;
+  std::vector<std::vector<uint32_t>> vertexTriangles;
+
+  // per position, vertices sharing a position are its wedges
+  std::vector<uint32_t> positionId;
+  std::vector<std::vector<uint32_t>> wedges;
+  std::vector<Kind> kinds;
+  std::vector<Quadric> quadrics;
+  std::vector<bool> removed;
+  std::vector<uint32_t> version;
+
+  std::vector<Collapse> heap;
+  double maxCost = 0.0;
+
+  const float *position(uint32_t vertex) const;
+  const float *positionOf(uint32_t id) const;
+  const std::vector<uint32_t> &liveTriangles(uint32_t vertex);
+  void addPlane(uint32_t id, const double *normal, const float *point,
+                double weight);
+  bool findWedgeMap(uint32_t from, uint32_t to, std::vector<uint32_t> &map);
+  bool isValid(uint32_t from, uint32_t to, std::vector<uint32_t> &map);
+  void updateCandidate(uint32_t id);
+  void collapse(uint32_t from, uint32_t to, const std::vector<uint32_t> &map);
+};
+
+#endif // TOXENGINE_ENGINE_MESHSIMPLIFIER_H_
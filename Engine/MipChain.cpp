@@ -0,0 +1,151 @@
+#include "MipChain.h"
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TOXENGINE_MIPCHAIN_SSE2
+#endif
+
+namespace {
+
+constexpr uint32_t ROWS_PER_TASK = 16;
+constexpr uint32_t ENCODE_SIZE = 4096;
+
+// srgb <-> linear lookups, linear values are encoded through a table
+// indexed by value * (ENCODE_SIZE - 1)
+struct SrgbTables {
+  float decode[256];
+  uint8_t encode[ENCODE_SIZE];
+
+  SrgbTables() {
+    for (int i = 0; i < 256; i++) {
+      float c = i / 255.0f;
+      decode[i] = c <= 0.04045f ? c / 12.92f
+                                : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    for (uint32_t i = 0; i < ENCODE_SIZE; i++) {
+      float l = i / static_cast<float>(ENCODE_SIZE - 1);
+      float c = l <= 0.0031308f ? l * 12.92f
+                                : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+      encode[i] = static_cast<uint8_t>(c * 255.0f + 0.5f);
+    }
+  }
+};
+
+const SrgbTables &srgbTables() {
+  static const SrgbTables tables;
+  return tables;
+}
+
+void decodeRow(const uint8_t *row, uint32_t width, bool srgb, float *out) {
+  const float *decode = srgbTables().decode;
+  for (uint32_t i = 0; i < 4 * width; i += 4) {
+    for (int c = 0; c < 3; c++) {
+      out[i + c] = srgb ? decode[row[i + c]] : row[i + c] / 255.0f;
+    }
+    out[i + 3] = row[i + 3] / 255.0f;
+  }
+}
+
+} // namespace
+
+uint32_t MipChain::levelCount(uint32_t width, uint32_t height) {
+  uint32_t count = 1;
+  for (uint32_t size = std::max(width, height); size > 1; size /= 2) {
+    count++;
+  }
+  return count;
+}
+
+std::vector<MipChain::Level> MipChain::layout(uint32_t width, uint32_t height,
+                                              size_t texelSize) {
+  std::vector<Level> levels(levelCount(width, height));
+  uint64_t offset = 0;
+  for (Level &level : levels) {
+    level.width = width;
+    level.height = height;
+    level.offset = offset;
+    level.size = uint64_t(width) * height * texelSize;
+    offset += level.size;
+    width = std::max(width / 2, 1u);
+    height = std::max(height / 2, 1u);
+  }
+  return levels;
+}
+
+MipChain::MipChain(const uint8_t *source, uint32_t width, uint32_t height,
+                   bool srgb)
+    : levels(layout(width, height, 4)) {
+  pixels.resize(levels.back().offset + levels.back().size);
+  std::copy(source, source + levels[0].size, pixels.begin());
+
+  for (size_t i = 1; i < levels.size(); i++) {
+    downsample(levels[i - 1], levels[i], srgb);
+  }
+}
+
+void MipChain::downsample(const Level &source, const Level &target,
+                          bool srgb) {
+  const uint8_t *encode = srgbTables().encode;
+  const uint8_t *sourcePixels = pixels.data() + source.offset;
+  uint8_t *targetPixels = pixels.data() + target.offset;
+
+  // odd edges reuse their last row or column
+  float colorScale = srgb ? (ENCODE_SIZE - 1) / 4.0f : 255.0f / 4.0f;
+  float alphaScale = 255.0f / 4.0f;
+
+  size_t tasks = (target.height + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+  ThreadPool::shared().parallelFor(tasks, [&](size_t task) {
+    std::vector<float> row0(4 * source.width);
+    std::vector<float> row1(4 * source.width);
+    uint32_t begin = static_cast<uint32_t>(task) * ROWS_PER_TASK;
+    uint32_t end = std::min(target.height, begin + ROWS_PER_TASK);
+
+    for (uint32_t y = begin; y < end; y++) {
+      uint32_t y0 = std::min(2 * y, source.height - 1);
+      uint32_t y1 = std::min(2 * y + 1, source.height - 1);
+      decodeRow(sourcePixels + size_t(y0) * source.width * 4, source.width,
+                srgb, row0.data());
+      decodeRow(sourcePixels + size_t(y1) * source.width * 4, source.width,
+                srgb, row1.data());
+
+      uint8_t *out = targetPixels + size_t(y) * target.width * 4;
+#ifdef TOXENGINE_MIPCHAIN_SSE2
+      const __m128 scale =
+          _mm_setr_ps(colorScale, colorScale, colorScale, alphaScale);
+      const __m128 half = _mm_set1_ps(0.5f);
+#endif
+      for (uint32_t x = 0; x < target.width; x++) {
+        size_t x0 = 4 * size_t(std::min(2 * x, source.width - 1));
+        size_t x1 = 4 * size_t(std::min(2 * x + 1, source.width - 1));
+
+        int32_t texel[4];
+#ifdef TOXENGINE_MIPCHAIN_SSE2
+        __m128 sum = _mm_add_ps(
+            _mm_add_ps(_mm_loadu_ps(&row0[x0]), _mm_loadu_ps(&row0[x1])),
+            _mm_add_ps(_mm_loadu_ps(&row1[x0]), _mm_loadu_ps(&row1[x1])));
+        __m128i scaled =
+            _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(sum, scale), half));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(texel), scaled);
+#else
+        for (int c = 0; c < 4; c++) {
+          float sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] +
+                      row1[x1 + c];
+          texel[c] =
+              static_cast<int32_t>(sum * (c < 3 ? colorScale : alphaScale) +
+                                   0.5f);
+        }
+#endif
+        for (int c = 0; c < 3; c++) {
+          out[4 * x + c] = srgb ? encode[texel[c]]
+                                : static_cast<uint8_t>(texel[c]);
+        }
+        out[4 * x + 3] = static_cast<uint8_t>(texel[3]);
+      }
+    }
+  });
+}
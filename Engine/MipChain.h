@@ -0,0 +1,35 @@
+#ifndef TOXENGINE_ENGINE_MIPCHAIN_H_
+#define TOXENGINE_ENGINE_MIPCHAIN_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Full mip chain of an 8 bit RGBA image, every level is a 2x2 box filter of
+// the previous one down to 1x1. Color channels of srgb images are averaged
+// in linear space so the chain does not darken, alpha is always linear.
+class MipChain {
+public:
+  struct Level {
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset; // into pixels
+    uint64_t size;
+  };
+
+  static uint32_t levelCount(uint32_t width, uint32_t height);
+  // tightly packed levels with the given texel size
+  static std::vector<Level> layout(uint32_t width, uint32_t height,
+                                   size_t texelSize);
+
+  MipChain(const uint8_t *pixels, uint32_t width, uint32_t height,
+           bool srgb = true);
+
+  std::vector<Level> levels;
+  std::vector<uint8_t> pixels;
+
+private:
+  void downsample(const Level &source, const Level &target, bool srgb);
+};
+
+#endif // TOXENGINE_ENGINE_MIPCHAIN_H_
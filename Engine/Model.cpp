@@ -1,77 +1,266 @@
 #include "Model.h"
 
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "ObjLoader.h"
+#include "Stats.h"
 #include "TOXEngine.h"
 #include "Vertex.h"
+#include "VertexDedup.h"
+
+#include <glm/gtc/packing.hpp>
 
 #include <memory>
-#include <tiny_obj_loader.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 
-Model::Model(Context &context, const std::string path) : context(context) {
-  tinyobj::attrib_t attrib;
-  std::vector<tinyobj::shape_t> shapes;
-  std::vector<tinyobj::material_t> materials;
-  std::string warn, err;
+Model::Model(Context &context, const std::string path,
+             const ModelOptions &options)
+    : context(context), format(options.format), optimize(options.optimize) {
+  // the cache stores vertices and indices already optimized and encoded
+  uint32_t variant = static_cast<uint32_t>(format) |
+                     (optimize ? 1u << 8 : 0u) | (options.lodCount << 16);
+
+  AssetCache cache(path, "mesh", variant);
+  if (cache.isValid() && cache.has(AssetCache::Section::Decode) &&
+      cache.has(AssetCache::Section::Lods)) {
+    nbVertices = cache.size(AssetCache::Section::Vertices) / getVertexSize();
+    indexType =
+        nbVertices < 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    nbIndices = cache.size(AssetCache::Section::Indices) / getIndexSize();
+    bounds = *cache.get<AssetCache::Bounds>(AssetCache::Section::Bounds);
+    decode = *cache.get<VertexDecode>(AssetCache::Section::Decode);
+    const Lod *cachedLods = cache.get<Lod>(AssetCache::Section::Lods);
+    lods.assign(cachedLods,
+                cachedLods + cache.count<Lod>(AssetCache::Section::Lods));
+
+    createVertexBuffer(cache.data(AssetCache::Section::Vertices));
+    createIndexBuffer(cache.data(AssetCache::Section::Indices));
+    createLodBuffer();
+    return;
+  }
+
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+  load(path, vertices, indices);
+  buildLods(vertices, indices, options.lodCount);
+
+  nbIndices = indices.size();
+  nbVertices = vertices.size();
+  indexType = nbVertices < 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+  decode.posScale = glm::vec4(1.0f);
+  decode.posOffset = glm::vec4(0.0f);
+  decode.texCoordScaleOffset = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);
+
+  std::vector<CompactVertex> compact;
+  const void *vertexData = vertices.data();
+  if (format != VertexFormat::Float32) {
+    encode(vertices, compact);
+    vertexData = compact.data();
+  }
+
+  std::vector<uint16_t> shortIndices;
+  const void *indexData = indices.data();
+  if (indexType == VK_INDEX_TYPE_UINT16) {
+    shortIndices.assign(indices.begin(), indices.end());
+    indexData = shortIndices.data();
+  }
 
-  if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
-                        path.c_str())) {
-    throw std::runtime_error(warn + err);
+  AssetCache::Writer writer;
+  writer.add(AssetCache::Section::Vertices, vertexData,
+             getVertexSize() * nbVertices);
+  writer.add(AssetCache::Section::Indices, indexData,
+             getIndexSize() * nbIndices);
+  writer.add(AssetCache::Section::Bounds, &bounds, sizeof(bounds));
+  writer.add(AssetCache::Section::Decode, &decode, sizeof(decode));
+  writer.add(AssetCache::Section::Lods, lods.data(), sizeof(Lod) * lods.size());
+  if (!writer.write(path, "mesh", variant)) {
+    std::cerr << "failed to write mesh cache for " << path << std::endl;
   }
 
-  std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+  createVertexBuffer(vertexData);
+  createIndexBuffer(indexData);
+  createLodBuffer();
+}
+
+void Model::load(const std::string path, std::vector<Vertex> &vertices,
+                 std::vector<uint32_t> &indices) {
+  ObjLoader obj(path);
 
-  for (const auto &shape : shapes) {
-    for (const auto &index : shape.mesh.indices) {
-      Vertex vertex{};
+  std::vector<Vertex> corners(obj.indices.size());
+  for (size_t i = 0; i < obj.indices.size(); i++) {
+    const auto &index = obj.indices[i];
+    Vertex &vertex = corners[i];
 
-      vertex.pos = {attrib.vertices[3 * index.vertex_index + 0],
-                    attrib.vertices[3 * index.vertex_index + 1],
-                    attrib.vertices[3 * index.vertex_index + 2]};
+    vertex.pos = {obj.positions[3 * index.vertex + 0],
+                  obj.positions[3 * index.vertex + 1],
+                  obj.positions[3 * index.vertex + 2]};
 
-      vertex.texCoord = {attrib.texcoords[2 * index.texcoord_index + 0],
-                         1.0f - attrib.texcoords[2 * index.texcoord_index + 1]};
+    vertex.texCoord = {obj.texcoords[2 * index.texcoord + 0],
+                       1.0f - obj.texcoords[2 * index.texcoord + 1]};
 
-      vertex.color = {1.0f, 1.0f, 1.0f};
+    vertex.color = {1.0f, 1.0f, 1.0f};
+  }
 
-      if (uniqueVertices.count(vertex) == 0) {
-        uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-        vertices.push_back(vertex);
-      }
+  VertexDedup dedup(corners.data(), corners.size(), sizeof(Vertex));
+  dedup.gather(corners.data(), vertices);
+  indices = std::move(dedup.remap);
 
-      indices.push_back(uniqueVertices[vertex]);
+  if (optimize && !vertices.empty()) {
+    std::chrono::high_resolution_clock::time_point start;
+    if (enableStats) {
+      start = std::chrono::high_resolution_clock::now();
+    }
+
+    MeshOptimizer optimizer(indices, vertices.size(), &vertices[0].pos.x,
+                            sizeof(Vertex));
+    optimizer.apply(vertices);
+
+    if (enableStats) {
+      float milliseconds =
+          std::chrono::duration<float, std::chrono::milliseconds::period>(
+              std::chrono::high_resolution_clock::now() - start)
+              .count();
+      std::cout << "optimized " << path << " in " << milliseconds
+                << " ms, ACMR " << optimizer.before.acmr << " -> "
+                << optimizer.after.acmr << ", ATVR "
+                << optimizer.before.atvr << " -> " << optimizer.after.atvr
+                << std::endl;
     }
   }
 
-  nbIndices = indices.size();
-  nbVertices = vertices.size();
+  bounds = {{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}};
+  for (size_t i = 0; i < vertices.size(); i++) {
+    for (int axis = 0; axis < 3; axis++) {
+      float value = vertices[i].pos[axis];
+      bounds.min[axis] = i == 0 ? value : std::min(bounds.min[axis], value);
+      bounds.max[axis] = i == 0 ? value : std::max(bounds.max[axis], value);
+    }
+  }
+}
+
+void Model::buildLods(const std::vector<Vertex> &vertices,
+                      std::vector<uint32_t> &indices, uint32_t lodCount) {
+  lods.assign(1, {0, static_cast<uint32_t>(indices.size()), 0.0f});
+  if (lodCount < 2 || vertices.empty()) {
+    return;
+  }
 
-  createVertexBuffer();
-  createIndexBuffer();
+  std::chrono::high_resolution_clock::time_point start;
+  if (enableStats) {
+    start = std::chrono::high_resolution_clock::now();
+  }
+
+  // coarser levels are appended to the index buffer and reuse the vertices
+  MeshSimplifier simplifier(indices, vertices.size(), &vertices[0].pos.x,
+                            sizeof(Vertex));
+  std::vector<uint32_t> lodIndices;
+  size_t target = indices.size();
+  for (uint32_t level = 1; level < lodCount; level++) {
+    target = target / 4 / 3 * 3;
+    float error = simplifier.simplify(target, lodIndices);
+
+    // stop once the locked borders and seams keep the mesh from shrinking
+    size_t previous = lods.back().indexCount;
+    if (lodIndices.empty() || lodIndices.size() * 10 > previous * 9) {
+      break;
+    }
+
+    lods.push_back({static_cast<uint32_t>(indices.size()),
+                    static_cast<uint32_t>(lodIndices.size()), error});
+    indices.insert(indices.end(), lodIndices.begin(), lodIndices.end());
+  }
+
+  if (enableStats) {
+    float milliseconds =
+        std::chrono::duration<float, std::chrono::milliseconds::period>(
+            std::chrono::high_resolution_clock::now() - start)
+            .count();
+    std::cout << "built " << lods.size() << " lods in " << milliseconds
+              << " ms:";
+    for (const auto &lod : lods) {
+      std::cout << " " << lod.indexCount / 3 << " (" << lod.error << ")";
+    }
+    std::cout << std::endl;
+  }
 }
 
-void Model::createVertexBuffer() {
-  VkDeviceSize bufferSize = sizeof(vertices[0]) * nbVertices;
+void Model::encode(const std::vector<Vertex> &vertices,
+                   std::vector<CompactVertex> &compact) {
+  glm::vec2 uvMin(0.0f), uvMax(0.0f);
+  for (size_t i = 0; i < vertices.size(); i++) {
+    const glm::vec2 &uv = vertices[i].texCoord;
+    uvMin = i == 0 ? uv : glm::min(uvMin, uv);
+    uvMax = i == 0 ? uv : glm::max(uvMax, uv);
+  }
 
-  Buffer stagingBuffer(context, Buffer::Type::Staging, bufferSize,
-                       vertices.data());
+  // positions map to [-1, 1] and uvs to [0, 1], flat axes keep a unit scale
+  glm::vec3 center, extent;
+  for (int axis = 0; axis < 3; axis++) {
+    center[axis] = (bounds.min[axis] + bounds.max[axis]) * 0.5f;
+    extent[axis] = (bounds.max[axis] - bounds.min[axis]) * 0.5f;
+    if (extent[axis] <= 0.0f) {
+      extent[axis] = 1.0f;
+    }
+  }
+  glm::vec2 uvExtent = uvMax - uvMin;
+  for (int axis = 0; axis < 2; axis++) {
+    if (uvExtent[axis] <= 0.0f) {
+      uvExtent[axis] = 1.0f;
+    }
+  }
+
+  decode.posScale = glm::vec4(extent, 1.0f);
+  decode.posOffset = glm::vec4(center, 0.0f);
+  decode.texCoordScaleOffset = glm::vec4(uvExtent, uvMin);
+
+  compact.resize(vertices.size());
+  for (size_t i = 0; i < vertices.size(); i++) {
+    glm::vec3 pos =
+        glm::clamp((vertices[i].pos - center) / extent, -1.0f, 1.0f);
+    glm::vec2 uv = (vertices[i].texCoord - uvMin) / uvExtent;
+
+    for (int axis = 0; axis < 3; axis++) {
+      compact[i].pos[axis] = format == VertexFormat::Half16
+                                 ? glm::packHalf1x16(pos[axis])
+                                 : glm::packSnorm1x16(pos[axis]);
+    }
+    compact[i].pos[3] = 0;
+    compact[i].texCoord[0] = glm::packUnorm1x16(uv.x);
+    compact[i].texCoord[1] = glm::packUnorm1x16(uv.y);
+  }
+}
+
+size_t Model::getVertexSize() const {
+  return format == VertexFormat::Float32 ? sizeof(Vertex)
+                                         : sizeof(CompactVertex);
+}
 
-  vertexBuffer =
-      std::make_unique<Buffer>(context, Buffer::Type::Vertex, bufferSize);
+size_t Model::getIndexSize() const {
+  return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t)
+                                           : sizeof(uint32_t);
+}
+
+void Model::createVertexBuffer(const void *vertices) {
+  VkDeviceSize bufferSize = getVertexSize() * nbVertices;
 
-  vertexBuffer->copy(stagingBuffer, bufferSize);
-  stagingBuffer.cleanup();
+  vertexBuffer = std::make_unique<Buffer>(context, Buffer::Type::Vertex,
+                                          bufferSize, vertices);
 }
 
-void Model::createIndexBuffer() {
-  VkDeviceSize bufferSize = sizeof(indices[0]) * nbIndices;
+void Model::createIndexBuffer(const void *indices) {
+  VkDeviceSize bufferSize = getIndexSize() * nbIndices;
 
-  Buffer stagingBuffer(context, Buffer::Type::Staging, bufferSize,
-                       indices.data());
+  indexBuffer = std::make_unique<Buffer>(context, Buffer::Type::Index,
+                                         bufferSize, indices);
+}
 
-  indexBuffer =
-      std::make_unique<Buffer>(context, Buffer::Type::Index, bufferSize);
+void Model::createLodBuffer() {
+  VkDeviceSize bufferSize = sizeof(Lod) * lods.size();
 
-  indexBuffer->copy(stagingBuffer, bufferSize);
-  stagingBuffer.cleanup();
+  lodBuffer = std::make_unique<Buffer>(context, Buffer::Type::Storage,
+                                       bufferSize, lods.data());
 }
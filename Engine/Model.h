@@ -1,6 +1,7 @@
 #ifndef TOXENGINE_ENGINE_MODEL_H_
 #define TOXENGINE_ENGINE_MODEL_H_
 
+#include "AssetCache.h"
 #include "Buffer.h"
 #include "Vertex.h"
 
@@ -13,26 +14,56 @@ class Context;
 
 class Model {
 public:
-  Model(Context &context, const std::string path);
+  // range of the shared index buffer, error is the geometric deviation from
+  // the full mesh in model units, matches the cull shader's lod table
+  struct Lod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+  };
+
+  Model(Context &context, const std::string path,
+        const ModelOptions &options = ModelOptions());
 
   uint32_t getIndexCount() const { return nbIndices; }
   uint32_t getVertexCount() const { return nbVertices; }
+  const AssetCache::Bounds &getBounds() const { return bounds; }
+  VertexFormat getVertexFormat() const { return format; }
+  const VertexDecode &getDecode() const { return decode; }
+  VkIndexType getIndexType() const { return indexType; }
+  uint32_t getLodCount() const { return static_cast<uint32_t>(lods.size()); }
+  const Lod &getLod(uint32_t level) const { return lods[level]; }
 
   std::unique_ptr<Buffer> vertexBuffer;
   std::unique_ptr<Buffer> indexBuffer;
+  // the lods, read by the cull pass
+  std::unique_ptr<Buffer> lodBuffer;
 
-  std::vector<uint32_t> indices;
-  
 private:
   Context &context;
 
-  std::vector<Vertex> vertices;
+  void load(const std::string path, std::vector<Vertex> &vertices,
+            std::vector<uint32_t> &indices);
+  void buildLods(const std::vector<Vertex> &vertices,
+                 std::vector<uint32_t> &indices, uint32_t lodCount);
+  void encode(const std::vector<Vertex> &vertices,
+              std::vector<CompactVertex> &compact);
+  void createVertexBuffer(const void *vertices);
+  void createIndexBuffer(const void *indices);
+  void createLodBuffer();
 
-  void createVertexBuffer();
-  void createIndexBuffer();
+  size_t getVertexSize() const;
+  size_t getIndexSize() const;
 
   uint32_t nbIndices;
   uint32_t nbVertices;
+  AssetCache::Bounds bounds;
+  std::vector<Lod> lods;
+
+  VertexFormat format;
+  bool optimize;
+  VertexDecode decode;
+  VkIndexType indexType;
 };
 
 #endif // TOXENGINE_ENGINE_MODEL_H_
@@ -0,0 +1,721 @@
+#include "ObjLoader.h"
+
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+namespace {
+
+constexpr size_t MIN_CHUNK_SIZE = 1 << 20;
+
+enum CornerFlags : uint8_t {
+  RelativeVertex = 1 << 0,
+  RelativeTexcoord = 1 << 1,
+  RelativeNormal = 1 << 2
+};
+
+// face corner as written in the file, relative indices are resolved once
+// the vertex counts of all previous chunks are known
+struct Corner {
+  int vertex;
+  int texcoord;
+  int normal;
+  uint8_t flags;
+};
+
+inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+inline const char *skipSpace(const char *p, const char *end) {
+  while (p < end && isSpace(*p)) {
+    p++;
+  }
+  return p;
+}
+
+// same delimiters as tinyobj's strcspn(token, " \t\r")
+inline const char *tokenEnd(const char *p, const char *end) {
+  while (p < end && !isSpace(*p) && *p != '\r') {
+    p++;
+  }
+  return p;
+}
+
+inline const char *indexEnd(const char *p, const char *end) {
+  while (p < end && *p != '/' && !isSpace(*p) && *p != '\r') {
+    p++;
+  }
+  return p;
+}
+
+inline bool startsWith(const char *p, const char *end, const char *prefix) {
+  size_t length = strlen(prefix);
+  return static_cast<size_t>(end - p) >= length &&
+         memcmp(p, prefix, length) == 0;
+}
+
+// tinyobj's tryParseDouble, ported so floats round identically
+bool tryParseDouble(const char *s, const char *s_end, double *result) {
+  if (s >= s_end) {
+    return false;
+  }
+
+  double mantissa = 0.0;
+  int exponent = 0;
+  char sign = '+';
+  char exp_sign = '+';
+  const char *curr = s;
+  int read = 0;
+  bool end_not_reached = false;
+  bool leading_decimal_dots = false;
+
+  if (*curr == '+' || *curr == '-') {
+    sign = *curr;
+    curr++;
+    if ((curr != s_end) && (*curr == '.')) {
+      leading_decimal_dots = true;
+    }
+  } else if (isDigit(*curr)) {
+  } else if (*curr == '.') {
+    leading_decimal_dots = true;
+  } else {
+    return false;
+  }
+
+  end_not_reached = (curr != s_end);
+  if (!leading_decimal_dots) {
+    while (end_not_reached && isDigit(*curr)) {
+      mantissa *= 10;
+      mantissa += static_cast<int>(*curr - 0x30);
+      curr++;
+      read++;
+      end_not_reached = (curr != s_end);
+    }
+
+    if (read == 0) {
+      return false;
+    }
+  }
+
+  if (end_not_reached) {
+    if (*curr == '.') {
+      curr++;
+      read = 1;
+      end_not_reached = (curr != s_end);
+      while (end_not_reached && isDigit(*curr)) {
+        static const double pow_lut[] = {
+            1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001,
+        };
+        const int lut_entries = sizeof pow_lut / sizeof pow_lut[0];
+
+        mantissa += static_cast<int>(*curr - 0x30) *
+                    (read < lut_entries ? pow_lut[read] : std::pow(10.0, -read));
+        read++;
+        curr++;
+        end_not_reached = (curr != s_end);
+      }
+    }
+
+    if (end_not_reached && (*curr == 'e' || *curr == 'E')) {
+      curr++;
+      end_not_reached = (curr != s_end);
+      if (end_not_reached && (*curr == '+' || *curr == '-')) {
+        exp_sign = *curr;
+        curr++;
+      } else if (end_not_reached && isDigit(*curr)) {
+      } else {
+        return false;
+      }
+
+      read = 0;
+      end_not_reached = (curr != s_end);
+      while (end_not_reached && isDigit(*curr)) {
+        if (exponent > (2147483647 / 10)) {
+          return false;
+        }
+        exponent *= 10;
+        exponent += static_cast<int>(*curr - 0x30);
+        curr++;
+        read++;
+        end_not_reached = (curr != s_end);
+      }
+      exponent *= (exp_sign == '+' ? 1 : -1);
+      if (read == 0) {
+        return false;
+      }
+    }
+  }
+
+  *result = (sign == '+' ? 1 : -1) *
+            (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent)
+                      : mantissa);
+  return true;
+}
+
+inline float parseReal(const char *&p, const char *end,
+                       double defaultValue = 0.0) {
+  p = skipSpace(p, end);
+  const char *e = tokenEnd(p, end);
+  double value = defaultValue;
+  tryParseDouble(p, e, &value);
+  p = e;
+  return static_cast<float>(value);
+}
+
+// atoi semantics bounded to the line
+inline int parseInt(const char *p, const char *end) {
+  while (p < end && (isSpace(*p) || *p == '\n' || *p == '\v' || *p == '\f' ||
+                     *p == '\r')) {
+    p++;
+  }
+  bool negative = false;
+  if (p < end && (*p == '+' || *p == '-')) {
+    negative = *p == '-';
+    p++;
+  }
+  long long value = 0;
+  while (p < end && isDigit(*p) && value <= 2147483647LL) {
+    value = value * 10 + (*p - '0');
+    p++;
+  }
+  return static_cast<int>(negative ? -value : value);
+}
+
+// tinyobj's fixIndex, relative indices are kept relative to the chunk
+inline bool fixIndex(int idx, int count, int &ret, uint8_t &flags,
+                     uint8_t relative, bool allowZero) {
+  if (idx > 0) {
+    ret = idx - 1;
+    return true;
+  }
+  if (idx == 0) {
+    ret = -1;
+    return allowZero;
+  }
+  ret = count + idx;
+  flags |= relative;
+  return true;
+}
+
+// tinyobj's SplitString on the rest of a mtllib line, spaces can be
+// escaped with a backslash
+std::vector<std::string> splitFilenames(const std::string &line) {
+  std::vector<std::string> filenames;
+  std::string filename;
+  bool escaping = false;
+  for (char c : line) {
+    if (escaping) {
+      escaping = false;
+    } else if (c == '\\') {
+      escaping = true;
+      continue;
+    } else if (c == ' ') {
+      if (!filename.empty()) {
+        filenames.push_back(filename);
+      }
+      filename.clear();
+      continue;
+    }
+    filename += c;
+  }
+  filenames.push_back(filename);
+  return filenames;
+}
+
+// the base directory as tinyobj::LoadObj hands it to its
+// MaterialFileReader, a list of directories separated by ':'
+std::string searchPath(const std::string &mtlBaseDir) {
+  if (mtlBaseDir.empty() || mtlBaseDir.back() == '/') {
+    return mtlBaseDir;
+  }
+  return mtlBaseDir + "/";
+}
+
+// every path the MaterialFileReader tries for a filename
+std::vector<std::string> materialPaths(const std::string &filename,
+                                       const std::string &mtlBaseDir) {
+  std::string path = searchPath(mtlBaseDir);
+  if (path.empty()) {
+    return {filename};
+  }
+
+  std::vector<std::string> paths;
+  size_t begin = 0;
+  while (begin < path.size()) {
+    size_t end = std::min(path.find(':', begin), path.size());
+    std::string dir = path.substr(begin, end - begin);
+    if (dir.empty()) {
+      paths.push_back(filename);
+    } else {
+      paths.push_back(dir.back() == '/' ? dir + filename
+                                        : dir + "/" + filename);
+    }
+    begin = end + 1;
+  }
+  return paths;
+}
+
+// the mtllib lines of a file tinyobj parses
+void findMtllibs(const char *data, size_t size,
+                 std::vector<std::string> &mtllibs) {
+  const char *end = data + size;
+  const char *line = data;
+  while (line < end) {
+    const char *newline =
+        static_cast<const char *>(memchr(line, '\n', end - line));
+    const char *lineEnd = newline ? newline : end;
+    if (lineEnd > line && lineEnd[-1] == '\r') {
+      lineEnd--;
+    }
+
+    const char *p = skipSpace(line, lineEnd);
+    if (lineEnd - p >= 7 && startsWith(p, lineEnd, "mtllib") &&
+        isSpace(p[6])) {
+      mtllibs.emplace_back(p + 7, lineEnd);
+    }
+    line = newline ? newline + 1 : end;
+  }
+}
+
+} // namespace
+
+struct ObjLoader::Chunk {
+  const char *begin;
+  const char *end;
+
+  std::vector<float> positions;
+  std::vector<float> texcoords;
+  std::vector<float> normals;
+
+  std::vector<Corner> corners;
+  std::vector<uint32_t> faceSizes;
+  std::vector<int> faceMaterials; // into materialNames, -1 inherits
+
+  std::vector<std::string> materialNames;
+  // mtllib lines of the chunk before each usemtl
+  std::vector<uint32_t> materialMtllibs;
+  std::vector<std::string> mtllibs;
+
+  bool polygons = false; // a face with more than four corners
+  std::string error;
+
+  std::vector<Index> triangles;
+  std::vector<int> triangleMaterials;
+
+  void parse();
+  bool parseFace(const char *p, const char *lineEnd);
+};
+
+bool ObjLoader::Chunk::parseFace(const char *p, const char *lineEnd) {
+  int vertexCount = static_cast<int>(positions.size() / 3);
+  int texcoordCount = static_cast<int>(texcoords.size() / 2);
+  int normalCount = static_cast<int>(normals.size() / 3);
+
+  uint32_t size = 0;
+  while (p < lineEnd && *p != '\r') {
+    Corner corner{-1, -1, -1, 0};
+
+    if (!fixIndex(parseInt(p, lineEnd), vertexCount, corner.vertex,
+                  corner.flags, RelativeVertex, false)) {
+      return false;
+    }
+    p = indexEnd(p, lineEnd);
+
+    if (p < lineEnd && *p == '/') {
+      p++;
+      if (p < lineEnd && *p == '/') {
+        // i//k
+        p++;
+        if (!fixIndex(parseInt(p, lineEnd), normalCount, corner.normal,
+                      corner.flags, RelativeNormal, true)) {
+          return false;
+        }
+        p = indexEnd(p, lineEnd);
+      } else {
+        // i/j/k or i/j
+        if (!fixIndex(parseInt(p, lineEnd), texcoordCount, corner.texcoord,
+                      corner.flags, RelativeTexcoord, true)) {
+          return false;
+        }
+        p = indexEnd(p, lineEnd);
+
+        if (p < lineEnd && *p == '/') {
+          p++;
+          if (!fixIndex(parseInt(p, lineEnd), normalCount, corner.normal,
+                        corner.flags, RelativeNormal, true)) {
+            return false;
+          }
+          p = indexEnd(p, lineEnd);
+        }
+      }
+    }
+
+    corners.push_back(corner);
+    size++;
+
+    while (p < lineEnd && (isSpace(*p) || *p == '\r')) {
+      p++;
+    }
+  }
+
+  if (size < 3) {
+    // degenerated face, skipped like tinyobj does
+    corners.resize(corners.size() - size);
+    return true;
+  }
+  if (size > 4) {
+    polygons = true;
+  }
+
+  faceSizes.push_back(size);
+  faceMaterials.push_back(static_cast<int>(materialNames.size()) - 1);
+  return true;
+}
+
+void ObjLoader::Chunk::parse() {
+  const char *line = begin;
+  while (line < end && !polygons) {
+    const char *newline =
+        static_cast<const char *>(memchr(line, '\n', end - line));
+    const char *lineEnd = newline ? newline : end;
+    const char *next = newline ? newline + 1 : end;
+
+    if (lineEnd > line && lineEnd[-1] == '\r') {
+      lineEnd--;
+    }
+
+    const char *p = skipSpace(line, lineEnd);
+    line = next;
+
+    if (p == lineEnd || *p == '#' || *p == '\0') {
+      continue;
+    }
+
+    if (lineEnd - p >= 2 && p[0] == 'v' && isSpace(p[1])) {
+      p += 2;
+      positions.push_back(parseReal(p, lineEnd));
+      positions.push_back(parseReal(p, lineEnd));
+      positions.push_back(parseReal(p, lineEnd));
+      continue;
+    }
+
+    if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && isSpace(p[2])) {
+      p += 3;
+      normals.push_back(parseReal(p, lineEnd));
+      normals.push_back(parseReal(p, lineEnd));
+      normals.push_back(parseReal(p, lineEnd));
+      continue;
+    }
+
+    if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 't' && isSpace(p[2])) {
+      p += 3;
+      texcoords.push_back(parseReal(p, lineEnd));
+      texcoords.push_back(parseReal(p, lineEnd));
+      continue;
+    }
+
+    if (lineEnd - p >= 2 && p[0] == 'f' && isSpace(p[1])) {
+      if (!parseFace(skipSpace(p + 2, lineEnd), lineEnd)) {
+        error = "failed to parse `f' line (e.g. a zero value for vertex "
+                "index): " +
+                std::string(p, lineEnd);
+        return;
+      }
+      continue;
+    }
+
+    if (startsWith(p, lineEnd, "usemtl")) {
+      p = skipSpace(p + 6, lineEnd);
+      materialNames.emplace_back(p, tokenEnd(p, lineEnd));
+      materialMtllibs.push_back(static_cast<uint32_t>(mtllibs.size()));
+      continue;
+    }
+
+    if (lineEnd - p >= 7 && startsWith(p, lineEnd, "mtllib") &&
+        isSpace(p[6])) {
+      mtllibs.emplace_back(p + 7, lineEnd);
+      continue;
+    }
+  }
+}
+
+ObjLoader::ObjLoader(const std::string path, const std::string mtlBaseDir) {
+  MappedFile file(path);
+  if (!file.isOpen()) {
+    throw std::runtime_error("Cannot open file [" + path + "]");
+  }
+
+  const char *data = reinterpret_cast<const char *>(file.data());
+  if (!loadParallel(data, file.size(), mtlBaseDir)) {
+    loadTinyObj(path, mtlBaseDir);
+
+    std::vector<std::string> mtllibs;
+    findMtllibs(data, file.size(), mtllibs);
+    addMaterialFiles(mtllibs, mtlBaseDir);
+  }
+}
+
+bool ObjLoader::loadParallel(const char *data, size_t size,
+                             const std::string &mtlBaseDir) {
+  ThreadPool &pool = ThreadPool::shared();
+
+  // split on line boundaries
+  size_t chunkSize = std::max(MIN_CHUNK_SIZE, size / (pool.size() * 4) + 1);
+  std::vector<Chunk> chunks;
+  const char *end = data + size;
+  const char *begin = data;
+  while (begin < end) {
+    const char *chunkEnd = begin + std::min(chunkSize, size_t(end - begin));
+    if (chunkEnd < end) {
+      const char *newline =
+          static_cast<const char *>(memchr(chunkEnd, '\n', end - chunkEnd));
+      chunkEnd = newline ? newline + 1 : end;
+    }
+    chunks.emplace_back();
+    chunks.back().begin = begin;
+    chunks.back().end = chunkEnd;
+    begin = chunkEnd;
+  }
+
+  pool.parallelFor(chunks.size(), [&chunks](size_t i) { chunks[i].parse(); });
+
+  for (const auto &chunk : chunks) {
+    if (chunk.polygons) {
+      return false;
+    }
+  }
+  for (const auto &chunk : chunks) {
+    if (!chunk.error.empty()) {
+      throw std::runtime_error(chunk.error);
+    }
+  }
+
+  // every mtllib is loaded up front, a usemtl only sees the materials of
+  // the mtllib lines above it like in tinyobj
+  std::map<std::string, int> materialMap;
+  std::vector<std::string> mtllibs;
+  std::vector<size_t> mtllibBase(chunks.size());
+  for (size_t c = 0; c < chunks.size(); c++) {
+    mtllibBase[c] = mtllibs.size();
+    mtllibs.insert(mtllibs.end(), chunks[c].mtllibs.begin(),
+                   chunks[c].mtllibs.end());
+  }
+  std::vector<size_t> materialCounts;
+  loadMaterials(mtllibs, mtlBaseDir, materialMap, materialCounts);
+  addMaterialFiles(mtllibs, mtlBaseDir);
+
+  std::vector<std::vector<int>> chunkMaterialIds(chunks.size());
+  std::vector<int> inheritedMaterial(chunks.size());
+  int material = -1;
+  for (size_t c = 0; c < chunks.size(); c++) {
+    inheritedMaterial[c] = material;
+    for (size_t i = 0; i < chunks[c].materialNames.size(); i++) {
+      // material ids grow with every mtllib loaded
+      size_t loaded =
+          materialCounts[mtllibBase[c] + chunks[c].materialMtllibs[i]];
+      auto it = materialMap.find(chunks[c].materialNames[i]);
+      material = it != materialMap.end() &&
+                         static_cast<size_t>(it->second) < loaded
+                     ? it->second
+                     : -1;
+      chunkMaterialIds[c].push_back(material);
+    }
+  }
+
+  // prefix sums over the per chunk attribute counts
+  std::vector<size_t> positionBase(chunks.size() + 1, 0);
+  std::vector<size_t> texcoordBase(chunks.size() + 1, 0);
+  std::vector<size_t> normalBase(chunks.size() + 1, 0);
+  for (size_t c = 0; c < chunks.size(); c++) {
+    positionBase[c + 1] = positionBase[c] + chunks[c].positions.size();
+    texcoordBase[c + 1] = texcoordBase[c] + chunks[c].texcoords.size();
+    normalBase[c + 1] = normalBase[c] + chunks[c].normals.size();
+  }
+
+  positions.resize(positionBase.back());
+  texcoords.resize(texcoordBase.back());
+  normals.resize(normalBase.back());
+
+  pool.parallelFor(chunks.size(), [&](size_t c) {
+    std::copy(chunks[c].positions.begin(), chunks[c].positions.end(),
+              positions.begin() + positionBase[c]);
+    std::copy(chunks[c].texcoords.begin(), chunks[c].texcoords.end(),
+              texcoords.begin() + texcoordBase[c]);
+    std::copy(chunks[c].normals.begin(), chunks[c].normals.end(),
+              normals.begin() + normalBase[c]);
+  });
+
+  // resolve relative indices and triangulate
+  pool.parallelFor(chunks.size(), [&](size_t c) {
+    Chunk &chunk = chunks[c];
+    int vertexBase = static_cast<int>(positionBase[c] / 3);
+    int texcoordBaseIndex = static_cast<int>(texcoordBase[c] / 2);
+    int normalBaseIndex = static_cast<int>(normalBase[c] / 3);
+
+    auto resolve = [&](const Corner &corner) {
+      Index index{corner.vertex, corner.texcoord, corner.normal};
+      if (corner.flags & RelativeVertex) {
+        index.vertex += vertexBase;
+      }
+      if (corner.flags & RelativeTexcoord) {
+        index.texcoord += texcoordBaseIndex;
+      }
+      if (corner.flags & RelativeNormal) {
+        index.normal += normalBaseIndex;
+      }
+      if (index.vertex < 0 || ((corner.flags & RelativeTexcoord) &&
+                               index.texcoord < 0) ||
+          ((corner.flags & RelativeNormal) && index.normal < 0)) {
+        throw std::runtime_error(
+            "failed to parse `f' line (invalid relative vertex index)");
+      }
+      return index;
+    };
+
+    chunk.triangles.reserve(chunk.corners.size());
+    const Corner *corner = chunk.corners.data();
+    for (size_t f = 0; f < chunk.faceSizes.size(); f++) {
+      uint32_t faceSize = chunk.faceSizes[f];
+      int local = chunk.faceMaterials[f];
+      int faceMaterial =
+          local < 0 ? inheritedMaterial[c] : chunkMaterialIds[c][local];
+
+      if (faceSize == 3) {
+        chunk.triangles.push_back(resolve(corner[0]));
+        chunk.triangles.push_back(resolve(corner[1]));
+        chunk.triangles.push_back(resolve(corner[2]));
+        chunk.triangleMaterials.push_back(faceMaterial);
+      } else {
+        Index i0 = resolve(corner[0]);
+        Index i1 = resolve(corner[1]);
+        Index i2 = resolve(corner[2]);
+        Index i3 = resolve(corner[3]);
+
+        size_t vi0 = size_t(i0.vertex), vi1 = size_t(i1.vertex),
+               vi2 = size_t(i2.vertex), vi3 = size_t(i3.vertex);
+        if ((3 * vi0 + 2) < positions.size() &&
+            (3 * vi1 + 2) < positions.size() &&
+            (3 * vi2 + 2) < positions.size() &&
+            (3 * vi3 + 2) < positions.size()) {
+          // split along the shorter diagonal
+          float e02x = positions[vi2 * 3 + 0] - positions[vi0 * 3 + 0];
+          float e02y = positions[vi2 * 3 + 1] - positions[vi0 * 3 + 1];
+          float e02z = positions[vi2 * 3 + 2] - positions[vi0 * 3 + 2];
+          float e13x = positions[vi3 * 3 + 0] - positions[vi1 * 3 + 0];
+          float e13y = positions[vi3 * 3 + 1] - positions[vi1 * 3 + 1];
+          float e13z = positions[vi3 * 3 + 2] - positions[vi1 * 3 + 2];
+
+          float sqr02 = e02x * e02x + e02y * e02y + e02z * e02z;
+          float sqr13 = e13x * e13x + e13y * e13y + e13z * e13z;
+
+          if (sqr02 < sqr13) {
+            chunk.triangles.insert(chunk.triangles.end(),
+                                   {i0, i1, i2, i0, i2, i3});
+          } else {
+            chunk.triangles.insert(chunk.triangles.end(),
+                                   {i0, i1, i3, i1, i2, i3});
+          }
+          chunk.triangleMaterials.push_back(faceMaterial);
+          chunk.triangleMaterials.push_back(faceMaterial);
+        }
+      }
+      corner += faceSize;
+    }
+  });
+
+  std::vector<size_t> triangleBase(chunks.size() + 1, 0);
+  for (size_t c = 0; c < chunks.size(); c++) {
+    triangleBase[c + 1] = triangleBase[c] + chunks[c].triangleMaterials.size();
+  }
+
+  indices.resize(triangleBase.back() * 3);
+  materialIds.resize(triangleBase.back());
+
+  pool.parallelFor(chunks.size(), [&](size_t c) {
+    std::copy(chunks[c].triangles.begin(), chunks[c].triangles.end(),
+              indices.begin() + 3 * triangleBase[c]);
+    std::copy(chunks[c].triangleMaterials.begin(),
+              chunks[c].triangleMaterials.end(),
+              materialIds.begin() + triangleBase[c]);
+  });
+
+  return true;
+}
+
+void ObjLoader::loadMaterials(const std::vector<std::string> &mtllibs,
+                              const std::string &mtlBaseDir,
+                              std::map<std::string, int> &materialMap,
+                              std::vector<size_t> &materialCounts) {
+  // tinyobj::LoadObj's mtllib handling, the first file of a line that
+  // loads is used and files loaded before are skipped
+  tinyobj::MaterialFileReader reader(searchPath(mtlBaseDir));
+  std::set<std::string> loaded;
+
+  materialCounts.assign(1, 0);
+  for (const auto &line : mtllibs) {
+    for (const auto &filename : splitFilenames(line)) {
+      if (loaded.count(filename) > 0) {
+        continue;
+      }
+
+      std::string warn, err;
+      if (reader(filename, &materials, &materialMap, &warn, &err)) {
+        loaded.insert(filename);
+        break;
+      }
+    }
+    materialCounts.push_back(materials.size());
+  }
+}
+
+void ObjLoader::addMaterialFiles(const std::vector<std::string> &mtllibs,
+                                 const std::string &mtlBaseDir) {
+  for (const auto &line : mtllibs) {
+    for (const auto &filename : splitFilenames(line)) {
+      if (filename.empty()) {
+        continue;
+      }
+      for (const auto &filepath : materialPaths(filename, mtlBaseDir)) {
+        if (std::find(materialFiles.begin(), materialFiles.end(),
+                      filepath) == materialFiles.end()) {
+          materialFiles.push_back(filepath);
+        }
+      }
+    }
+  }
+}
+
+void ObjLoader::loadTinyObj(const std::string &path,
+                            const std::string &mtlBaseDir) {
+  tinyobj::attrib_t attrib;
+  std::vector<tinyobj::shape_t> shapes;
+  std::string warn, err;
+
+  if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
+                        path.c_str(),
+                        mtlBaseDir.empty() ? nullptr : mtlBaseDir.c_str())) {
+    throw std::runtime_error(warn + err);
+  }
+
+  positions = std::move(attrib.vertices);
+  texcoords = std::move(attrib.texcoords);
+  normals = std::move(attrib.normals);
+
+  indices.clear();
+  materialIds.clear();
+  for (const auto &shape : shapes) {
+    for (const auto &index : shape.mesh.indices) {
+      indices.push_back(
+          {index.vertex_index, index.texcoord_index, index.normal_index});
+    }
+    materialIds.insert(materialIds.end(), shape.mesh.material_ids.begin(),
+                       shape.mesh.material_ids.end());
+  }
+}
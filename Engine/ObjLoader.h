@@ -0,0 +1,52 @@
+#ifndef TOXENGINE_ENGINE_OBJLOADER_H_
+#define TOXENGINE_ENGINE_OBJLOADER_H_
+
+#include <tiny_obj_loader.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Parallel Wavefront OBJ importer. The file is split into chunks on line
+// boundaries that are parsed on the shared ThreadPool and stitched together
+// with prefix sums afterwards. Output matches tinyobj::LoadObj with
+// triangulation: faces are flattened in file order, quads are split along
+// the shorter diagonal, and materials resolve like in tinyobj: a usemtl
+// only sees the materials of the mtllib lines above it. Files with larger
+// polygons are handed to tinyobj. Benchmarks/ObjLoaderBenchmark compares
+// both loaders.
+class ObjLoader {
+public:
+  struct Index {
+    int vertex;
+    int texcoord; // -1 if missing
+    int normal;   // -1 if missing
+  };
+
+  ObjLoader(const std::string path, const std::string mtlBaseDir = "");
+
+  std::vector<float> positions; // xyz
+  std::vector<float> texcoords; // uv
+  std::vector<float> normals;   // xyz
+
+  std::vector<Index> indices;    // three per triangle
+  std::vector<int> materialIds;  // one per triangle, -1 without material
+  std::vector<tinyobj::material_t> materials;
+  // every .mtl path named by the mtllib lines, whether it exists or not
+  std::vector<std::string> materialFiles;
+
+private:
+  struct Chunk;
+
+  bool loadParallel(const char *data, size_t size,
+                    const std::string &mtlBaseDir);
+  void loadTinyObj(const std::string &path, const std::string &mtlBaseDir);
+  void loadMaterials(const std::vector<std::string> &mtllibs,
+                     const std::string &mtlBaseDir,
+                     std::map<std::string, int> &materialMap,
+                     std::vector<size_t> &materialCounts);
+  void addMaterialFiles(const std::vector<std::string> &mtllibs,
+                        const std::string &mtlBaseDir);
+};
+
+#endif // TOXENGINE_ENGINE_OBJLOADER_H_
@@ -82,6 +82,24 @@ PhysicalDevice::QueueFamilyIndices PhysicalDevice::findQueueFamilies() {
     i++;
   }
 
+  // prefer pure copy engines over async compute families, both need to
+  // copy at texel granularity for the smallest mip levels
+  uint32_t best = 0;
+  for (uint32_t j = 0; j < queueFamilyCount; j++) {
+    VkQueueFlags flags = queueFamilies[j].queueFlags;
+    VkExtent3D granularity = queueFamilies[j].minImageTransferGranularity;
+    if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT) ||
+        granularity.width != 1 || granularity.height != 1 ||
+        granularity.depth != 1) {
+      continue;
+    }
+    uint32_t score = flags & VK_QUEUE_COMPUTE_BIT ? 1 : 2;
+    if (score > best) {
+      best = score;
+      indices.transferFamily = j;
+    }
+  }
+
   return indices;
 }
 
@@ -116,19 +134,74 @@ PhysicalDevice::querySwapChainSupport() {
   return details;
 }
 
+VkPhysicalDeviceFeatures PhysicalDevice::getFeatures() {
+  VkPhysicalDeviceFeatures features;
+  vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+  return features;
+}
+
+VkPhysicalDeviceAccelerationStructureFeaturesKHR
+PhysicalDevice::getAccelerationStructureFeatures() {
+  VkPhysicalDeviceAccelerationStructureFeaturesKHR asFeatures{};
+  asFeatures.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+  VkPhysicalDeviceFeatures2 features{};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.pNext = &asFeatures;
+  vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+  asFeatures.pNext = nullptr;
+  return asFeatures;
+}
+
+VkPhysicalDeviceDescriptorIndexingFeatures
+PhysicalDevice::getDescriptorIndexingFeatures() {
+  VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{};
+  indexingFeatures.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+  VkPhysicalDeviceFeatures2 features{};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.pNext = &indexingFeatures;
+  vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+  indexingFeatures.pNext = nullptr;
+  return indexingFeatures;
+}
+
+VkPhysicalDeviceDescriptorIndexingProperties
+PhysicalDevice::getDescriptorIndexingProperties() {
+  VkPhysicalDeviceDescriptorIndexingProperties indexingProperties{};
+  indexingProperties.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+  VkPhysicalDeviceProperties2 properties{};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &indexingProperties;
+  vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+  indexingProperties.pNext = nullptr;
+  return indexingProperties;
+}
+
 uint32_t PhysicalDevice::findMemoryType(uint32_t typeFilter,
                                         VkMemoryPropertyFlags properties) {
+  uint32_t memoryType;
+  if (!findMemoryType(typeFilter, properties, memoryType)) {
+    throw std::runtime_error("failed to find suitable memory type!");
+  }
+  return memoryType;
+}
+
+bool PhysicalDevice::findMemoryType(uint32_t typeFilter,
+                                    VkMemoryPropertyFlags properties,
+                                    uint32_t &memoryType) {
   VkPhysicalDeviceMemoryProperties memProperties;
   vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
 
   for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
     if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags &
                                     properties) == properties) {
-      return i;
+      memoryType = i;
+      return true;
     }
   }
-
-  throw std::runtime_error("failed to find suitable memory type!");
+  return false;
 }
 
 VkFormat
@@ -136,14 +209,7 @@ PhysicalDevice::findSupportedFormat(const std::vector<VkFormat> &candidates,
                                     VkImageTiling tiling,
                                     VkFormatFeatureFlags features) {
   for (VkFormat format : candidates) {
-    VkFormatProperties props;
-    vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
-
-    if (tiling == VK_IMAGE_TILING_LINEAR &&
-        (props.linearTilingFeatures & features) == features) {
-      return format;
-    } else if (tiling == VK_IMAGE_TILING_OPTIMAL &&
-               (props.optimalTilingFeatures & features) == features) {
+    if (hasFormatFeatures(format, tiling, features)) {
       return format;
     }
   }
@@ -151,6 +217,19 @@ PhysicalDevice::findSupportedFormat(const std::vector<VkFormat> &candidates,
   throw std::runtime_error("failed to find supported format!");
 }
 
+bool PhysicalDevice::hasFormatFeatures(VkFormat format, VkImageTiling tiling,
+                                       VkFormatFeatureFlags features) {
+  VkFormatProperties props;
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+
+  if (tiling == VK_IMAGE_TILING_LINEAR) {
+    return (props.linearTilingFeatures & features) == features;
+  } else if (tiling == VK_IMAGE_TILING_OPTIMAL) {
+    return (props.optimalTilingFeatures & features) == features;
+  }
+  return false;
+}
+
 bool PhysicalDevice::hasRequiredFeatures() {
   QueueFamilyIndices indices = findQueueFamilies();
 
@@ -163,9 +242,22 @@ bool PhysicalDevice::hasRequiredFeatures() {
                         !swapChainSupport.presentModes.empty();
   }
 
-  VkPhysicalDeviceFeatures supportedFeatures;
-  vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+  VkPhysicalDeviceFeatures supportedFeatures = getFeatures();
+
+  // everything the bindless table uses
+  VkPhysicalDeviceDescriptorIndexingFeatures indexing =
+      getDescriptorIndexingFeatures();
+  bool bindless =
+      indexing.runtimeDescriptorArray &&
+      indexing.descriptorBindingPartiallyBound &&
+      indexing.descriptorBindingUpdateUnusedWhilePending &&
+      indexing.descriptorBindingStorageBufferUpdateAfterBind &&
+      indexing.descriptorBindingSampledImageUpdateAfterBind &&
+      indexing.shaderStorageBufferArrayNonUniformIndexing &&
+      indexing.shaderSampledImageArrayNonUniformIndexing;
 
   return indices.isComplete() && extensionsSupported && swapChainAdequate &&
-         supportedFeatures.samplerAnisotropy;
+         supportedFeatures.samplerAnisotropy &&
+         supportedFeatures.multiDrawIndirect &&
+         supportedFeatures.drawIndirectFirstInstance && bindless;
 }
@@ -16,6 +16,9 @@ public:
   struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    // transfer capable family without graphics, uploads run on the
+    // graphics family when there is none
+    std::optional<uint32_t> transferFamily;
 
     bool isComplete() {
       return graphicsFamily.has_value() && presentFamily.has_value();
@@ -32,14 +35,25 @@ public:
   ~PhysicalDevice() {}
 
   VkPhysicalDevice get() { return physicalDevice; }
+  VkPhysicalDeviceFeatures getFeatures();
+  VkPhysicalDeviceAccelerationStructureFeaturesKHR
+  getAccelerationStructureFeatures();
+  VkPhysicalDeviceDescriptorIndexingFeatures getDescriptorIndexingFeatures();
+  VkPhysicalDeviceDescriptorIndexingProperties
+  getDescriptorIndexingProperties();
   bool checkDeviceExtensionSupport();
   QueueFamilyIndices findQueueFamilies();
   SwapChainSupportDetails querySwapChainSupport();
   uint32_t findMemoryType(uint32_t typeFilter,
                           VkMemoryPropertyFlags properties);
+  // false instead of throwing when no memory type matches
+  bool findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties,
+                      uint32_t &memoryType);
   VkFormat findSupportedFormat(const std::vector<VkFormat> &candidates,
                                VkImageTiling tiling,
                                VkFormatFeatureFlags features);
+  bool hasFormatFeatures(VkFormat format, VkImageTiling tiling,
+                         VkFormatFeatureFlags features);
 
 protected:
   virtual bool hasRequiredFeatures();
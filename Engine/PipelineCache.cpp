@@ -0,0 +1,151 @@
+#include "PipelineCache.h"
+
+#include "Hash.h"
+#include "MappedFile.h"
+#include "Stats.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+PipelineCache::PipelineCache(VkDevice device, VkPhysicalDevice physicalDevice,
+                             const std::string &path)
+    : device(device), path(path) {
+  VkPhysicalDeviceIDProperties idProperties{};
+  idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+  VkPhysicalDeviceProperties2 properties{};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &idProperties;
+  vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+  identity.magic = MAGIC;
+  identity.version = VERSION;
+  identity.vendorID = properties.properties.vendorID;
+  identity.deviceID = properties.properties.deviceID;
+  identity.driverVersion = properties.properties.driverVersion;
+  memcpy(identity.driverUUID, idProperties.driverUUID, VK_UUID_SIZE);
+  memcpy(identity.pipelineCacheUUID, properties.properties.pipelineCacheUUID,
+         VK_UUID_SIZE);
+
+  MappedFile file(path);
+  size_t dataSize = file.isOpen() ? validate(file.data(), file.size()) : 0;
+
+  VkPipelineCacheCreateInfo createInfo{};
+  createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  createInfo.initialDataSize = dataSize;
+  createInfo.pInitialData = dataSize > 0 ? file.data() + sizeof(Header)
+                                         : nullptr;
+
+  if (vkCreatePipelineCache(device, &createInfo, nullptr, &cache) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create pipeline cache!");
+  }
+
+  if (enableStats && dataSize > 0) {
+    std::cout << "pipeline cache: loaded " << dataSize / 1024 << " KB from "
+              << path << std::endl;
+  }
+}
+
+PipelineCache::~PipelineCache() {
+  if (!save()) {
+    std::cerr << "failed to write pipeline cache " << path << std::endl;
+  }
+  vkDestroyPipelineCache(device, cache, nullptr);
+}
+
+size_t PipelineCache::validate(const uint8_t *file, size_t size) {
+  if (size < sizeof(Header)) {
+    if (enableStats) {
+      std::cout << "pipeline cache: " << path << " is truncated" << std::endl;
+    }
+    return 0;
+  }
+
+  Header header;
+  memcpy(&header, file, sizeof(header));
+  if (header.magic != MAGIC || header.version != VERSION) {
+    if (enableStats) {
+      std::cout << "pipeline cache: " << path << " has an old format"
+                << std::endl;
+    }
+    return 0;
+  }
+  if (header.vendorID != identity.vendorID ||
+      header.deviceID != identity.deviceID ||
+      header.driverVersion != identity.driverVersion ||
+      memcmp(header.driverUUID, identity.driverUUID, VK_UUID_SIZE) != 0 ||
+      memcmp(header.pipelineCacheUUID, identity.pipelineCacheUUID,
+             VK_UUID_SIZE) != 0) {
+    if (enableStats) {
+      std::cout << "pipeline cache: " << path
+                << " was written by another device or driver" << std::endl;
+    }
+    return 0;
+  }
+
+  const uint8_t *data = file + sizeof(Header);
+  if (header.dataSize != size - sizeof(Header) ||
+      hash::bytes(data, header.dataSize) != header.dataHash) {
+    if (enableStats) {
+      std::cout << "pipeline cache: " << path << " is corrupt" << std::endl;
+    }
+    return 0;
+  }
+
+  // drivers are expected to check their own header but not all do
+  VkPipelineCacheHeaderVersionOne driverHeader;
+  if (header.dataSize < sizeof(driverHeader)) {
+    return 0;
+  }
+  memcpy(&driverHeader, data, sizeof(driverHeader));
+  if (driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+      driverHeader.vendorID != identity.vendorID ||
+      driverHeader.deviceID != identity.deviceID ||
+      memcmp(driverHeader.pipelineCacheUUID, identity.pipelineCacheUUID,
+             VK_UUID_SIZE) != 0) {
+    return 0;
+  }
+
+  return header.dataSize;
+}
+
+bool PipelineCache::save() {
+  size_t dataSize = 0;
+  if (vkGetPipelineCacheData(device, cache, &dataSize, nullptr) !=
+      VK_SUCCESS) {
+    return false;
+  }
+  std::vector<uint8_t> data(dataSize);
+  if (vkGetPipelineCacheData(device, cache, &dataSize, data.data()) !=
+      VK_SUCCESS) {
+    return false;
+  }
+
+  Header header = identity;
+  header.dataSize = dataSize;
+  header.dataHash = hash::bytes(data.data(), dataSize);
+
+  // write to a temporary file first so a crash never leaves a partial cache
+  std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      return false;
+    }
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(data.data()), dataSize);
+
+    if (!file.good()) {
+      file.close();
+      std::remove(tmpPath.c_str());
+      return false;
+    }
+  }
+
+  return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
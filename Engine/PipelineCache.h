@@ -0,0 +1,54 @@
+#ifndef TOXENGINE_ENGINE_PIPELINECACHE_H_
+#define TOXENGINE_ENGINE_PIPELINECACHE_H_
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+
+// VkPipelineCache persisted between runs, shared by every pipeline the
+// engine creates. The file starts with our own header that names the
+// device and driver it was written by, caches from another vendor, device,
+// driver version or driver UUID, and truncated or corrupt files, are
+// dropped before the driver sees them.
+class PipelineCache {
+public:
+  PipelineCache(VkDevice device, VkPhysicalDevice physicalDevice,
+                const std::string &path);
+  // saves the cache
+  ~PipelineCache();
+
+  PipelineCache(const PipelineCache &) = delete;
+  PipelineCache &operator=(const PipelineCache &) = delete;
+
+  VkPipelineCache get() { return cache; }
+
+  bool save();
+
+private:
+  static constexpr uint32_t MAGIC = 0x50584f54; // "TOXP"
+  static constexpr uint32_t VERSION = 1;
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint32_t reserved;
+    uint8_t driverUUID[VK_UUID_SIZE];
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+    uint64_t dataHash;
+  };
+
+  VkDevice device;
+  std::string path;
+  Header identity{};
+  VkPipelineCache cache = VK_NULL_HANDLE;
+
+  // returns the size of the usable cache data in file, 0 if there is none
+  size_t validate(const uint8_t *file, size_t size);
+};
+
+#endif // TOXENGINE_ENGINE_PIPELINECACHE_H_
@@ -1,153 +1,183 @@
 #include "RTXModel.h"
 
 #include "AccelerationStructure.h"
-#include "Buffer.h"
+#include "Hash.h"
+#include "ObjLoader.h"
+#include "Stats.h"
+#include "VertexDedup.h"
 
-#include <tiny_obj_loader.h>
 #include <vulkan/vulkan.h>
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <cstring>
 #include <memory>
 
+namespace {
+
+// 1: welded vertices
+constexpr uint32_t CACHE_VARIANT = 1;
+
+} // namespace
+
 RTXModel::RTXModel(Context &context, const std::string path)
     : context(context) {
   load(path);
-  VkDeviceAddress vertexAddress = vertexBuffer->getDeviceAddress();
-  VkDeviceAddress indexAddress = indexBuffer->getDeviceAddress();
 
+  // the serialized blas of the last run is restored as long as the welded
+  // geometry and the driver are the same
+  blasCachePath = AssetCache::path(path, "blas");
+  blasCacheKey =
+      hash::bytes(getIndices(), sizeof(uint32_t) * nbIndices,
+                  hash::bytes(getVertices(), sizeof(Vertex) * nbVertices));
+  BLAS = context.device->getAccelerationStructureBuilder().load(blasCachePath,
+                                                               blasCacheKey);
+}
+
+void RTXModel::createBLAS(VkDeviceAddress vertexAddress,
+                          VkDeviceAddress indexAddress) {
+  if (BLAS) {
+    return;
+  }
+
+  AccelerationStructureBuilder &builder =
+      context.device->getAccelerationStructureBuilder();
   uint32_t primitiveCount = getIndexCount() / 3;
 
   VkAccelerationStructureGeometryTrianglesDataKHR triangles{};
   triangles.sType =
       VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
   triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-  triangles.vertexData.deviceAddress = vertexAddress;
   triangles.vertexStride = sizeof(Vertex);
   triangles.indexType = VK_INDEX_TYPE_UINT32;
-  triangles.indexData.deviceAddress = indexAddress;
   triangles.maxVertex = getVertexCount();
 
   VkAccelerationStructureGeometryKHR asGeom{};
   asGeom.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
   asGeom.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
   asGeom.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+
+  if (context.device->hasHostAccelerationStructureBuilds()) {
+    // built on the thread pool, it reads the host geometry until the scene
+    // waits for it
+    triangles.vertexData.hostAddress = getVertices();
+    triangles.indexData.hostAddress = getIndices();
+    asGeom.geometry.triangles = triangles;
+
+    BLAS = std::make_unique<AccelerationStructure>(
+        context, asGeom, primitiveCount,
+        VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        AccelerationStructure::Build::Host, true);
+    builder.save(*BLAS, blasCachePath, blasCacheKey);
+    return;
+  }
+
+  // built together with every other mesh's on the next builder.build()
+  triangles.vertexData.deviceAddress = vertexAddress;
+  triangles.indexData.deviceAddress = indexAddress;
   asGeom.geometry.triangles = triangles;
+  BLAS = builder.add(asGeom, primitiveCount);
+  builder.save(*BLAS, blasCachePath, blasCacheKey);
+}
+
+void RTXModel::release() {
+  cache.reset();
+  vertices = {};
+  indices = {};
+  faces = {};
+}
 
-  BLAS = std::make_unique<AccelerationStructure>(
-      context, asGeom, primitiveCount,
-      VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR);
-
-  // TLAS
-  // TODO to support mulitple models move TLAS out of here
-  // VkTransformMatrixKHR transformMatrix{0.05f, 0.0f,   0.0f,  0.0f, ///////
-  // 0.0f,  0.0f,   0.05f, 0.0f, ///////
-  //                                   0.0f,  -0.05f, 0.0f,  0.0f};
-
-  VkTransformMatrixKHR transformMatrix{1.0f, 0.0f, 0.0f, 0.0f, //
-                                       0.0f, 1.0f, 0.0f, 0.0f, //
-                                       0.0f, 0.0f, 1.0f, 0.0f};
-
-  VkAccelerationStructureInstanceKHR asInstance{};
-  // TODO this should be the model transform (model matrix)
-  asInstance.transform = transformMatrix;
-  asInstance.instanceCustomIndex =
-      0; // todo unique per model - shader access index
-  asInstance.accelerationStructureReference = BLAS->buffer->getDeviceAddress();
-  asInstance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-  asInstance.mask = 0xFF;
-  asInstance.instanceShaderBindingTableRecordOffset = 0; // (hit group)
-
-  instancesBuffer = std::make_unique<Buffer>(
-      context, Buffer::Type::AccelInput,
-      sizeof(VkAccelerationStructureInstanceKHR), &asInstance);
-
-  VkAccelerationStructureGeometryInstancesDataKHR instancesData{};
-  instancesData.sType =
-      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
-  instancesData.arrayOfPointers = false;
-  instancesData.data.deviceAddress = instancesBuffer->getDeviceAddress();
-
-  VkAccelerationStructureGeometryKHR instanceGeometry{};
-  instanceGeometry.sType =
-      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
-  instanceGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
-  instanceGeometry.geometry.instances = instancesData;
-  instanceGeometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
-
-  TLAS = std::make_unique<AccelerationStructure>(
-      context, instanceGeometry, 1,
-      VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR);
+const RTXModel::Vertex *RTXModel::getVertices() const {
+  return cache ? cache->get<Vertex>(AssetCache::Section::Vertices)
+               : vertices.data();
+}
+
+const uint32_t *RTXModel::getIndices() const {
+  return cache ? cache->get<uint32_t>(AssetCache::Section::Indices)
+               : indices.data();
+}
+
+const Face *RTXModel::getFaces() const {
+  return cache ? cache->get<Face>(AssetCache::Section::Faces) : faces.data();
 }
 
 void RTXModel::load(const std::string path) {
-  tinyobj::attrib_t attrib;
-  std::vector<tinyobj::shape_t> shapes;
-  std::vector<tinyobj::material_t> materials;
-  std::string warn, err;
-
-  if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.c_str(),
-                        "../resources/models")) {
-    throw std::runtime_error(warn + err);
+  // kept mapped until release(), the scene uploads straight from it
+  auto mapped = std::make_unique<AssetCache>(path, "rtx", CACHE_VARIANT);
+  if (mapped->isValid() && mapped->has(AssetCache::Section::Bounds)) {
+    nbVertices = mapped->count<Vertex>(AssetCache::Section::Vertices);
+    nbIndices = mapped->count<uint32_t>(AssetCache::Section::Indices);
+    nbFaces = mapped->count<Face>(AssetCache::Section::Faces);
+    bounds = *mapped->get<AssetCache::Bounds>(AssetCache::Section::Bounds);
+    cache = std::move(mapped);
+    return;
   }
+  mapped.reset();
 
-  for (const auto &shape : shapes) {
-    for (const auto &index : shape.mesh.indices) {
-      Vertex vertex{};
-      vertex.pos[0] = attrib.vertices[3 * index.vertex_index + 0];
-      vertex.pos[1] = -attrib.vertices[3 * index.vertex_index + 1];
-      vertex.pos[2] = attrib.vertices[3 * index.vertex_index + 2];
-      vertices.push_back(vertex);
-      indices.push_back(static_cast<uint32_t>(indices.size()));
-    }
-    for (const auto &matIndex : shape.mesh.material_ids) {
-      Face face;
-      face.diffuse[0] = materials[matIndex].diffuse[0];
-      face.diffuse[1] = materials[matIndex].diffuse[1];
-      face.diffuse[2] = materials[matIndex].diffuse[2];
-      face.emission[0] = materials[matIndex].emission[0];
-      face.emission[1] = materials[matIndex].emission[1];
-      face.emission[2] = materials[matIndex].emission[2];
-      faces.push_back(face);
-    }
-  }
+  std::vector<std::string> materialFiles;
+  import(path, materialFiles);
 
   nbIndices = indices.size();
   nbVertices = vertices.size();
   nbFaces = faces.size();
 
-  createVertexBuffer();
-  createIndexBuffer();
-  createFaceBuffer();
+  // the faces embed the materials, edits to the .mtl files invalidate too
+  AssetCache::Writer writer;
+  for (const auto &materialFile : materialFiles) {
+    writer.addDependency(materialFile);
+  }
+  writer.add(AssetCache::Section::Vertices, vertices.data(),
+             sizeof(Vertex) * nbVertices);
+  writer.add(AssetCache::Section::Indices, indices.data(),
+             sizeof(uint32_t) * nbIndices);
+  writer.add(AssetCache::Section::Faces, faces.data(), sizeof(Face) * nbFaces);
+  writer.add(AssetCache::Section::Bounds, &bounds, sizeof(bounds));
+  if (!writer.write(path, "rtx", CACHE_VARIANT)) {
+    std::cerr << "failed to write mesh cache for " << path << std::endl;
+  }
 }
 
-void RTXModel::createVertexBuffer() {
-  VkDeviceSize bufferSize = sizeof(vertices[0]) * nbVertices;
-  Buffer stagingBuffer(context, Buffer::Type::Staging, bufferSize,
-                       vertices.data());
-  vertexBuffer =
-      std::make_unique<Buffer>(context, Buffer::Type::Vertex, bufferSize);
-  vertexBuffer->copy(stagingBuffer, bufferSize);
-  stagingBuffer.cleanup();
-}
+void RTXModel::import(const std::string path,
+                      std::vector<std::string> &materialFiles) {
+  ObjLoader obj(path, "../resources/models");
+  materialFiles = obj.materialFiles;
+
+  std::vector<Vertex> corners(obj.indices.size());
+  for (size_t i = 0; i < obj.indices.size(); i++) {
+    const auto &index = obj.indices[i];
+    corners[i].pos[0] = obj.positions[3 * index.vertex + 0];
+    corners[i].pos[1] = -obj.positions[3 * index.vertex + 1];
+    corners[i].pos[2] = obj.positions[3 * index.vertex + 2];
+  }
 
-void RTXModel::createIndexBuffer() {
-  VkDeviceSize bufferSize = sizeof(indices[0]) * nbIndices;
-  Buffer stagingBuffer(context, Buffer::Type::Staging, bufferSize,
-                       indices.data());
-  indexBuffer =
-      std::make_unique<Buffer>(context, Buffer::Type::Index, bufferSize);
-  indexBuffer->copy(stagingBuffer, bufferSize);
-  stagingBuffer.cleanup();
-}
+  // weld shared positions, triangle order and with it the face order used
+  // by gl_PrimitiveID stays the same
+  VertexDedup dedup(corners.data(), corners.size(), sizeof(Vertex));
+  dedup.gather(corners.data(), vertices);
+  indices = std::move(dedup.remap);
+  if (enableStats) {
+    std::cout << "welded " << corners.size() << " vertices to "
+              << vertices.size() << std::endl;
+  }
 
-void RTXModel::createFaceBuffer() {
-  VkDeviceSize bufferSize = sizeof(faces[0]) * nbFaces;
-  Buffer stagingBuffer(context, Buffer::Type::Staging, bufferSize,
-                       faces.data());
-  faceBuffer =
-      std::make_unique<Buffer>(context, Buffer::Type::Face, bufferSize);
-  faceBuffer->copy(stagingBuffer, bufferSize);
-  stagingBuffer.cleanup();
+  for (const auto &matIndex : obj.materialIds) {
+    Face face;
+    face.diffuse[0] = obj.materials[matIndex].diffuse[0];
+    face.diffuse[1] = obj.materials[matIndex].diffuse[1];
+    face.diffuse[2] = obj.materials[matIndex].diffuse[2];
+    face.emission[0] = obj.materials[matIndex].emission[0];
+    face.emission[1] = obj.materials[matIndex].emission[1];
+    face.emission[2] = obj.materials[matIndex].emission[2];
+    faces.push_back(face);
+  }
+
+  bounds = {{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}};
+  for (size_t i = 0; i < vertices.size(); i++) {
+    for (int axis = 0; axis < 3; axis++) {
+      float value = vertices[i].pos[axis];
+      bounds.min[axis] = i == 0 ? value : std::min(bounds.min[axis], value);
+      bounds.max[axis] = i == 0 ? value : std::max(bounds.max[axis], value);
+    }
+  }
 }
@@ -2,52 +2,77 @@
 #define TOXENGINE_ENGINE_RTXMODEL_H_
 
 #include "AccelerationStructure.h"
-#include "Buffer.h"
+#include "AssetCache.h"
 #include "Context.h"
 #include "Face.h"
-#include "Vertex.h"
+
+#include <vulkan/vulkan.h>
 
 #include <cstdint>
 #include <memory>
+#include <string>
 #include <vector>
 
+// A mesh of the ray traced scene. Its geometry stays on the host until the
+// scene has copied it into shared buffers and its blas is built, the blas
+// is referenced by every instance of the mesh. On a warm start the
+// geometry is read straight from the mapped cache.
 class RTXModel {
+public:
   struct Vertex {
     float pos[3];
   };
-public:
+
   RTXModel(Context &context, const std::string path);
 
   uint32_t getIndexCount() const { return nbIndices; }
   uint32_t getVertexCount() const { return nbVertices; }
   uint32_t getFaceCount() const { return nbFaces; }
+  const AssetCache::Bounds &getBounds() const { return bounds; }
 
-  std::vector<uint32_t> indices;
-  std::unique_ptr<Buffer> indexBuffer;
-  
-  std::vector<Vertex> vertices;
-  std::unique_ptr<Buffer> vertexBuffer;
+  // valid until release()
+  const Vertex *getVertices() const;
+  const uint32_t *getIndices() const;
+  const Face *getFaces() const;
 
-  std::vector<Face> faces;
-  std::unique_ptr<Buffer> faceBuffer;
+  // queues the blas build over the mesh's part of the shared buffers, does
+  // nothing when the blas was restored from its cache
+  void createBLAS(VkDeviceAddress vertexAddress, VkDeviceAddress indexAddress);
+  // frees the host geometry once the blas is built
+  void release();
+
+  // bindless slots of the shared buffers holding the mesh and its offsets
+  // in them
+  uint32_t vertexBuffer = 0;
+  uint32_t indexBuffer = 0;
+  uint32_t faceBuffer = 0;
+  uint32_t firstVertex = 0;
+  uint32_t firstIndex = 0;
+  uint32_t firstFace = 0;
 
   std::unique_ptr<AccelerationStructure> BLAS;
-  std::unique_ptr<AccelerationStructure> TLAS;
 
 private:
-  void createVertexBuffer();
-  void createIndexBuffer();
-  void createFaceBuffer();
-
   Context &context;
-  
+
   uint32_t nbIndices;
   uint32_t nbVertices;
   uint32_t nbFaces;
-  
-  std::shared_ptr<Buffer> instancesBuffer;
+  AssetCache::Bounds bounds;
+
+  // the mapped cache of a warm start, the vectors are only filled by an
+  // import
+  std::unique_ptr<AssetCache> cache;
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+  std::vector<Face> faces;
+
+  std::string blasCachePath;
+  uint64_t blasCacheKey;
 
   void load(const std::string path);
+  void import(const std::string path,
+              std::vector<std::string> &materialFiles);
 };
 
 #endif // TOXENGINE_ENGINE_RTXMODEL_H_
@@ -1,48 +1,133 @@
 #include "Rasterizer.h"
 
 #include "Context.h"
+#include "DrawList.h"
 #include "Shader.h"
 #include "SwapChain.h"
 #include "TOXEngine.h"
 #include "Vertex.h"
 
+#include <glm/glm.hpp>
+
 #include <array>
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
+
+namespace {
+
+// largest geometric error of a lod in pixels before a finer one is used
+constexpr float MAX_SCREEN_ERROR = 1.0f;
+constexpr uint32_t CULL_GROUP_SIZE = 64;
+constexpr uint32_t REDUCE_GROUP_SIZE = 8;
+
+// matches the cull shader's push constants
+struct CullConstants {
+  glm::vec4 frustum[6];
+  glm::vec4 sphere;
+  uint32_t objectCount;
+  uint32_t lodCount;
+  float lodScale;
+  uint32_t late;
+};
+
+uint32_t previousPowerOfTwo(uint32_t value) {
+  uint32_t result = 1;
+  while (result * 2 <= value) {
+    result *= 2;
+  }
+  return result;
+}
+
+// planes of the clip volume of a projection, in the space the matrix
+// transforms from, normalized and pointing inside
+void extractFrustum(const glm::mat4 &matrix, glm::vec4 planes[6]) {
+  glm::vec4 rows[4];
+  for (int row = 0; row < 4; row++) {
+    rows[row] = glm::vec4(matrix[0][row], matrix[1][row], matrix[2][row],
+                          matrix[3][row]);
+  }
+  planes[0] = rows[3] + rows[0];
+  planes[1] = rows[3] - rows[0];
+  planes[2] = rows[3] + rows[1];
+  planes[3] = rows[3] - rows[1];
+  // depth goes from 0 to 1
+  planes[4] = rows[2];
+  planes[5] = rows[3] - rows[2];
+  for (int i = 0; i < 6; i++) {
+    planes[i] /= glm::length(glm::vec3(planes[i]));
+  }
+}
+
+} // namespace
 
 Rasterizer::Rasterizer(Context &context, TOXEngine *engine, SwapChain *swapChain)
   : context(context), engine(engine), swapChain(swapChain) {
-  createRenderPass();
+  renderPass = createRenderPass(false);
+  lateRenderPass = createRenderPass(true);
   createDescriptorSetLayout();
-  createGraphicsPipeline();
+  createPipelineLayout();
+  // one pipeline per vertex layout, models pick theirs when drawing
+  for (size_t i = 0; i < VERTEX_FORMAT_COUNT; i++) {
+    createGraphicsPipeline(static_cast<VertexFormat>(i));
+  }
+  createCullPipeline();
+  createDepthReducePipeline();
   createDepthResources();
   createUniformBuffers();
+  createDrawBuffers();
   createDescriptorPool();
 }
 
-void Rasterizer::createRenderPass() {
+Rasterizer::~Rasterizer() {
+  destroyDepthPyramid();
+  vkDestroyDescriptorPool(context.device->get(), depthReducePool, nullptr);
+  vkDestroyPipeline(context.device->get(), depthReducePipeline, nullptr);
+  vkDestroyPipelineLayout(context.device->get(), depthReducePipelineLayout,
+                          nullptr);
+  vkDestroyDescriptorSetLayout(context.device->get(), depthReduceSetLayout,
+                               nullptr);
+  vkDestroySampler(context.device->get(), depthSampler, nullptr);
+}
+
+VkRenderPass Rasterizer::createRenderPass(bool late) {
+  // the early phase clears and keeps its depth for the depth pyramid, the
+  // late phase draws on top and presents
   VkAttachmentDescription colorAttachment{};
   colorAttachment.format = swapChain->getSwapChainImageFormat();
   colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  colorAttachment.loadOp =
+      late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
   colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
   colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
   colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  colorAttachment.initialLayout =
+      late ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+           : VK_IMAGE_LAYOUT_UNDEFINED;
+  colorAttachment.finalLayout = late ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+                                     : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
   VkAttachmentDescription depthAttachment{};
   depthAttachment.format = context.physicalDevice->findSupportedFormat(
       {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT,
        VK_FORMAT_D24_UNORM_S8_UINT},
-      VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+      VK_IMAGE_TILING_OPTIMAL,
+      VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT |
+          VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
   depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-  depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachment.loadOp =
+      late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+  depthAttachment.storeOp =
+      late ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
   depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
   depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  depthAttachment.initialLayout =
+      late ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
+           : VK_IMAGE_LAYOUT_UNDEFINED;
   depthAttachment.finalLayout =
-      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+      late ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+           : VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
 
   VkAttachmentReference colorAttachmentRef{};
   colorAttachmentRef.attachment = 0;
@@ -58,16 +143,32 @@ void Rasterizer::createRenderPass() {
   subpass.pColorAttachments = &colorAttachmentRef;
   subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
-  VkSubpassDependency dependency{};
-  dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-  dependency.dstSubpass = 0;
-  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
-                            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-  dependency.srcAccessMask = 0;
-  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
-                            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
-                             VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  // both passes use the same dependencies so they stay compatible, the
+  // late pass waits on the early one and on the reduction reading depth,
+  // the reduction waits on the early pass's depth
+  std::array<VkSubpassDependency, 2> dependencies{};
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                                 VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                 VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                                  VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                                 VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                 VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[0].dstAccessMask =
+      VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
   std::array<VkAttachmentDescription, 2> attachments = {colorAttachment,
                                                         depthAttachment};
@@ -77,13 +178,15 @@ void Rasterizer::createRenderPass() {
   renderPassInfo.pAttachments = attachments.data();
   renderPassInfo.subpassCount = 1;
   renderPassInfo.pSubpasses = &subpass;
-  renderPassInfo.dependencyCount = 1;
-  renderPassInfo.pDependencies = &dependency;
+  renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+  renderPassInfo.pDependencies = dependencies.data();
 
+  VkRenderPass pass;
   if (vkCreateRenderPass(context.device->get(), &renderPassInfo, nullptr,
-                         &renderPass) != VK_SUCCESS) {
+                         &pass) != VK_SUCCESS) {
     throw std::runtime_error("failed to create render pass!");
   }
+  return pass;
 }
 
 void Rasterizer::createDescriptorSetLayout() {
@@ -92,7 +195,8 @@ void Rasterizer::createDescriptorSetLayout() {
   uboLayoutBinding.descriptorCount = 1;
   uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
   uboLayoutBinding.pImmutableSamplers = nullptr;
-  uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  uboLayoutBinding.stageFlags =
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
 
   VkDescriptorSetLayoutBinding samplerLayoutBinding{};
   samplerLayoutBinding.binding = 1;
@@ -102,8 +206,19 @@ void Rasterizer::createDescriptorSetLayout() {
   samplerLayoutBinding.pImmutableSamplers = nullptr;
   samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-  std::array<VkDescriptorSetLayoutBinding, 2> bindings = {uboLayoutBinding,
+  // the draw list's objects, the model's lods, the frame's draws, the
+  // objects' visibility, the depth pyramid and the cull counters
+  std::array<VkDescriptorSetLayoutBinding, 9> bindings = {uboLayoutBinding,
                                                           samplerLayoutBinding};
+  for (uint32_t i = 2; i < bindings.size(); i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorCount = 1;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  bindings[2].stageFlags |= VK_SHADER_STAGE_VERTEX_BIT;
+  bindings[7].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
   VkDescriptorSetLayoutCreateInfo layoutInfo{};
   layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
   layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -114,7 +229,43 @@ void Rasterizer::createDescriptorSetLayout() {
     throw std::runtime_error("failed to create descriptor set layout!");
   }
 }
-void Rasterizer::createGraphicsPipeline() {
+void Rasterizer::createPipelineLayout() {
+  VkPushConstantRange pushRange{};
+  pushRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  pushRange.offset = 0;
+  pushRange.size = sizeof(VertexDecode);
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+
+  if (vkCreatePipelineLayout(context.device->get(), &pipelineLayoutInfo,
+                             nullptr, &pipelineLayout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create pipeline layout!");
+  }
+
+  VkPushConstantRange cullRange{};
+  cullRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  cullRange.offset = 0;
+  cullRange.size = sizeof(CullConstants);
+
+  VkPipelineLayoutCreateInfo cullLayoutInfo{};
+  cullLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  cullLayoutInfo.setLayoutCount = 1;
+  cullLayoutInfo.pSetLayouts = &descriptorSetLayout;
+  cullLayoutInfo.pushConstantRangeCount = 1;
+  cullLayoutInfo.pPushConstantRanges = &cullRange;
+
+  if (vkCreatePipelineLayout(context.device->get(), &cullLayoutInfo, nullptr,
+                             &cullPipelineLayout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create cull pipeline layout!");
+  }
+}
+
+void Rasterizer::createGraphicsPipeline(VertexFormat format) {
   Shader vertexShader(context, "../resources/shaders/vert.spv");
   Shader fragmentShader(context, "../resources/shaders/frag.spv");
 
@@ -139,8 +290,17 @@ void Rasterizer::createGraphicsPipeline() {
   vertexInputInfo.sType =
       VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-  auto bindingDescription = Vertex::getBindingDescription();
-  auto attributeDescriptions = Vertex::getAttributeDescriptions();
+  VkVertexInputBindingDescription bindingDescription;
+  std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+  if (format == VertexFormat::Float32) {
+    auto attributes = Vertex::getAttributeDescriptions();
+    bindingDescription = Vertex::getBindingDescription();
+    attributeDescriptions.assign(attributes.begin(), attributes.end());
+  } else {
+    auto attributes = CompactVertex::getAttributeDescriptions(format);
+    bindingDescription = CompactVertex::getBindingDescription();
+    attributeDescriptions.assign(attributes.begin(), attributes.end());
+  }
 
   vertexInputInfo.vertexBindingDescriptionCount = 1;
   vertexInputInfo.vertexAttributeDescriptionCount =
@@ -209,16 +369,6 @@ void Rasterizer::createGraphicsPipeline() {
   dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
   dynamicState.pDynamicStates = dynamicStates.data();
 
-  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  pipelineLayoutInfo.setLayoutCount = 1;
-  pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-
-  if (vkCreatePipelineLayout(context.device->get(), &pipelineLayoutInfo,
-                             nullptr, &pipelineLayout) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create pipeline layout!");
-  }
-
   VkGraphicsPipelineCreateInfo pipelineInfo{};
   pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
   pipelineInfo.stageCount = 2;
@@ -236,19 +386,230 @@ void Rasterizer::createGraphicsPipeline() {
   pipelineInfo.subpass = 0;
   pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-  if (vkCreateGraphicsPipelines(context.device->get(), VK_NULL_HANDLE, 1,
+  if (vkCreateGraphicsPipelines(context.device->get(),
+                                context.device->getPipelineCache(), 1,
                                 &pipelineInfo, nullptr,
-                                &graphicsPipeline) != VK_SUCCESS) {
+                                &graphicsPipelines[static_cast<size_t>(
+                                    format)]) != VK_SUCCESS) {
     throw std::runtime_error("failed to create graphics pipeline!");
   }
 }
 
+void Rasterizer::createCullPipeline() {
+  Shader cullShader(context, "../resources/shaders/cull.comp.spv");
+
+  VkPipelineShaderStageCreateInfo stageInfo{};
+  stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  stageInfo.module = cullShader.get();
+  stageInfo.pName = "main";
+
+  VkComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage = stageInfo;
+  pipelineInfo.layout = cullPipelineLayout;
+
+  if (vkCreateComputePipelines(context.device->get(),
+                               context.device->getPipelineCache(), 1,
+                               &pipelineInfo, nullptr,
+                               &cullPipeline) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create cull pipeline!");
+  }
+}
+
+void Rasterizer::createDepthReducePipeline() {
+  // texelFetch ignores filtering, only the view's level matters
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+  if (vkCreateSampler(context.device->get(), &samplerInfo, nullptr,
+                      &depthSampler) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create depth sampler!");
+  }
+
+  std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+  bindings[0].binding = 0;
+  bindings[0].descriptorCount = 1;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  bindings[1].binding = 1;
+  bindings[1].descriptorCount = 1;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  if (vkCreateDescriptorSetLayout(context.device->get(), &layoutInfo, nullptr,
+                                  &depthReduceSetLayout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create depth reduce descriptor set "
+                             "layout!");
+  }
+
+  VkPushConstantRange pushRange{};
+  pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushRange.offset = 0;
+  pushRange.size = sizeof(glm::uvec2);
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &depthReduceSetLayout;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+
+  if (vkCreatePipelineLayout(context.device->get(), &pipelineLayoutInfo,
+                             nullptr,
+                             &depthReducePipelineLayout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create depth reduce pipeline "
+                             "layout!");
+  }
+
+  Shader reduceShader(context, "../resources/shaders/depthreduce.comp.spv");
+
+  VkPipelineShaderStageCreateInfo stageInfo{};
+  stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  stageInfo.module = reduceShader.get();
+  stageInfo.pName = "main";
+
+  VkComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage = stageInfo;
+  pipelineInfo.layout = depthReducePipelineLayout;
+
+  if (vkCreateComputePipelines(context.device->get(),
+                               context.device->getPipelineCache(), 1,
+                               &pipelineInfo, nullptr,
+                               &depthReducePipeline) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create depth reduce pipeline!");
+  }
+
+  // enough levels for any window a 32 bit extent can describe
+  constexpr uint32_t MAX_LEVELS = 32;
+  std::array<VkDescriptorPoolSize, 2> poolSizes{};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[0].descriptorCount = MAX_LEVELS;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  poolSizes[1].descriptorCount = MAX_LEVELS;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = MAX_LEVELS;
+
+  if (vkCreateDescriptorPool(context.device->get(), &poolInfo, nullptr,
+                             &depthReducePool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create depth reduce descriptor "
+                             "pool!");
+  }
+}
+
 void Rasterizer::createDepthResources() {
   depthImage =
       std::make_unique<Image>(context, swapChain->getWidth(),
                               swapChain->getHeight(), Image::Type::Depth);
   depthImageView = context.device->createImageView(
       depthImage->get(), depthImage->getFormat(), VK_IMAGE_ASPECT_DEPTH_BIT);
+  createDepthPyramid();
+}
+
+void Rasterizer::createDepthPyramid() {
+  // a power of two keeps every level an exact halving of the previous one
+  depthPyramidWidth = previousPowerOfTwo(swapChain->getWidth());
+  depthPyramidHeight = previousPowerOfTwo(swapChain->getHeight());
+  uint32_t levels = 1;
+  while ((std::max(depthPyramidWidth, depthPyramidHeight) >> levels) > 0) {
+    levels++;
+  }
+
+  depthPyramid =
+      std::make_unique<Image>(context, depthPyramidWidth, depthPyramidHeight,
+                              Image::Type::DepthPyramid, levels);
+  depthPyramid->transitionLayout(VK_IMAGE_LAYOUT_UNDEFINED,
+                                 VK_IMAGE_LAYOUT_GENERAL, true);
+  depthPyramidView =
+      depthPyramid->createImageView(VK_IMAGE_ASPECT_COLOR_BIT);
+  depthPyramidLevels.resize(levels);
+  for (uint32_t i = 0; i < levels; i++) {
+    depthPyramidLevels[i] = context.device->createImageView(
+        depthPyramid->get(), depthPyramid->getFormat(),
+        VK_IMAGE_ASPECT_COLOR_BIT, 1, i);
+  }
+
+  std::vector<VkDescriptorSetLayout> layouts(levels, depthReduceSetLayout);
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = depthReducePool;
+  allocInfo.descriptorSetCount = levels;
+  allocInfo.pSetLayouts = layouts.data();
+
+  depthReduceSets.resize(levels);
+  if (vkAllocateDescriptorSets(context.device->get(), &allocInfo,
+                               depthReduceSets.data()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate depth reduce descriptor "
+                             "sets!");
+  }
+
+  for (uint32_t i = 0; i < levels; i++) {
+    // level 0 reads the depth image, the others the level above
+    VkDescriptorImageInfo inputInfo{};
+    inputInfo.sampler = depthSampler;
+    inputInfo.imageView = i == 0 ? depthImageView : depthPyramidLevels[i - 1];
+    inputInfo.imageLayout =
+        i == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
+               : VK_IMAGE_LAYOUT_GENERAL;
+
+    VkDescriptorImageInfo outputInfo{};
+    outputInfo.imageView = depthPyramidLevels[i];
+    outputInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[0].dstSet = depthReduceSets[i];
+    descriptorWrites[0].dstBinding = 0;
+    descriptorWrites[0].descriptorType =
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrites[0].descriptorCount = 1;
+    descriptorWrites[0].pImageInfo = &inputInfo;
+
+    descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[1].dstSet = depthReduceSets[i];
+    descriptorWrites[1].dstBinding = 1;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    descriptorWrites[1].descriptorCount = 1;
+    descriptorWrites[1].pImageInfo = &outputInfo;
+
+    vkUpdateDescriptorSets(context.device->get(),
+                           static_cast<uint32_t>(descriptorWrites.size()),
+                           descriptorWrites.data(), 0, nullptr);
+  }
+}
+
+void Rasterizer::destroyDepthPyramid() {
+  if (depthPyramidView == VK_NULL_HANDLE) {
+    return;
+  }
+  vkResetDescriptorPool(context.device->get(), depthReducePool, 0);
+  depthReduceSets.clear();
+  for (VkImageView view : depthPyramidLevels) {
+    vkDestroyImageView(context.device->get(), view, nullptr);
+  }
+  depthPyramidLevels.clear();
+  vkDestroyImageView(context.device->get(), depthPyramidView, nullptr);
+  depthPyramidView = VK_NULL_HANDLE;
+  depthPyramid.reset();
 }
 
 void Rasterizer::createUniformBuffers() {
@@ -260,20 +621,44 @@ void Rasterizer::createUniformBuffers() {
   for (size_t i = 0; i < context.MAX_FRAMES_IN_FLIGHT; i++) {
     uniformBuffers[i] =
         std::make_unique<Buffer>(context, Buffer::Type::Uniform, bufferSize);
+    uniformBuffersMapped[i] = uniformBuffers[i]->getMapped();
+  }
+}
+
+void Rasterizer::createDrawBuffers() {
+  drawBuffers.resize(context.MAX_FRAMES_IN_FLIGHT);
+  drawCountBuffers.resize(context.MAX_FRAMES_IN_FLIGHT);
+  statsBuffers.resize(context.MAX_FRAMES_IN_FLIGHT);
 
-    vkMapMemory(context.device->get(), uniformBuffers[i]->getDeviceMemory(), 0,
-                bufferSize, 0, &uniformBuffersMapped[i]);
+  CullStats zero;
+  for (size_t i = 0; i < context.MAX_FRAMES_IN_FLIGHT; i++) {
+    drawBuffers[i] = std::make_unique<Buffer>(
+        context, Buffer::Type::Indirect,
+        sizeof(VkDrawIndexedIndirectCommand) * DrawList::MAX_OBJECTS * 2);
+    drawCountBuffers[i] = std::make_unique<Buffer>(
+        context, Buffer::Type::Indirect, sizeof(uint32_t) * 2);
+    statsBuffers[i] = std::make_unique<Buffer>(
+        context, Buffer::Type::Readback, sizeof(CullStats), &zero);
   }
+
+  // nothing was visible before the first frame, it draws everything late
+  std::vector<uint32_t> visibility(DrawList::MAX_OBJECTS, 0);
+  visibilityBuffer = std::make_unique<Buffer>(
+      context, Buffer::Type::Indirect, sizeof(uint32_t) * visibility.size(),
+      visibility.data());
 }
 
 void Rasterizer::createDescriptorPool() {
-  std::array<VkDescriptorPoolSize, 2> poolSizes{};
+  std::array<VkDescriptorPoolSize, 3> poolSizes{};
   poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
   poolSizes[0].descriptorCount =
       static_cast<uint32_t>(context.MAX_FRAMES_IN_FLIGHT);
   poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
   poolSizes[1].descriptorCount =
-      static_cast<uint32_t>(context.MAX_FRAMES_IN_FLIGHT);
+      static_cast<uint32_t>(context.MAX_FRAMES_IN_FLIGHT * 2);
+  poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[2].descriptorCount =
+      static_cast<uint32_t>(context.MAX_FRAMES_IN_FLIGHT * 6);
 
   VkDescriptorPoolCreateInfo poolInfo{};
   poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -314,7 +699,21 @@ void Rasterizer::createDescriptorSets() {
     imageInfo.imageView = engine->texture->getImageView();
     imageInfo.sampler = engine->sampler->get();
 
-    std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+    // the depth pyramid at binding 7 changes with the window
+    std::array<uint32_t, 6> storageBindings = {2, 3, 4, 5, 6, 8};
+    std::array<VkDescriptorBufferInfo, 6> storageInfos{};
+    storageInfos[0].buffer = engine->drawList->getObjects(i).get();
+    storageInfos[1].buffer = engine->model->lodBuffer->get();
+    storageInfos[2].buffer = drawBuffers[i]->get();
+    storageInfos[3].buffer = drawCountBuffers[i]->get();
+    storageInfos[4].buffer = visibilityBuffer->get();
+    storageInfos[5].buffer = statsBuffers[i]->get();
+    for (VkDescriptorBufferInfo &storageInfo : storageInfos) {
+      storageInfo.offset = 0;
+      storageInfo.range = VK_WHOLE_SIZE;
+    }
+
+    std::array<VkWriteDescriptorSet, 8> descriptorWrites{};
 
     descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     descriptorWrites[0].dstSet = descriptorSets[i];
@@ -333,10 +732,43 @@ void Rasterizer::createDescriptorSets() {
     descriptorWrites[1].descriptorCount = 1;
     descriptorWrites[1].pImageInfo = &imageInfo;
 
+    for (uint32_t j = 0; j < storageInfos.size(); j++) {
+      VkWriteDescriptorSet &write = descriptorWrites[j + 2];
+      write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.dstSet = descriptorSets[i];
+      write.dstBinding = storageBindings[j];
+      write.dstArrayElement = 0;
+      write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      write.descriptorCount = 1;
+      write.pBufferInfo = &storageInfos[j];
+    }
+
     vkUpdateDescriptorSets(context.device->get(),
                            static_cast<uint32_t>(descriptorWrites.size()),
                            descriptorWrites.data(), 0, nullptr);
   }
+
+  writeDepthPyramidDescriptors();
+}
+
+void Rasterizer::writeDepthPyramidDescriptors() {
+  VkDescriptorImageInfo imageInfo{};
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  imageInfo.imageView = depthPyramidView;
+  imageInfo.sampler = depthSampler;
+
+  for (VkDescriptorSet descriptorSet : descriptorSets) {
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = descriptorSet;
+    descriptorWrite.dstBinding = 7;
+    descriptorWrite.dstArrayElement = 0;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(context.device->get(), 1, &descriptorWrite, 0,
+                           nullptr);
+  }
 }
 
 void Rasterizer::recordCommandBuffer(VkCommandBuffer commandBuffer,
@@ -349,9 +781,127 @@ void Rasterizer::recordCommandBuffer(VkCommandBuffer commandBuffer,
     throw std::runtime_error("failed to begin recording command buffer!");
   }
 
+  engine->drawList->update(currentFrame);
+
+  // written by the last frame that used this slot, its fence was waited on
+  memcpy(&cullStats, statsBuffers[currentFrame]->getMapped(),
+         sizeof(cullStats));
+
+  vkCmdFillBuffer(commandBuffer, drawCountBuffers[currentFrame]->get(), 0,
+                  VK_WHOLE_SIZE, 0);
+  vkCmdFillBuffer(commandBuffer, statsBuffers[currentFrame]->get(), 0,
+                  VK_WHOLE_SIZE, 0);
+
+  // also orders the previous frame's visibility writes and pyramid reads
+  // before this frame's passes
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask =
+      VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+                          VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0,
+      nullptr);
+
+  recordCull(commandBuffer, currentFrame, false);
+  recordDraws(commandBuffer, imageIndex, currentFrame, false);
+
+  recordDepthReduce(commandBuffer);
+
+  recordCull(commandBuffer, currentFrame, true);
+  recordDraws(commandBuffer, imageIndex, currentFrame, true);
+
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr,
+                       0, nullptr);
+
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record command buffer!");
+  }
+}
+
+void Rasterizer::recordCull(VkCommandBuffer commandBuffer,
+                            uint32_t currentFrame, bool late) {
+  const Model &model = *engine->model;
+  const UniformBufferObject &ubo =
+      *static_cast<const UniformBufferObject *>(
+          uniformBuffersMapped[currentFrame]);
+
+  CullConstants constants{};
+  extractFrustum(ubo.proj * ubo.view * ubo.model, constants.frustum);
+  const AssetCache::Bounds &bounds = model.getBounds();
+  glm::vec3 min(bounds.min[0], bounds.min[1], bounds.min[2]);
+  glm::vec3 max(bounds.max[0], bounds.max[1], bounds.max[2]);
+  constants.sphere =
+      glm::vec4((min + max) * 0.5f, glm::length(max - min) * 0.5f);
+  constants.objectCount = engine->drawList->getCount();
+  constants.lodCount = model.getLodCount();
+  constants.lodScale = std::abs(ubo.proj[1][1]) * swapChain->getHeight() *
+                       0.5f / MAX_SCREEN_ERROR;
+  constants.late = late ? 1 : 0;
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    cullPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          cullPipelineLayout, 0, 1,
+                          &descriptorSets[currentFrame], 0, nullptr);
+  vkCmdPushConstants(commandBuffer, cullPipelineLayout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+                     &constants);
+  vkCmdDispatch(commandBuffer,
+                (constants.objectCount + CULL_GROUP_SIZE - 1) /
+                    CULL_GROUP_SIZE,
+                1, 1);
+
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+}
+
+void Rasterizer::recordDepthReduce(VkCommandBuffer commandBuffer) {
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    depthReducePipeline);
+
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  // the render pass made the depth visible, each level waits on the last
+  for (uint32_t i = 0; i < depthReduceSets.size(); i++) {
+    glm::uvec2 size(std::max(depthPyramidWidth >> i, 1u),
+                    std::max(depthPyramidHeight >> i, 1u));
+
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            depthReducePipelineLayout, 0, 1,
+                            &depthReduceSets[i], 0, nullptr);
+    vkCmdPushConstants(commandBuffer, depthReducePipelineLayout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(size), &size);
+    vkCmdDispatch(commandBuffer,
+                  (size.x + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE,
+                  (size.y + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE, 1);
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
+  }
+}
+
+void Rasterizer::recordDraws(VkCommandBuffer commandBuffer,
+                             uint32_t imageIndex, uint32_t currentFrame,
+                             bool late) {
   VkRenderPassBeginInfo renderPassInfo{};
   renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-  renderPassInfo.renderPass = renderPass;
+  renderPassInfo.renderPass = late ? lateRenderPass : renderPass;
   renderPassInfo.framebuffer = swapChain->getFramebuffer(imageIndex);
   renderPassInfo.renderArea.offset = {0, 0};
   renderPassInfo.renderArea.extent = swapChain->getExtent();
@@ -366,8 +916,11 @@ void Rasterizer::recordCommandBuffer(VkCommandBuffer commandBuffer,
   vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
                        VK_SUBPASS_CONTENTS_INLINE);
 
-  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                    graphicsPipeline);
+  const Model &model = *engine->model;
+
+  vkCmdBindPipeline(
+      commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+      graphicsPipelines[static_cast<size_t>(model.getVertexFormat())]);
 
   VkViewport viewport{};
   viewport.x = 0.0f;
@@ -383,28 +936,33 @@ void Rasterizer::recordCommandBuffer(VkCommandBuffer commandBuffer,
   scissor.extent = swapChain->getExtent();
   vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-  VkBuffer vertexBuffers[] = {engine->model->vertexBuffer->get()};
+  VkBuffer vertexBuffers[] = {model.vertexBuffer->get()};
   VkDeviceSize offsets[] = {0};
   vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
 
-  vkCmdBindIndexBuffer(commandBuffer, engine->model->indexBuffer->get(), 0,
-                       VK_INDEX_TYPE_UINT32);
+  vkCmdBindIndexBuffer(commandBuffer, model.indexBuffer->get(), 0,
+                       model.getIndexType());
 
   vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
                           pipelineLayout, 0, 1, &descriptorSets[currentFrame],
                           0, nullptr);
 
-  vkCmdDrawIndexed(commandBuffer,
-                   static_cast<uint32_t>(engine->model->indices.size()), 1, 0,
-                   0, 0);
+  vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+                     0, sizeof(VertexDecode), &model.getDecode());
 
-  vkCmdEndRenderPass(commandBuffer);
+  uint32_t phase = late ? 1 : 0;
+  vkCmdDrawIndexedIndirectCountKHR(
+      commandBuffer, drawBuffers[currentFrame]->get(),
+      sizeof(VkDrawIndexedIndirectCommand) * DrawList::MAX_OBJECTS * phase,
+      drawCountBuffers[currentFrame]->get(), sizeof(uint32_t) * phase,
+      engine->drawList->getCount(), sizeof(VkDrawIndexedIndirectCommand));
 
-  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-    throw std::runtime_error("failed to record command buffer!");
-  }
+  vkCmdEndRenderPass(commandBuffer);
 }
 
 void Rasterizer::refresh() {
+  destroyDepthPyramid();
   createDepthResources();
+  // the sets only exist once the app's assets are loaded
+  writeDepthPyramidDescriptors();
 }
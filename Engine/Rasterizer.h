@@ -4,26 +4,46 @@
 #include "Buffer.h"
 #include "Context.h"
 #include "Image.h"
+#include "Vertex.h"
 
 #include <cstdint>
 #include <vulkan/vulkan.h>
 
+#include <array>
 #include <memory>
 #include <vector>
 
+class Model;
 class TOXEngine;
 class SwapChain;
 
+// Draws the draw list in two phases. The early phase draws the objects
+// visible last frame, a depth pyramid is reduced from its depth, and the
+// late phase draws the objects the pyramid no longer hides.
 class Rasterizer {
 public:
+  // late pass counters of the last frame read back
+  struct CullStats {
+    // objects inside the frustum tested against the depth pyramid
+    uint32_t objectsTested = 0;
+    // tested objects left undrawn
+    uint32_t objectsCulled = 0;
+    uint32_t trianglesSaved = 0;
+  };
+
   Rasterizer(Context &context, TOXEngine *engine, SwapChain *swapChain);
+  ~Rasterizer();
 
+  // clears the attachments, the late phase's pass loads them and is
+  // compatible with the same framebuffers
   VkRenderPass renderPass;
+  VkRenderPass lateRenderPass;
   VkDescriptorSetLayout descriptorSetLayout;
   VkPipelineLayout pipelineLayout;
-  VkPipeline graphicsPipeline;
+  std::array<VkPipeline, VERTEX_FORMAT_COUNT> graphicsPipelines;
+  VkPipelineLayout cullPipelineLayout;
+  VkPipeline cullPipeline;
 
-  VkDeviceMemory depthImageMemory;
   VkImageView depthImageView;
 
   std::vector<void *> uniformBuffersMapped;
@@ -36,6 +56,8 @@ public:
 
   void refresh();
 
+  const CullStats &getCullStats() const { return cullStats; }
+
 private:
   Context &context;
   TOXEngine *engine;
@@ -43,16 +65,51 @@ private:
 
   std::unique_ptr<Image> depthImage;
 
+  std::unique_ptr<Image> depthPyramid;
+  uint32_t depthPyramidWidth;
+  uint32_t depthPyramidHeight;
+  // all levels for the cull pass and one per level for the reduction
+  VkImageView depthPyramidView = VK_NULL_HANDLE;
+  std::vector<VkImageView> depthPyramidLevels;
+  VkSampler depthSampler;
+  VkDescriptorSetLayout depthReduceSetLayout;
+  VkPipelineLayout depthReducePipelineLayout;
+  VkPipeline depthReducePipeline;
+  VkDescriptorPool depthReducePool;
+  // one per pyramid level
+  std::vector<VkDescriptorSet> depthReduceSets;
+
   std::vector<std::unique_ptr<Buffer>> uniformBuffers;
+  // per frame in flight, written by the cull pass, the late phase's draws
+  // and count follow the early phase's
+  std::vector<std::unique_ptr<Buffer>> drawBuffers;
+  std::vector<std::unique_ptr<Buffer>> drawCountBuffers;
+  std::vector<std::unique_ptr<Buffer>> statsBuffers;
+  // one flag per object, shared by all frames
+  std::unique_ptr<Buffer> visibilityBuffer;
+  CullStats cullStats;
 
   std::vector<VkDescriptorSet> descriptorSets;
 
-  void createRenderPass();
+  VkRenderPass createRenderPass(bool late);
   void createDescriptorSetLayout();
-  void createGraphicsPipeline();
+  void createPipelineLayout();
+  void createGraphicsPipeline(VertexFormat format);
+  void createCullPipeline();
+  void createDepthReducePipeline();
   void createDepthResources();
+  void createDepthPyramid();
+  void destroyDepthPyramid();
+  void writeDepthPyramidDescriptors();
   void createUniformBuffers();
+  void createDrawBuffers();
   void createDescriptorPool();
+
+  void recordCull(VkCommandBuffer commandBuffer, uint32_t currentFrame,
+                  bool late);
+  void recordDepthReduce(VkCommandBuffer commandBuffer);
+  void recordDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex,
+                   uint32_t currentFrame, bool late);
 };
 
 #endif // TOXENGINE_ENGINE_RASTERIZER_H_
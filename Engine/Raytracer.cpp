@@ -2,20 +2,24 @@
 
 #include "Context.h"
 #include "Shader.h"
+#include "Stats.h"
 #include "SwapChain.h"
 #include "TOXEngine.h"
+#include "ThreadPool.h"
 
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstdint>
+#include <iostream>
 #include <stdexcept>
 
 Raytracer::Raytracer(Context &context, TOXEngine *engine, SwapChain *swapChain)
     : context(context), engine(engine), swapChain(swapChain) {
   createDescriptorSetLayout();
-  createUniformBuffer();
+  createUniformBuffers();
   createDescriptorPool();
   createPipeline();
-  createShaderBindingTable();
 }
 
 void Raytracer::createDescriptorSetLayout() {
@@ -34,38 +38,24 @@ void Raytracer::createDescriptorSetLayout() {
   storageImageLayoutBinding.pImmutableSamplers = nullptr;
   storageImageLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
 
-  VkDescriptorSetLayoutBinding vertexBinding{};
-  vertexBinding.binding = 2;
-  vertexBinding.descriptorCount = 1;
-  vertexBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-  vertexBinding.pImmutableSamplers = nullptr;
-  vertexBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
-
-  VkDescriptorSetLayoutBinding indexBinding{};
-  indexBinding.binding = 3;
-  indexBinding.descriptorCount = 1;
-  indexBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-  indexBinding.pImmutableSamplers = nullptr;
-  indexBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
-
-  VkDescriptorSetLayoutBinding faceBinding{};
-  faceBinding.binding = 4;
-  faceBinding.descriptorCount = 1;
-  faceBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-  faceBinding.pImmutableSamplers = nullptr;
-  faceBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
-
   VkDescriptorSetLayoutBinding uniformBinding{};
   uniformBinding.binding = 5;
   uniformBinding.descriptorCount = 1;
-  uniformBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  uniformBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
   uniformBinding.pImmutableSamplers = nullptr;
   uniformBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
 
-  std::array<VkDescriptorSetLayoutBinding, 6> bindings = {
-      asLayoutBinding, storageImageLayoutBinding,
-      vertexBinding,   indexBinding,
-      faceBinding,     uniformBinding};
+  VkDescriptorSetLayoutBinding instanceBinding{};
+  instanceBinding.binding = 6;
+  instanceBinding.descriptorCount = 1;
+  instanceBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  instanceBinding.pImmutableSamplers = nullptr;
+  instanceBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
+
+  // meshes are read through the bindless table in set 1
+  std::array<VkDescriptorSetLayoutBinding, 4> bindings = {
+      asLayoutBinding, storageImageLayoutBinding, uniformBinding,
+      instanceBinding};
 
   VkDescriptorSetLayoutCreateInfo layoutInfo{};
   layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -79,38 +69,29 @@ void Raytracer::createDescriptorSetLayout() {
 }
 
 void Raytracer::createDescriptorPool() {
-  std::array<VkDescriptorPoolSize, 6> poolSizes{};
+  std::array<VkDescriptorPoolSize, 4> poolSizes{};
   poolSizes[0].type = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
-  poolSizes[0].descriptorCount = 1; // maybe MAX_FRAMES_IN_FLIGHT
+  poolSizes[0].descriptorCount = 1;
   poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
   poolSizes[1].descriptorCount = 1;
   poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
   poolSizes[2].descriptorCount = 1;
-  poolSizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[3].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
   poolSizes[3].descriptorCount = 1;
-  poolSizes[4].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-  poolSizes[4].descriptorCount = 1;
-  poolSizes[5].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  poolSizes[5].descriptorCount = 1;
 
   VkDescriptorPoolCreateInfo poolInfo{};
   poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
   poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
   poolInfo.pPoolSizes = poolSizes.data();
-  poolInfo.maxSets = 1; // --
+  poolInfo.maxSets = 1;
 
   if (vkCreateDescriptorPool(context.device->get(), &poolInfo, nullptr,
                              &descriptorPool) != VK_SUCCESS) {
     throw std::runtime_error("failed to create RT descriptor pool!");
   }
 }
-void Raytracer::createDescriptorSet() {
-  outputImage = std::make_unique<Image>(context, swapChain->getWidth(),
-                                          swapChain->getHeight(),
-                                          Image::Type::RTOutputImage);
-  outputImage->transitionLayout(VK_IMAGE_LAYOUT_UNDEFINED,
-                                  VK_IMAGE_LAYOUT_GENERAL, true);
-  outputImageView = outputImage->createImageView(VK_IMAGE_ASPECT_COLOR_BIT);
+void Raytracer::createDescriptorSets() {
+  createOutputImage();
 
   VkDescriptorSetAllocateInfo allocInfo{};
   allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
@@ -120,10 +101,11 @@ void Raytracer::createDescriptorSet() {
 
   if (vkAllocateDescriptorSets(context.device->get(), &allocInfo,
                                &descriptorSet) != VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate RT descriptor sets!");
+    throw std::runtime_error("failed to allocate RT descriptor set!");
   }
 
-  VkAccelerationStructureKHR tlas = engine->rtx_model->TLAS->accel;
+  Scene &scene = *engine->scene;
+  VkAccelerationStructureKHR tlas = scene.getTLAS();
 
   VkWriteDescriptorSetAccelerationStructureKHR descASInfo{};
   descASInfo.sType =
@@ -131,27 +113,16 @@ void Raytracer::createDescriptorSet() {
   descASInfo.accelerationStructureCount = 1;
   descASInfo.pAccelerationStructures = &tlas;
 
-  VkDescriptorImageInfo imageInfo{};
-  imageInfo.imageView = outputImageView;
-  imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-
-  VkDescriptorBufferInfo vertexBufferInfo{};
-  vertexBufferInfo.buffer = engine->rtx_model->vertexBuffer->get();
-  vertexBufferInfo.range = VK_WHOLE_SIZE;
-
-  VkDescriptorBufferInfo indexBufferInfo{};
-  indexBufferInfo.buffer = engine->rtx_model->indexBuffer->get();
-  indexBufferInfo.range = VK_WHOLE_SIZE;
-
-  VkDescriptorBufferInfo faceBufferInfo{};
-  faceBufferInfo.buffer = engine->rtx_model->faceBuffer->get();
-  faceBufferInfo.range = VK_WHOLE_SIZE;
-
+  // each frame in flight picks its camera with a dynamic offset
   VkDescriptorBufferInfo uniformBufferInfo{};
   uniformBufferInfo.buffer = uniformBuffer->get();
   uniformBufferInfo.range = sizeof(RTUniformBufferObject);
 
-  std::array<VkWriteDescriptorSet, 6> descriptorWrites{};
+  VkDescriptorBufferInfo instanceTableInfo{};
+  instanceTableInfo.buffer = scene.getInstanceTable().get();
+  instanceTableInfo.range = VK_WHOLE_SIZE;
+
+  std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
 
   descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
   descriptorWrites[0].dstSet = descriptorSet;
@@ -164,68 +135,89 @@ void Raytracer::createDescriptorSet() {
 
   descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
   descriptorWrites[1].dstSet = descriptorSet;
-  descriptorWrites[1].dstBinding = 1;
+  descriptorWrites[1].dstBinding = 5;
   descriptorWrites[1].dstArrayElement = 0;
-  descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  descriptorWrites[1].descriptorType =
+      VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
   descriptorWrites[1].descriptorCount = 1;
-  descriptorWrites[1].pImageInfo = &imageInfo;
+  descriptorWrites[1].pBufferInfo = &uniformBufferInfo;
 
   descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
   descriptorWrites[2].dstSet = descriptorSet;
-  descriptorWrites[2].dstBinding = 2;
+  descriptorWrites[2].dstBinding = 6;
   descriptorWrites[2].dstArrayElement = 0;
   descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
   descriptorWrites[2].descriptorCount = 1;
-  descriptorWrites[2].pBufferInfo = &vertexBufferInfo;
-
-  descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  descriptorWrites[3].dstSet = descriptorSet;
-  descriptorWrites[3].dstBinding = 3;
-  descriptorWrites[3].dstArrayElement = 0;
-  descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-  descriptorWrites[3].descriptorCount = 1;
-  descriptorWrites[3].pBufferInfo = &indexBufferInfo;
-
-  descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  descriptorWrites[4].dstSet = descriptorSet;
-  descriptorWrites[4].dstBinding = 4;
-  descriptorWrites[4].dstArrayElement = 0;
-  descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-  descriptorWrites[4].descriptorCount = 1;
-  descriptorWrites[4].pBufferInfo = &faceBufferInfo;
-
-  descriptorWrites[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  descriptorWrites[5].dstSet = descriptorSet;
-  descriptorWrites[5].dstBinding = 5;
-  descriptorWrites[5].dstArrayElement = 0;
-  descriptorWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  descriptorWrites[5].descriptorCount = 1;
-  descriptorWrites[5].pBufferInfo = &uniformBufferInfo;
+  descriptorWrites[2].pBufferInfo = &instanceTableInfo;
 
   vkUpdateDescriptorSets(context.device->get(),
                          static_cast<uint32_t>(descriptorWrites.size()),
                          descriptorWrites.data(), 0, nullptr);
+
+  writeOutputImage();
+}
+
+void Raytracer::refresh() {
+  createOutputImage();
+  writeOutputImage();
+  standingFrames = 0;
+}
+
+void Raytracer::createOutputImage() {
+  outputImage = std::make_unique<Image>(context, swapChain->getWidth(),
+                                        swapChain->getHeight(),
+                                        Image::Type::RTOutputImage);
+  outputImage->transitionLayout(VK_IMAGE_LAYOUT_UNDEFINED,
+                                VK_IMAGE_LAYOUT_GENERAL, true);
+  outputImageView = outputImage->createImageView(VK_IMAGE_ASPECT_COLOR_BIT);
+}
+
+void Raytracer::writeOutputImage() {
+  VkDescriptorImageInfo imageInfo{};
+  imageInfo.imageView = outputImageView;
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+  // only rewritten after the device went idle
+  VkWriteDescriptorSet descriptorWrite{};
+  descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrite.dstSet = descriptorSet;
+  descriptorWrite.dstBinding = 1;
+  descriptorWrite.dstArrayElement = 0;
+  descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  descriptorWrite.descriptorCount = 1;
+  descriptorWrite.pImageInfo = &imageInfo;
+
+  vkUpdateDescriptorSets(context.device->get(), 1, &descriptorWrite, 0,
+                         nullptr);
 }
 
 void Raytracer::createPipeline() {
+  pending = std::make_unique<PendingPipeline>();
+  if (enableStats) {
+    pending->start = std::chrono::high_resolution_clock::now();
+  }
+
   enum StageIndices { eRaygen, eMiss, eClosestHit, eShaderGroupCount };
-  std::array<VkPipelineShaderStageCreateInfo, eShaderGroupCount> stages{};
+  auto &stages = pending->stages;
   VkPipelineShaderStageCreateInfo stage{};
   stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
   stage.pName = "main";
   // Raygen
-  Shader raygen(context, "../resources/shaders/raytrace.rgen.spv");
-  stage.module = raygen.get();
+  pending->shaders.push_back(std::make_unique<Shader>(
+      context, "../resources/shaders/raytrace.rgen.spv"));
+  stage.module = pending->shaders.back()->get();
   stage.stage = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
   stages[eRaygen] = stage;
   // Miss
-  Shader miss(context, "../resources/shaders/raytrace.rmiss.spv");
-  stage.module = miss.get();
+  pending->shaders.push_back(std::make_unique<Shader>(
+      context, "../resources/shaders/raytrace.rmiss.spv"));
+  stage.module = pending->shaders.back()->get();
   stage.stage = VK_SHADER_STAGE_MISS_BIT_KHR;
   stages[eMiss] = stage;
   // Closest Hit
-  Shader chit(context, "../resources/shaders/raytrace.rchit.spv");
-  stage.module = chit.get();
+  pending->shaders.push_back(std::make_unique<Shader>(
+      context, "../resources/shaders/raytrace.rchit.spv"));
+  stage.module = pending->shaders.back()->get();
   stage.stage = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
   stages[eClosestHit] = stage;
 
@@ -260,15 +252,18 @@ void Raytracer::createPipeline() {
   VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
   pipelineLayoutCreateInfo.sType =
       VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  pipelineLayoutCreateInfo.setLayoutCount = 1;
-  pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+  std::array<VkDescriptorSetLayout, 2> setLayouts = {
+      descriptorSetLayout, context.device->getBindlessTable().getLayout()};
+  pipelineLayoutCreateInfo.setLayoutCount =
+      static_cast<uint32_t>(setLayouts.size());
+  pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
   pipelineLayoutCreateInfo.pushConstantRangeCount = pushRanges.size();
   pipelineLayoutCreateInfo.pPushConstantRanges = pushRanges.data();
 
   vkCreatePipelineLayout(context.device->get(), &pipelineLayoutCreateInfo,
                          nullptr, &pipelineLayout);
 
-  VkRayTracingPipelineCreateInfoKHR rayPipelineInfo{};
+  VkRayTracingPipelineCreateInfoKHR &rayPipelineInfo = pending->createInfo;
   rayPipelineInfo.sType =
       VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR;
   rayPipelineInfo.stageCount = static_cast<uint32_t>(stages.size());
@@ -278,8 +273,48 @@ void Raytracer::createPipeline() {
   rayPipelineInfo.maxPipelineRayRecursionDepth = 2;
   rayPipelineInfo.layout = pipelineLayout;
 
-  vkCreateRayTracingPipelinesKHR(context.device->get(), {}, {}, 1,
-                                 &rayPipelineInfo, nullptr, &pipeline);
+  pending->operation =
+      std::make_unique<DeferredOperation>(context.device->get());
+  VkResult result = vkCreateRayTracingPipelinesKHR(
+      context.device->get(), pending->operation->get(),
+      context.device->getPipelineCache(), 1, &rayPipelineInfo, nullptr,
+      &pipeline);
+  // leave part of the pool to the asset loading that runs meanwhile
+  pending->operation->start(result,
+                            std::max(ThreadPool::shared().size() / 2, 1u));
+}
+
+void Raytracer::finishPipeline() {
+  if (!pending) {
+    return;
+  }
+
+  std::chrono::high_resolution_clock::time_point waitStart;
+  if (enableStats) {
+    waitStart = std::chrono::high_resolution_clock::now();
+  }
+  VkResult result = pending->operation->wait();
+  auto start = pending->start;
+  pending.reset();
+
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to create ray tracing pipeline!");
+  }
+  if (enableStats) {
+    auto end = std::chrono::high_resolution_clock::now();
+    float milliseconds =
+        std::chrono::duration<float, std::chrono::milliseconds::period>(
+            end - start)
+            .count();
+    float waited =
+        std::chrono::duration<float, std::chrono::milliseconds::period>(
+            end - waitStart)
+            .count();
+    std::cout << "created ray tracing pipeline in " << milliseconds
+              << " ms, waited " << waited << " ms for it" << std::endl;
+  }
+
+  createShaderBindingTable();
 }
 
 void Raytracer::createShaderBindingTable() {
@@ -331,27 +366,47 @@ void Raytracer::createShaderBindingTable() {
   hitRegion.stride = stride;
 }
 
-void Raytracer::createUniformBuffer() {
-  VkDeviceSize bufferSize = sizeof(RTUniformBufferObject);
-
-  uniformBuffer =
-      std::make_unique<Buffer>(context, Buffer::Type::Uniform, bufferSize);
-
-  vkMapMemory(context.device->get(), uniformBuffer->getDeviceMemory(), 0,
-              bufferSize, 0, &uniformBufferMapped);
+void Raytracer::createUniformBuffers() {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(context.physicalDevice->get(), &properties);
+  VkDeviceSize alignment =
+      properties.limits.minUniformBufferOffsetAlignment;
+  uniformStride = (sizeof(RTUniformBufferObject) + alignment - 1) &
+                  ~(alignment - 1);
+
+  uniformBuffer = std::make_unique<Buffer>(
+      context, Buffer::Type::Uniform,
+      uniformStride * context.MAX_FRAMES_IN_FLIGHT);
+
+  uniformBuffersMapped.resize(context.MAX_FRAMES_IN_FLIGHT);
+  for (size_t i = 0; i < context.MAX_FRAMES_IN_FLIGHT; i++) {
+    uniformBuffersMapped[i] =
+        static_cast<uint8_t *>(uniformBuffer->getMapped()) + uniformStride * i;
+  }
 }
 
-void Raytracer::recordCommandBuffer(const VkCommandBuffer &commandBuffer) {
+void Raytracer::recordCommandBuffer(VkCommandBuffer commandBuffer,
+                                    uint32_t imageIndex,
+                                    uint32_t currentFrame) {
   VkCommandBufferBeginInfo beginInfo{};
   beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
   if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
     throw std::runtime_error("failed to begin recording command buffer!");
   }
+  // moved instances invalidate the accumulated samples
+  if (engine->scene->update(commandBuffer, currentFrame)) {
+    standingFrames = 0;
+  }
   vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
                     pipeline);
+  std::array<VkDescriptorSet, 2> sets = {
+      descriptorSet, context.device->getBindlessTable().get()};
+  uint32_t uniformOffset = static_cast<uint32_t>(uniformStride * currentFrame);
   vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
-                          pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+                          pipelineLayout, 0,
+                          static_cast<uint32_t>(sets.size()), sets.data(), 1,
+                          &uniformOffset);
   vkCmdPushConstants(commandBuffer, pipelineLayout,
                      VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0, sizeof(int), &frame);
   if (context.camera.getHasMoved()) {
@@ -363,12 +418,11 @@ void Raytracer::recordCommandBuffer(const VkCommandBuffer &commandBuffer) {
   vkCmdTraceRaysKHR(commandBuffer, &raygenRegion, &missRegion, &hitRegion,
                     &callRegion, swapChain->getWidth(), swapChain->getHeight(),
                     2);
-  swapChain->copyToBackImage(*outputImage);
+  swapChain->copyToBackImage(commandBuffer, *outputImage, imageIndex);
 
   if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
     throw std::runtime_error("failed to record command buffer!");
   }
-  context.device->waitIdle();
   frame++;
   standingFrames++;
 }
@@ -3,10 +3,14 @@
 
 #include "Buffer.h"
 #include "Context.h"
+#include "DeferredOperation.h"
 #include "Image.h"
+#include "Shader.h"
 
 #include <vulkan/vulkan.h>
 
+#include <array>
+#include <chrono>
 #include <memory>
 #include <vector>
 
@@ -17,15 +21,21 @@ class Raytracer {
 public:
   Raytracer(Context &context, TOXEngine *engine, SwapChain *swapChain);
 
-  void createDescriptorSet();
-  void recordCommandBuffer(const VkCommandBuffer &commandBuffer);
+  // blocks until the pipeline started by the constructor is compiled
+  void finishPipeline();
+  void createDescriptorSets();
+  void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex,
+                           uint32_t currentFrame);
+
+  // recreates the output image at the current swap chain size
+  void refresh();
 
   VkDescriptorPool descriptorPool;
   VkDescriptorSetLayout descriptorSetLayout;
 
   VkImageView outputImageView;
 
-  void *uniformBufferMapped;
+  std::vector<void *> uniformBuffersMapped;
 
   VkPipelineLayout pipelineLayout;
   VkPipeline pipeline;
@@ -35,20 +45,38 @@ private:
   void createDescriptorPool();
   void createPipeline();
   void createShaderBindingTable();
-  void createUniformBuffer();
+  void createUniformBuffers();
+  void createOutputImage();
+  void writeOutputImage();
 
   Context &context;
   TOXEngine *engine;
   SwapChain *swapChain;
 
+  // set 0, set 1 is the device's bindless table
   VkDescriptorSet descriptorSet;
 
+  // accumulates over frames so all frames in flight share it, barriers
+  // order their traces on the gpu
   std::unique_ptr<Image> outputImage;
 
+  // one camera per frame in flight, uniformStride apart
   std::unique_ptr<Buffer> uniformBuffer;
+  VkDeviceSize uniformStride;
 
   std::vector<VkRayTracingShaderGroupCreateInfoKHR> shaderGroups;
 
+  // a pipeline compiling on pool workers, everything the create info
+  // points to has to outlive the operation
+  struct PendingPipeline {
+    std::vector<std::unique_ptr<Shader>> shaders;
+    std::array<VkPipelineShaderStageCreateInfo, 3> stages{};
+    VkRayTracingPipelineCreateInfoKHR createInfo{};
+    std::unique_ptr<DeferredOperation> operation;
+    std::chrono::high_resolution_clock::time_point start;
+  };
+  std::unique_ptr<PendingPipeline> pending;
+
   std::unique_ptr<Buffer> raygenSBT;
   std::unique_ptr<Buffer> missSBT;
   std::unique_ptr<Buffer> hitSBT;
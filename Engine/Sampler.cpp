@@ -20,6 +20,9 @@ Sampler::Sampler(Context &context) : context(context) {
   samplerInfo.compareEnable = VK_FALSE;
   samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
   samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+  samplerInfo.mipLodBias = 0.0f;
 
   if (vkCreateSampler(context.device->get(), &samplerInfo, nullptr, &sampler) !=
       VK_SUCCESS) {
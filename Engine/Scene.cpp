@@ -0,0 +1,364 @@
+#include "Scene.h"
+
+#include "Context.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// glm is column major, the instance transform is a row major 3x4
+VkTransformMatrixKHR toTransformMatrix(const glm::mat4 &transform) {
+  VkTransformMatrixKHR matrix;
+  for (int row = 0; row < 3; row++) {
+    for (int column = 0; column < 4; column++) {
+      matrix.matrix[row][column] = transform[column][row];
+    }
+  }
+  return matrix;
+}
+
+// world space box around the transformed model space bounds
+void worldBounds(const AssetCache::Bounds &bounds, const glm::mat4 &transform,
+                 glm::vec3 &min, glm::vec3 &max) {
+  for (int corner = 0; corner < 8; corner++) {
+    glm::vec4 point(corner & 1 ? bounds.max[0] : bounds.min[0],
+                    corner & 2 ? bounds.max[1] : bounds.min[1],
+                    corner & 4 ? bounds.max[2] : bounds.min[2], 1.0f);
+    glm::vec3 world = glm::vec3(transform * point);
+    min = corner == 0 ? world : glm::min(min, world);
+    max = corner == 0 ? world : glm::max(max, world);
+  }
+}
+
+glm::vec3 worldCenter(const AssetCache::Bounds &bounds,
+                      const glm::mat4 &transform) {
+  glm::vec3 min, max;
+  worldBounds(bounds, transform, min, max);
+  return (min + max) * 0.5f;
+}
+
+} // namespace
+
+Scene::Scene(Context &context) : context(context) {
+  VkPhysicalDeviceAccelerationStructurePropertiesKHR asProperties{};
+  asProperties.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+  VkPhysicalDeviceProperties2 properties{};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &asProperties;
+  vkGetPhysicalDeviceProperties2(context.physicalDevice->get(), &properties);
+  VkDeviceSize scratchAlignment = std::max<VkDeviceSize>(
+      asProperties.minAccelerationStructureScratchOffsetAlignment, 1);
+
+  // one per frame in flight so the host never writes instances a frame
+  // still being built reads
+  for (size_t i = 0; i < context.MAX_FRAMES_IN_FLIGHT; i++) {
+    instanceBuffers.push_back(std::make_unique<Buffer>(
+        context, Buffer::Type::AccelInput,
+        sizeof(VkAccelerationStructureInstanceKHR) * MAX_INSTANCES));
+  }
+
+  // sized for every instance up front, the tlas handle written to the
+  // descriptor sets never changes
+  VkAccelerationStructureGeometryKHR instanceGeometry = geometry(0);
+  VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo{};
+  buildGeometryInfo.sType =
+      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+  buildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+  buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+  buildGeometryInfo.flags =
+      VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+      VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+  buildGeometryInfo.geometryCount = 1;
+  buildGeometryInfo.pGeometries = &instanceGeometry;
+
+  uint32_t maxInstances = MAX_INSTANCES;
+  VkAccelerationStructureBuildSizesInfoKHR buildSizesInfo{};
+  buildSizesInfo.sType =
+      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+  vkGetAccelerationStructureBuildSizesKHR(
+      context.device->get(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+      &buildGeometryInfo, &maxInstances, &buildSizesInfo);
+
+  tlas.reset(new AccelerationStructure(
+      context, VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+      buildSizesInfo.accelerationStructureSize));
+
+  // builds and refits are ordered by barriers and share one scratch buffer
+  VkDeviceSize scratchSize = std::max(buildSizesInfo.buildScratchSize,
+                                      buildSizesInfo.updateScratchSize);
+  scratch = std::make_unique<Buffer>(context, Buffer::Type::Scratch,
+                                     scratchSize + scratchAlignment);
+  scratchAddress = alignUp(scratch->getDeviceAddress(), scratchAlignment);
+
+  // entries never change once written, frames in flight can keep reading
+  // while new instances are added
+  instanceTable = std::make_unique<Buffer>(
+      context, Buffer::Type::Instance, sizeof(InstanceInfo) * MAX_INSTANCES);
+}
+
+Scene::~Scene() {}
+
+uint32_t Scene::addMesh(const std::string &path) {
+  auto mesh = std::make_unique<RTXModel>(context, path);
+  mesh->firstVertex = vertexCount;
+  mesh->firstIndex = indexCount;
+  mesh->firstFace = faceCount;
+  vertexCount += mesh->getVertexCount();
+  indexCount += mesh->getIndexCount();
+  faceCount += mesh->getFaceCount();
+
+  meshes.push_back(std::move(mesh));
+  return static_cast<uint32_t>(meshes.size() - 1);
+}
+
+uint32_t Scene::addInstance(uint32_t mesh, const glm::mat4 &transform) {
+  if (instances.size() >= MAX_INSTANCES) {
+    throw std::runtime_error("failed to add instance, scene is full!");
+  }
+  uint32_t index = static_cast<uint32_t>(instances.size());
+
+  Instance instance;
+  instance.mesh = mesh;
+  instance.transform = transform;
+  instance.builtCenter =
+      worldCenter(meshes.at(mesh)->getBounds(), transform);
+  instances.push_back(instance);
+
+  VkAccelerationStructureInstanceKHR asInstance{};
+  asInstance.transform = toTransformMatrix(transform);
+  asInstance.instanceCustomIndex = index;
+  asInstance.mask = 0xFF;
+  asInstance.instanceShaderBindingTableRecordOffset = 0;
+  asInstance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+  // a null blas reference keeps the instance inactive until its mesh is
+  // uploaded
+  instanceData.push_back(asInstance);
+
+  if (mesh < uploadedMeshes) {
+    writeInstance(index);
+  }
+
+  structureChanged = true;
+  return index;
+}
+
+void Scene::upload() {
+  if (uploadedMeshes == meshes.size()) {
+    return;
+  }
+  BindlessTable &bindless = context.device->getBindlessTable();
+
+  // at least one element each, empty meshes still get valid slots
+  auto vertexBuffer = std::make_unique<Buffer>(
+      context, Buffer::Type::Vertex,
+      sizeof(RTXModel::Vertex) * std::max(vertexCount, 1u));
+  auto indexBuffer = std::make_unique<Buffer>(
+      context, Buffer::Type::Index,
+      sizeof(uint32_t) * std::max(indexCount, 1u));
+  auto faceBuffer = std::make_unique<Buffer>(
+      context, Buffer::Type::Face, sizeof(Face) * std::max(faceCount, 1u));
+  uint32_t vertexSlot = bindless.addBuffer(vertexBuffer->get());
+  uint32_t indexSlot = bindless.addBuffer(indexBuffer->get());
+  uint32_t faceSlot = bindless.addBuffer(faceBuffer->get());
+
+  for (size_t i = uploadedMeshes; i < meshes.size(); i++) {
+    RTXModel &mesh = *meshes[i];
+    mesh.vertexBuffer = vertexSlot;
+    mesh.indexBuffer = indexSlot;
+    mesh.faceBuffer = faceSlot;
+
+    VkDeviceSize vertexOffset = sizeof(RTXModel::Vertex) * mesh.firstVertex;
+    VkDeviceSize indexOffset = sizeof(uint32_t) * mesh.firstIndex;
+    if (mesh.getVertexCount() > 0) {
+      vertexBuffer->upload(mesh.getVertices(),
+                           sizeof(RTXModel::Vertex) * mesh.getVertexCount(),
+                           vertexOffset);
+    }
+    if (mesh.getIndexCount() > 0) {
+      indexBuffer->upload(mesh.getIndices(),
+                          sizeof(uint32_t) * mesh.getIndexCount(),
+                          indexOffset);
+    }
+    if (mesh.getFaceCount() > 0) {
+      faceBuffer->upload(mesh.getFaces(),
+                         sizeof(Face) * mesh.getFaceCount(),
+                         sizeof(Face) * mesh.firstFace);
+    }
+    mesh.createBLAS(vertexBuffer->getDeviceAddress() + vertexOffset,
+                    indexBuffer->getDeviceAddress() + indexOffset);
+  }
+
+  // host builds are done and compacted before the builder saves them
+  for (size_t i = uploadedMeshes; i < meshes.size(); i++) {
+    meshes[i]->BLAS->wait();
+  }
+  context.device->getAccelerationStructureBuilder().build();
+
+  for (size_t i = uploadedMeshes; i < meshes.size(); i++) {
+    meshes[i]->release();
+  }
+  size_t firstMesh = uploadedMeshes;
+  uploadedMeshes = meshes.size();
+  for (uint32_t i = 0; i < instances.size(); i++) {
+    if (instances[i].mesh >= firstMesh) {
+      writeInstance(i);
+    }
+  }
+
+  if (enableStats) {
+    std::cout << "scene: uploaded " << meshes.size() - firstMesh
+              << " meshes with "
+              << (sizeof(RTXModel::Vertex) * vertexCount +
+                  sizeof(uint32_t) * indexCount + sizeof(Face) * faceCount) /
+                     1024
+              << " KB of geometry, " << instances.size() << " instances"
+              << std::endl;
+  }
+
+  vertexCount = 0;
+  indexCount = 0;
+  faceCount = 0;
+  geometryBuffers.push_back(std::move(vertexBuffer));
+  geometryBuffers.push_back(std::move(indexBuffer));
+  geometryBuffers.push_back(std::move(faceBuffer));
+}
+
+void Scene::writeInstance(uint32_t instance) {
+  RTXModel &mesh = *meshes[instances[instance].mesh];
+
+  InstanceInfo info{};
+  info.indexBuffer = mesh.indexBuffer;
+  info.vertexBuffer = mesh.vertexBuffer;
+  info.faceBuffer = mesh.faceBuffer;
+  info.firstIndex = mesh.firstIndex;
+  info.firstVertex = mesh.firstVertex;
+  info.firstFace = mesh.firstFace;
+  instanceTable->upload(&info, sizeof(info), sizeof(info) * instance);
+
+  instanceData[instance].accelerationStructureReference =
+      mesh.BLAS->getDeviceAddress();
+}
+
+void Scene::setTransform(uint32_t instance, const glm::mat4 &transform) {
+  Instance &target = instances.at(instance);
+  target.transform = transform;
+  instanceData[instance].transform = toTransformMatrix(transform);
+
+  const AssetCache::Bounds &bounds = meshes[target.mesh]->getBounds();
+  float displacement =
+      glm::length(worldCenter(bounds, transform) - target.builtCenter);
+  maxDisplacement = std::max(maxDisplacement, displacement);
+  transformsChanged = true;
+}
+
+bool Scene::update(VkCommandBuffer commandBuffer, uint32_t currentFrame) {
+  if (built && !structureChanged && !transformsChanged) {
+    return false;
+  }
+
+  // the frame's fence was waited on, nothing reads this buffer anymore
+  memcpy(instanceBuffers[currentFrame]->getMapped(), instanceData.data(),
+         sizeof(VkAccelerationStructureInstanceKHR) * instanceData.size());
+
+  bool rebuild = needsRebuild();
+
+  VkAccelerationStructureGeometryKHR instanceGeometry = geometry(currentFrame);
+  VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo{};
+  buildGeometryInfo.sType =
+      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+  buildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+  buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+  if (!rebuild) {
+    buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+    buildGeometryInfo.srcAccelerationStructure = tlas->accel;
+  }
+  buildGeometryInfo.flags =
+      VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+      VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+  buildGeometryInfo.geometryCount = 1;
+  buildGeometryInfo.pGeometries = &instanceGeometry;
+  buildGeometryInfo.dstAccelerationStructure = tlas->accel;
+  buildGeometryInfo.scratchData.deviceAddress = scratchAddress;
+
+  VkAccelerationStructureBuildRangeInfoKHR range{};
+  range.primitiveCount = static_cast<uint32_t>(instanceData.size());
+  const VkAccelerationStructureBuildRangeInfoKHR *p_range = &range;
+
+  // earlier frames may still trace against the tlas or use the scratch
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+  barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+                          VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+          VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+      VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier,
+      0, nullptr, 0, nullptr);
+
+  vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildGeometryInfo,
+                                      &p_range);
+
+  barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+  barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+  vkCmdPipelineBarrier(
+      commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &barrier, 0,
+      nullptr, 0, nullptr);
+
+  if (rebuild) {
+    glm::vec3 min, max;
+    for (size_t i = 0; i < instances.size(); i++) {
+      glm::vec3 instanceMin, instanceMax;
+      worldBounds(meshes[instances[i].mesh]->getBounds(),
+                  instances[i].transform, instanceMin, instanceMax);
+      min = i == 0 ? instanceMin : glm::min(min, instanceMin);
+      max = i == 0 ? instanceMax : glm::max(max, instanceMax);
+      instances[i].builtCenter = (instanceMin + instanceMax) * 0.5f;
+    }
+    extent = instances.empty() ? 0.0f : glm::length(max - min);
+    maxDisplacement = 0.0f;
+    refits = 0;
+  } else {
+    refits++;
+  }
+
+  built = true;
+  structureChanged = false;
+  transformsChanged = false;
+  return true;
+}
+
+VkAccelerationStructureGeometryKHR Scene::geometry(uint32_t currentFrame) {
+  VkAccelerationStructureGeometryInstancesDataKHR instancesData{};
+  instancesData.sType =
+      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+  instancesData.arrayOfPointers = false;
+  instancesData.data.deviceAddress =
+      instanceBuffers[currentFrame]->getDeviceAddress();
+
+  VkAccelerationStructureGeometryKHR instanceGeometry{};
+  instanceGeometry.sType =
+      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+  instanceGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+  instanceGeometry.geometry.instances = instancesData;
+  instanceGeometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+  return instanceGeometry;
+}
+
+// a refit keeps the tree's topology, the boxes of instances that moved far
+// overlap more and more and tracing slows down
+bool Scene::needsRebuild() {
+  return !built || structureChanged || refits >= REBUILD_INTERVAL ||
+         maxDisplacement > REBUILD_DISPLACEMENT * extent;
+}
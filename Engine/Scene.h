@@ -0,0 +1,119 @@
+#ifndef TOXENGINE_ENGINE_SCENE_H_
+#define TOXENGINE_ENGINE_SCENE_H_
+
+#include "AccelerationStructure.h"
+#include "Buffer.h"
+#include "RTXModel.h"
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Context;
+
+// The ray traced scene. Meshes are uploaded in batches, each batch into
+// one vertex, index and face buffer registered in the bindless table, and
+// every mesh gets one blas any number of instances reference. An
+// instance's custom index points into the instance table, which holds the
+// bindless slots of its mesh's buffers and its offsets in them. Neither
+// adding meshes nor instances touches a bound descriptor.
+//
+// The tlas over all instances is updated in the frame's command buffer,
+// each frame in flight has its own persistently mapped instance buffer.
+// When only transforms changed the tlas is refitted, it is rebuilt when
+// instances are added, after REBUILD_INTERVAL refits or when an instance
+// moved so far that the refitted boxes have likely grown loose.
+class Scene {
+public:
+  static constexpr uint32_t MAX_INSTANCES = 1 << 14;
+  static constexpr uint32_t REBUILD_INTERVAL = 120;
+  // largest move since the last build as a fraction of the scene extent
+  static constexpr float REBUILD_DISPLACEMENT = 0.25f;
+
+  explicit Scene(Context &context);
+  ~Scene();
+
+  Scene(const Scene &) = delete;
+  Scene &operator=(const Scene &) = delete;
+
+  // returns the mesh index, the mesh can be instanced right away and is
+  // traced after the next upload()
+  uint32_t addMesh(const std::string &path);
+  // returns the instance index
+  uint32_t addInstance(uint32_t mesh, const glm::mat4 &transform);
+  void setTransform(uint32_t instance, const glm::mat4 &transform);
+
+  // uploads the meshes added since the last call into new shared buffers
+  // and builds their blases
+  void upload();
+
+  // records the build or refit needed for this frame, returns whether the
+  // scene changed since the last call
+  bool update(VkCommandBuffer commandBuffer, uint32_t currentFrame);
+
+  // stays the same for the scene's lifetime
+  VkAccelerationStructureKHR getTLAS() { return tlas->accel; }
+
+  Buffer &getInstanceTable() { return *instanceTable; }
+
+private:
+  // matches the closest hit shader's instance table
+  struct InstanceInfo {
+    uint32_t indexBuffer;
+    uint32_t vertexBuffer;
+    uint32_t faceBuffer;
+    uint32_t reserved0;
+    uint32_t firstIndex;
+    uint32_t firstVertex;
+    uint32_t firstFace;
+    uint32_t reserved1;
+  };
+
+  struct Instance {
+    uint32_t mesh;
+    glm::mat4 transform;
+    // center of the world bounds at the last full build
+    glm::vec3 builtCenter;
+  };
+
+  Context &context;
+
+  std::vector<std::unique_ptr<RTXModel>> meshes;
+  // meshes before this one are uploaded
+  size_t uploadedMeshes = 0;
+  // sizes of the next batch
+  uint32_t vertexCount = 0;
+  uint32_t indexCount = 0;
+  uint32_t faceCount = 0;
+
+  std::vector<std::unique_ptr<Buffer>> geometryBuffers;
+  std::unique_ptr<Buffer> instanceTable;
+
+  std::vector<Instance> instances;
+  std::vector<VkAccelerationStructureInstanceKHR> instanceData;
+  std::vector<std::unique_ptr<Buffer>> instanceBuffers;
+
+  std::unique_ptr<AccelerationStructure> tlas;
+  std::unique_ptr<Buffer> scratch;
+  VkDeviceAddress scratchAddress;
+
+  bool built = false;
+  bool structureChanged = false;
+  bool transformsChanged = false;
+  uint32_t refits = 0;
+  // diagonal of the instances' world bounds at the last full build
+  float extent = 0.0f;
+  float maxDisplacement = 0.0f;
+
+  // table entry and blas reference, once the instance's mesh is uploaded
+  void writeInstance(uint32_t instance);
+  VkAccelerationStructureGeometryKHR geometry(uint32_t currentFrame);
+  bool needsRebuild();
+};
+
+#endif // TOXENGINE_ENGINE_SCENE_H_
@@ -0,0 +1,13 @@
+#ifndef TOXENGINE_ENGINE_STATS_H_
+#define TOXENGINE_ENGINE_STATS_H_
+
+// Load and startup statistics (welded vertices, build and upload totals,
+// cache hits, ...) are printed only in builds configured with
+// -DTOXENGINE_STATS=ON, the default build prints nothing but the fps.
+#ifdef TOXENGINE_STATS
+constexpr bool enableStats = true;
+#else
+constexpr bool enableStats = false;
+#endif
+
+#endif // TOXENGINE_ENGINE_STATS_H_
@@ -29,6 +29,8 @@ SwapChain::SwapChain(Context &context, TOXEngine *engine)
 }
 
 SwapChain::~SwapChain() {
+  // a pipeline still compiling uses the device
+  raytracer->finishPipeline();
   cleanup();
 
   vkDestroyPipeline(context.device->get(), raytracer->pipeline, nullptr);
@@ -41,11 +43,17 @@ SwapChain::~SwapChain() {
   vkDestroyDescriptorSetLayout(context.device->get(),
                                raytracer->descriptorSetLayout, nullptr);
 
-  vkDestroyPipeline(context.device->get(), rasterizer->graphicsPipeline,
-                    nullptr);
+  for (VkPipeline pipeline : rasterizer->graphicsPipelines) {
+    vkDestroyPipeline(context.device->get(), pipeline, nullptr);
+  }
   vkDestroyPipelineLayout(context.device->get(), rasterizer->pipelineLayout,
                           nullptr);
+  vkDestroyPipeline(context.device->get(), rasterizer->cullPipeline, nullptr);
+  vkDestroyPipelineLayout(context.device->get(),
+                          rasterizer->cullPipelineLayout, nullptr);
   vkDestroyRenderPass(context.device->get(), rasterizer->renderPass, nullptr);
+  vkDestroyRenderPass(context.device->get(), rasterizer->lateRenderPass,
+                      nullptr);
 
   vkDestroyDescriptorPool(context.device->get(), rasterizer->descriptorPool,
                           nullptr);
@@ -53,9 +61,8 @@ SwapChain::~SwapChain() {
   vkDestroyDescriptorSetLayout(context.device->get(),
                                rasterizer->descriptorSetLayout, nullptr);
 
+  destroyRenderFinishedSemaphores();
   for (size_t i = 0; i < context.MAX_FRAMES_IN_FLIGHT; i++) {
-    vkDestroySemaphore(context.device->get(), renderFinishedSemaphores[i],
-                       nullptr);
     vkDestroySemaphore(context.device->get(), imageAvailableSemaphores[i],
                        nullptr);
     vkDestroyFence(context.device->get(), inFlightFences[i], nullptr);
@@ -129,7 +136,6 @@ void SwapChain::cleanup() {
 
   vkDestroyImageView(context.device->get(), rasterizer->depthImageView,
                      nullptr);
-  vkFreeMemory(context.device->get(), rasterizer->depthImageMemory, nullptr);
 
   for (auto framebuffer : swapChainFramebuffers) {
     vkDestroyFramebuffer(context.device->get(), framebuffer, nullptr);
@@ -157,7 +163,13 @@ void SwapChain::recreate() {
   create();
   createImageViews();
   rasterizer->refresh();
+  raytracer->refresh();
   createFramebuffers();
+
+  if (renderFinishedSemaphores.size() != swapChainImages.size()) {
+    destroyRenderFinishedSemaphores();
+    createRenderFinishedSemaphores();
+  }
 }
 
 void SwapChain::createImageViews() {
@@ -192,9 +204,9 @@ void SwapChain::createFramebuffers() {
   }
 }
 
-void SwapChain::copyToBackImage(Image &image) {
-  VkCommandBuffer commandBuffer = commandBuffers[currentFrame];
-  VkImage backImage = swapChainImages[currentFrame];
+void SwapChain::copyToBackImage(VkCommandBuffer commandBuffer, Image &image,
+                                uint32_t imageIndex) {
+  VkImage backImage = swapChainImages[imageIndex];
   image.transitionLayout(VK_IMAGE_LAYOUT_GENERAL,
                          VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, commandBuffer,
                          true);
@@ -204,7 +216,7 @@ void SwapChain::copyToBackImage(Image &image) {
   context.device->copyImage(image.get(), backImage, swapChainExtent,
                             commandBuffer);
   image.transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                         VK_IMAGE_LAYOUT_GENERAL, true);
+                         VK_IMAGE_LAYOUT_GENERAL, commandBuffer, true);
   context.device->transitionImageLayout(
       backImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
       VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, commandBuffer, true);
@@ -299,7 +311,7 @@ void SwapChain::drawFrame() {
   rtUbo.view = context.camera.GetViewMatrix();
   rtUbo.proj = context.camera.GetProjectionMatrix(
       static_cast<float>(getWidth()), static_cast<float>(getHeight()));
-  memcpy(raytracer->uniformBufferMapped, &rtUbo, sizeof(rtUbo));
+  memcpy(raytracer->uniformBuffersMapped[currentFrame], &rtUbo, sizeof(rtUbo));
 
   engine->app.update(engine, rasterizer->uniformBuffersMapped[currentFrame],
                      getWidth(), getHeight());
@@ -309,7 +321,8 @@ void SwapChain::drawFrame() {
   vkResetCommandBuffer(commandBuffers[currentFrame],
                        /*VkCommandBufferResetFlagBits*/ 0);
   if (useRaytracer) {
-    raytracer->recordCommandBuffer(commandBuffers[currentFrame]);
+    raytracer->recordCommandBuffer(commandBuffers[currentFrame], imageIndex,
+                                   currentFrame);
   } else {
     rasterizer->recordCommandBuffer(commandBuffers[currentFrame], imageIndex,
                                     currentFrame);
@@ -318,17 +331,30 @@ void SwapChain::drawFrame() {
   VkSubmitInfo submitInfo{};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-  VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
+  // uploads may still be running on the transfer queue, frames only wait
+  // for them on the gpu
+  UploadManager &uploader = context.device->getUploader();
+  VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame],
+                                  uploader.getSemaphore()};
   VkPipelineStageFlags waitStages[] = {
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  submitInfo.waitSemaphoreCount = 1;
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_PIPELINE_STAGE_ALL_COMMANDS_BIT};
+  uint64_t waitValues[] = {0, uploader.getSubmittedValue()};
+
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.waitSemaphoreValueCount = 2;
+  timelineInfo.pWaitSemaphoreValues = waitValues;
+
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.waitSemaphoreCount = 2;
   submitInfo.pWaitSemaphores = waitSemaphores;
   submitInfo.pWaitDstStageMask = waitStages;
 
   submitInfo.commandBufferCount = 1;
   submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
 
-  VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
+  VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[imageIndex]};
   submitInfo.signalSemaphoreCount = 1;
   submitInfo.pSignalSemaphores = signalSemaphores;
 
@@ -359,14 +385,11 @@ void SwapChain::drawFrame() {
     throw std::runtime_error("failed to present swap chain image!");
   }
 
-  vkQueueWaitIdle(context.device->getPresentQueue());
-
   currentFrame = (currentFrame + 1) % context.MAX_FRAMES_IN_FLIGHT;
 }
 
 void SwapChain::createSyncObjects() {
   imageAvailableSemaphores.resize(context.MAX_FRAMES_IN_FLIGHT);
-  renderFinishedSemaphores.resize(context.MAX_FRAMES_IN_FLIGHT);
   inFlightFences.resize(context.MAX_FRAMES_IN_FLIGHT);
 
   VkSemaphoreCreateInfo semaphoreInfo{};
@@ -379,17 +402,41 @@ void SwapChain::createSyncObjects() {
   for (size_t i = 0; i < context.MAX_FRAMES_IN_FLIGHT; i++) {
     if (vkCreateSemaphore(context.device->get(), &semaphoreInfo, nullptr,
                           &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-        vkCreateSemaphore(context.device->get(), &semaphoreInfo, nullptr,
-                          &renderFinishedSemaphores[i]) != VK_SUCCESS ||
         vkCreateFence(context.device->get(), &fenceInfo, nullptr,
                       &inFlightFences[i]) != VK_SUCCESS) {
       throw std::runtime_error(
           "failed to create synchronization objects for a frame!");
     }
   }
+
+  createRenderFinishedSemaphores();
+}
+
+void SwapChain::createRenderFinishedSemaphores() {
+  renderFinishedSemaphores.resize(swapChainImages.size());
+
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+  for (size_t i = 0; i < renderFinishedSemaphores.size(); i++) {
+    if (vkCreateSemaphore(context.device->get(), &semaphoreInfo, nullptr,
+                          &renderFinishedSemaphores[i]) != VK_SUCCESS) {
+      throw std::runtime_error(
+          "failed to create synchronization objects for an image!");
+    }
+  }
+}
+
+void SwapChain::destroyRenderFinishedSemaphores() {
+  for (VkSemaphore semaphore : renderFinishedSemaphores) {
+    vkDestroySemaphore(context.device->get(), semaphore, nullptr);
+  }
+  renderFinishedSemaphores.clear();
 }
 
 void SwapChain::refresh() {
+  // compiled while the app loaded its assets
+  raytracer->finishPipeline();
   rasterizer->createDescriptorSets();
-  raytracer->createDescriptorSet();
+  raytracer->createDescriptorSets();
 }
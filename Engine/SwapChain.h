@@ -23,7 +23,8 @@ public:
 
   void refresh();
   void drawFrame();
-  void copyToBackImage(Image &image);
+  void copyToBackImage(VkCommandBuffer commandBuffer, Image &image,
+                       uint32_t imageIndex);
 
   VkSwapchainKHR get() { return swapChain; }
   VkExtent2D getExtent() { return swapChainExtent; }
@@ -34,6 +35,11 @@ public:
     return swapChainFramebuffers[index];
   }
 
+  // occlusion counters of the last rasterized frame read back
+  const Rasterizer::CullStats &getCullStats() {
+    return rasterizer->getCullStats();
+  }
+
   bool useRaytracer = true;
 
 private:
@@ -50,6 +56,8 @@ private:
   void createFramebuffers();
   void createCommandBuffers();
   void createSyncObjects();
+  void createRenderFinishedSemaphores();
+  void destroyRenderFinishedSemaphores();
 
   Context &context;
   TOXEngine *engine;
@@ -68,6 +76,8 @@ private:
   std::vector<VkCommandBuffer> commandBuffers;
 
   std::vector<VkSemaphore> imageAvailableSemaphores;
+  // one per swap chain image, presentation may hold on to it longer than
+  // the frame's fence tells
   std::vector<VkSemaphore> renderFinishedSemaphores;
   std::vector<VkFence> inFlightFences;
 
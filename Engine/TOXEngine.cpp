@@ -1,4 +1,5 @@
 #include "TOXEngine.h"
+#include "Stats.h"
 #include "Texture.h"
 #include <memory>
 
@@ -13,7 +14,12 @@ void TOXEngine::run() {
 void TOXEngine::initVulkan() {
   swapChain = std::make_unique<SwapChain>(context, this);
   sampler = std::make_unique<Sampler>(context);
+  drawList = std::make_unique<DrawList>(context);
+  scene = std::make_unique<Scene>(context);
   app.start(this);
+  scene->upload();
+  // everything loaded by the app goes out in as few submits as possible
+  context.device->getUploader().flush();
   swapChain->refresh();
 }
 
@@ -30,6 +36,12 @@ void TOXEngine::mainLoop() {
     fps_counter++;
     if(fps_counter >= 1000) {
       std::cout << "fps: " << fps_counter / fps_accumulated << std::endl;
+      if (enableStats && !swapChain->useRaytracer) {
+        const Rasterizer::CullStats &stats = swapChain->getCullStats();
+        std::cout << "occlusion: " << stats.objectsTested << " tested, "
+                  << stats.objectsCulled << " culled, "
+                  << stats.trianglesSaved << " triangles saved" << std::endl;
+      }
       fps_counter = 0;
       fps_accumulated = 0;
     }
@@ -71,12 +83,34 @@ void TOXEngine::processInputs() {
 
 // todo vectors of models and textures -> push back
 void TOXEngine::loadModel(const std::string modelPath,
-                          const std::string texturePath) {
-  texture = std::make_unique<Texture>(context, texturePath);
-  model = std::make_unique<Model>(context, modelPath);
+                          const std::string texturePath,
+                          const ModelOptions &options) {
+  texture =
+      std::make_unique<Texture>(context, texturePath, options.textureFormat);
+  textureSlot = context.device->getBindlessTable().addTexture(
+      texture->getImageView(), sampler->get());
+  model = std::make_unique<Model>(context, modelPath, options);
 }
 
-// todo vector of models -> push back
-void TOXEngine::loadRTXModel(const std::string path) {
-  rtx_model = std::make_unique<RTXModel>(context, path);
+uint32_t TOXEngine::addModelInstance(const glm::mat4 &transform) {
+  return drawList->add(transform);
+}
+
+void TOXEngine::setModelInstanceTransform(uint32_t object,
+                                          const glm::mat4 &transform) {
+  drawList->setTransform(object, transform);
+}
+
+uint32_t TOXEngine::loadRTXModel(const std::string path) {
+  return scene->addMesh(path);
+}
+
+uint32_t TOXEngine::addRTXInstance(uint32_t rtxModel,
+                                   const glm::mat4 &transform) {
+  return scene->addInstance(rtxModel, transform);
+}
+
+void TOXEngine::setRTXInstanceTransform(uint32_t instance,
+                                        const glm::mat4 &transform) {
+  scene->setTransform(instance, transform);
 }
@@ -5,9 +5,10 @@
 
 #include "Buffer.h"
 #include "Context.h"
+#include "DrawList.h"
 #include "Model.h"
-#include "RTXModel.h"
 #include "Sampler.h"
+#include "Scene.h"
 #include "SwapChain.h"
 #include "Texture.h"
 
@@ -30,8 +31,16 @@ public:
 
   void run() override;
 
-  void loadModel(const std::string modelPath, const std::string texturePath) override;
-  void loadRTXModel(const std::string path) override;
+  void loadModel(const std::string modelPath, const std::string texturePath,
+                 const ModelOptions &options) override;
+  uint32_t loadRTXModel(const std::string path) override;
+  uint32_t addModelInstance(const glm::mat4 &transform) override;
+  void setModelInstanceTransform(uint32_t object,
+                                 const glm::mat4 &transform) override;
+  uint32_t addRTXInstance(uint32_t rtxModel,
+                          const glm::mat4 &transform) override;
+  void setRTXInstanceTransform(uint32_t instance,
+                               const glm::mat4 &transform) override;
 
   //App &app;
   Context context;
@@ -41,8 +50,12 @@ public:
   // todo these should be vectors
   std::unique_ptr<Sampler> sampler;
   std::unique_ptr<Texture> texture;
+  // the texture's slot in the device's bindless table
+  uint32_t textureSlot;
   std::unique_ptr<Model> model;
-  std::unique_ptr<RTXModel> rtx_model;
+  std::unique_ptr<DrawList> drawList;
+
+  std::unique_ptr<Scene> scene;
 
   float deltaTime;
 
@@ -1,40 +1,199 @@
 #include "Texture.h"
 
+#include "AssetCache.h"
+#include "BlockEncoder.h"
 #include "Image.h"
+#include "Ktx2.h"
 #include "PhysicalDevice.h"
+#include "Stats.h"
 #include "TOXEngine.h"
 
 #include <stb_image.h>
 
+#include <chrono>
 #include <cstring>
+#include <iostream>
+
+namespace {
+
+const char WRITER[] = "TOXEngine";
+const std::string SOURCE_KEY = "TOXEngine.source";
+
+VkFormat vulkanFormat(TextureFormat format) {
+  switch (format) {
+  case TextureFormat::Bc1:
+    return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+  case TextureFormat::Bc5:
+    return VK_FORMAT_BC5_UNORM_BLOCK;
+  case TextureFormat::Bc7:
+    return VK_FORMAT_BC7_SRGB_BLOCK;
+  default:
+    return VK_FORMAT_R8G8B8A8_SRGB;
+  }
+}
+
+const char *formatName(TextureFormat format) {
+  const char *names[] = {"rgba8", "bc1", "bc5", "bc7"};
+  return names[static_cast<int>(format)];
+}
+
+std::vector<VkBufferImageCopy>
+copyRegions(const std::vector<MipChain::Level> &levels) {
+  std::vector<VkBufferImageCopy> regions(levels.size());
+  for (size_t i = 0; i < levels.size(); i++) {
+    VkBufferImageCopy &region = regions[i];
+    region.bufferOffset = levels[i].offset;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = static_cast<uint32_t>(i);
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = {levels[i].width, levels[i].height, 1};
+  }
+  return regions;
+}
+
+} // namespace
+
+Texture::Texture(Context &context, const std::string path,
+                 TextureFormat format)
+    : context(context) {
+  std::chrono::high_resolution_clock::time_point start;
+  if (enableStats) {
+    start = std::chrono::high_resolution_clock::now();
+  }
+
+  VkFormat vkFormat = vulkanFormat(format);
+  if (format != TextureFormat::Rgba8 &&
+      !context.physicalDevice->hasFormatFeatures(
+          vkFormat, VK_IMAGE_TILING_OPTIMAL,
+          VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+              VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+    if (enableStats) {
+      std::cout << "block compressed textures are not supported, using rgba8"
+                << std::endl;
+    }
+    format = TextureFormat::Rgba8;
+    vkFormat = vulkanFormat(format);
+  }
+
+  // the ktx2 file holds the finished mip chain in the device format, a
+  // warm start uploads it without decoding or encoding anything
+  std::string ktxPath = path + "." + formatName(format) + ".ktx2";
+  {
+    Ktx2 ktx(ktxPath);
+    AssetCache::Fingerprint source;
+    size_t size = 0;
+    const void *value = ktx.isValid() ? ktx.value(SOURCE_KEY, size) : nullptr;
+    if (value && size == sizeof(source) && ktx.getFormat() == vkFormat) {
+      memcpy(&source, value, sizeof(source));
+      if (AssetCache::matches(path, source)) {
+        const std::vector<MipChain::Level> &levels = ktx.getLevels();
+        createImage(vkFormat, levels[0].width, levels[0].height,
+                    static_cast<uint32_t>(levels.size()));
+        upload(ktx.data(), ktx.size(), levels);
+        return;
+      }
+    }
+  }
 
-Texture::Texture(Context &context, const std::string path) : context(context) {
   int texWidth, texHeight, texChannels;
   stbi_uc *pixels = stbi_load(path.c_str(), &texWidth, &texHeight,
                               &texChannels, STBI_rgb_alpha);
-  VkDeviceSize imageSize = texWidth * texHeight * 4;
 
   if (!pixels) {
     throw std::runtime_error("failed to load texture image!");
   }
 
-  Buffer stagingBuffer(context, Buffer::Type::Staging, imageSize, pixels);
+  uint32_t width = static_cast<uint32_t>(texWidth);
+  uint32_t height = static_cast<uint32_t>(texHeight);
+  createImage(vkFormat, width, height, MipChain::levelCount(width, height));
 
+  // blits filter in linear space for srgb formats just like the cpu path,
+  // block compressed formats can not be blitted to
+  bool blit = format == TextureFormat::Rgba8 &&
+              context.physicalDevice->hasFormatFeatures(
+                  vkFormat, VK_IMAGE_TILING_OPTIMAL,
+                  VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+                      VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                      VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+
+  std::vector<uint8_t> data;
+  std::vector<MipChain::Level> levels;
+  if (blit) {
+    blitMipmaps(pixels, width, height, data, levels);
+  } else {
+    // two channel textures hold linear data such as normals
+    MipChain chain(pixels, width, height, format != TextureFormat::Bc5);
+    if (format == TextureFormat::Rgba8) {
+      data.swap(chain.pixels);
+      levels.swap(chain.levels);
+    } else {
+      BlockEncoder encoder(format, chain);
+      data.swap(encoder.blocks);
+      levels.swap(encoder.levels);
+    }
+    upload(data.data(), data.size(), levels);
+  }
   stbi_image_free(pixels);
 
-  image = std::make_unique<Image>(context, texWidth, texHeight,
-                                  Image::Type::Texture);
-  image->transitionLayout(VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-  image->copyBuffer(stagingBuffer.get(), static_cast<uint32_t>(texWidth),
-                    static_cast<uint32_t>(texHeight));
-  image->transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  if (enableStats) {
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "prepared " << levels.size() << " mip levels of " << path
+              << " as " << formatName(format) << " (" << data.size() / 1024
+              << " KiB) in "
+              << std::chrono::duration<float,
+                                       std::chrono::milliseconds::period>(
+                     end - start)
+                     .count()
+              << " ms" << std::endl;
+  }
 
-  imageView = image->createImageView(VK_IMAGE_ASPECT_COLOR_BIT);
-  stagingBuffer.cleanup();
+  AssetCache::Fingerprint source;
+  if (!AssetCache::fingerprint(path, source) ||
+      !Ktx2::write(ktxPath, vkFormat, levels, data.data(),
+                   {{"KTXwriter", WRITER, sizeof(WRITER)},
+                    {SOURCE_KEY, &source, sizeof(source)}})) {
+    std::cerr << "failed to write texture cache for " << path << std::endl;
+  }
 }
 
 Texture::~Texture() {
   vkDestroyImageView(context.device->get(), imageView, nullptr);
 }
+
+void Texture::createImage(VkFormat format, uint32_t width, uint32_t height,
+                          uint32_t mipLevels) {
+  image = std::make_unique<Image>(context, width, height, Image::Type::Texture,
+                                  mipLevels, format);
+  imageView = image->createImageView(VK_IMAGE_ASPECT_COLOR_BIT);
+}
+
+void Texture::upload(const void *data, size_t size,
+                     const std::vector<MipChain::Level> &levels) {
+  context.device->getUploader().upload(*image, data, size,
+                                       copyRegions(levels));
+}
+
+void Texture::blitMipmaps(const void *pixels, uint32_t width, uint32_t height,
+                          std::vector<uint8_t> &chain,
+                          std::vector<MipChain::Level> &levels) {
+  levels = MipChain::layout(width, height, 4);
+  context.device->getUploader().upload(*image, pixels, levels[0].size,
+                                       copyRegions({levels[0]}),
+                                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  context.device->getUploader().flush();
+  image->generateMipmaps(width, height);
+
+  // read the chain back once so later starts load it from the cache
+  VkDeviceSize size = levels.back().offset + levels.back().size;
+  Buffer readbackBuffer(context, Buffer::Type::Readback, size);
+  image->copyToBuffer(readbackBuffer.get(), copyRegions(levels));
+  image->transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+  chain.resize(size);
+  memcpy(chain.data(), readbackBuffer.getMapped(), size);
+}
@@ -1,16 +1,19 @@
 #ifndef TOXENGINE_ENGINE_TEXTURE_H_
 #define TOXENGINE_ENGINE_TEXTURE_H_
 
+#include "../App/ITOXEngine.h"
 #include "Image.h"
+#include "MipChain.h"
 
 #include <memory>
 #include <string>
+#include <vector>
 
 class Context;
 
 class Texture {
 public:
-  Texture(Context &context, const std::string path);
+  Texture(Context &context, const std::string path, TextureFormat format);
   ~Texture();
 
   VkImageView getImageView() { return imageView; }
@@ -20,6 +23,14 @@ private:
 
   std::unique_ptr<Image> image;
   VkImageView imageView;
+
+  void createImage(VkFormat format, uint32_t width, uint32_t height,
+                   uint32_t mipLevels);
+  void upload(const void *data, size_t size,
+              const std::vector<MipChain::Level> &levels);
+  void blitMipmaps(const void *pixels, uint32_t width, uint32_t height,
+                   std::vector<uint8_t> &chain,
+                   std::vector<MipChain::Level> &levels);
 };
 
 #endif // TOXENGINE_ENGINE_TEXTURE_H_
@@ -0,0 +1,114 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned threadCount) {
+  threadCount = std::max(threadCount, 1u);
+  for (unsigned i = 0; i < threadCount; i++) {
+    workers.emplace_back(&ThreadPool::work, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  condition.notify_all();
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+ThreadPool &ThreadPool::shared() {
+  static ThreadPool pool(std::thread::hardware_concurrency());
+  return pool;
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+  std::packaged_task<void()> packaged(std::move(task));
+  std::future<void> future = packaged.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push(std::move(packaged));
+  }
+  condition.notify_one();
+  return future;
+}
+
+void ThreadPool::parallelFor(size_t count,
+                             const std::function<void(size_t)> &fn) {
+  if (count == 0) {
+    return;
+  }
+  if (count == 1) {
+    fn(0);
+    return;
+  }
+
+  // shared so helpers that start after the loop finished stay valid
+  struct State {
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::exception_ptr error;
+    std::function<void(size_t)> fn;
+    size_t count;
+  };
+  auto state = std::make_shared<State>();
+  state->fn = fn;
+  state->count = count;
+
+  auto run = [state]() {
+    size_t i;
+    while ((i = state->next.fetch_add(1)) < state->count) {
+      try {
+        state->fn(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!state->error) {
+          state->error = std::current_exception();
+        }
+      }
+      if (state->done.fetch_add(1) + 1 == state->count) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->finished.notify_all();
+      }
+    }
+  };
+
+  size_t helpers = std::min(count - 1, workers.size());
+  for (size_t i = 0; i < helpers; i++) {
+    submit(run);
+  }
+  run();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->finished.wait(lock,
+                       [&state]() { return state->done == state->count; });
+
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+void ThreadPool::work() {
+  while (true) {
+    std::packaged_task<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+      if (stopping && tasks.empty()) {
+        return;
+      }
+      task = std::move(tasks.front());
+      tasks.pop();
+    }
+    task();
+  }
+}
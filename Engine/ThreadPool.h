@@ -0,0 +1,42 @@
+#ifndef TOXENGINE_ENGINE_THREADPOOL_H_
+#define TOXENGINE_ENGINE_THREADPOOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned threadCount);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // pool shared by the engine's CPU side work (asset import, encoding, ...)
+  static ThreadPool &shared();
+
+  unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+  std::future<void> submit(std::function<void()> task);
+
+  // runs fn(0) .. fn(count - 1) spread over the pool and blocks until all
+  // are done, the calling thread takes part so nested calls do not deadlock
+  void parallelFor(size_t count, const std::function<void(size_t)> &fn);
+
+private:
+  void work();
+
+  std::vector<std::thread> workers;
+  std::queue<std::packaged_task<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool stopping = false;
+};
+
+#endif // TOXENGINE_ENGINE_THREADPOOL_H_
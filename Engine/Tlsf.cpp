@@ -0,0 +1,198 @@
+#include "Tlsf.h"
+
+#include <algorithm>
+
+namespace {
+
+uint32_t highestBit(uint64_t value) { return 63 - __builtin_clzll(value); }
+
+uint32_t lowestBit(uint64_t value) { return __builtin_ctzll(value); }
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+} // namespace
+
+Tlsf::Tlsf(uint64_t size) : size(size - size % GRANULE) {
+  std::fill(&heads[0][0], &heads[0][0] + FL_COUNT * SL_COUNT, INVALID);
+  if (this->size > 0) {
+    insertFree(createRegion(0, this->size));
+  }
+}
+
+void Tlsf::mapping(uint64_t size, uint32_t &fl, uint32_t &sl) {
+  // sizes are at least GRANULE so fl always has SL_BITS bits below it
+  fl = highestBit(size);
+  sl = static_cast<uint32_t>(size >> (fl - SL_BITS)) & (SL_COUNT - 1);
+}
+
+uint32_t Tlsf::createRegion(uint64_t offset, uint64_t size) {
+  uint32_t id;
+  if (!spare.empty()) {
+    id = spare.back();
+    spare.pop_back();
+  } else {
+    id = static_cast<uint32_t>(regions.size());
+    regions.emplace_back();
+  }
+  regions[id] = {offset, size, INVALID, INVALID, INVALID, INVALID, false};
+  return id;
+}
+
+void Tlsf::insertFree(uint32_t id) {
+  Region &region = regions[id];
+  uint32_t fl, sl;
+  mapping(region.size, fl, sl);
+
+  region.free = true;
+  region.prevFree = INVALID;
+  region.nextFree = heads[fl][sl];
+  if (region.nextFree != INVALID) {
+    regions[region.nextFree].prevFree = id;
+  }
+  heads[fl][sl] = id;
+  flBitmap |= uint64_t(1) << fl;
+  slBitmap[fl] |= 1u << sl;
+  freeRegionCount++;
+}
+
+void Tlsf::removeFree(uint32_t id) {
+  Region &region = regions[id];
+  uint32_t fl, sl;
+  mapping(region.size, fl, sl);
+
+  if (region.prevFree != INVALID) {
+    regions[region.prevFree].nextFree = region.nextFree;
+  } else {
+    heads[fl][sl] = region.nextFree;
+  }
+  if (region.nextFree != INVALID) {
+    regions[region.nextFree].prevFree = region.prevFree;
+  }
+  if (heads[fl][sl] == INVALID) {
+    slBitmap[fl] &= ~(1u << sl);
+    if (slBitmap[fl] == 0) {
+      flBitmap &= ~(uint64_t(1) << fl);
+    }
+  }
+  region.free = false;
+  freeRegionCount--;
+}
+
+uint32_t Tlsf::findFree(uint64_t size) const {
+  // round up to the next bin so any region of the bin found is large enough
+  uint32_t fl, sl;
+  mapping(size, fl, sl);
+  uint64_t rounded = size + (uint64_t(1) << (fl - SL_BITS)) - 1;
+  if (rounded < size) {
+    return INVALID;
+  }
+  mapping(rounded, fl, sl);
+
+  uint32_t slMap = slBitmap[fl] & (~0u << sl);
+  if (slMap == 0) {
+    uint64_t flMap = fl + 1 < FL_COUNT ? flBitmap & (~uint64_t(0) << (fl + 1))
+                                       : 0;
+    if (flMap == 0) {
+      return INVALID;
+    }
+    fl = lowestBit(flMap);
+    slMap = slBitmap[fl];
+  }
+  return heads[fl][lowestBit(slMap)];
+}
+
+uint32_t Tlsf::allocate(uint64_t size, uint64_t alignment, uint64_t &offset) {
+  if (size == 0 || size > this->size) {
+    return INVALID;
+  }
+  size = alignUp(size, GRANULE);
+  alignment = std::max(alignment, GRANULE);
+
+  // larger alignments may need to skip up to alignment - GRANULE bytes
+  uint32_t id = findFree(size + alignment - GRANULE);
+  if (id == INVALID) {
+    return INVALID;
+  }
+  removeFree(id);
+
+  uint64_t aligned = alignUp(regions[id].offset, alignment);
+  if (aligned > regions[id].offset) {
+    uint64_t padding = aligned - regions[id].offset;
+    uint32_t front = createRegion(regions[id].offset, padding);
+    Region &region = regions[id];
+    regions[front].prevPhysical = region.prevPhysical;
+    regions[front].nextPhysical = id;
+    if (region.prevPhysical != INVALID) {
+      regions[region.prevPhysical].nextPhysical = front;
+    }
+    region.prevPhysical = front;
+    region.offset = aligned;
+    region.size -= padding;
+    insertFree(front);
+  }
+
+  if (regions[id].size - size >= GRANULE) {
+    uint32_t back =
+        createRegion(regions[id].offset + size, regions[id].size - size);
+    Region &region = regions[id];
+    regions[back].prevPhysical = id;
+    regions[back].nextPhysical = region.nextPhysical;
+    if (region.nextPhysical != INVALID) {
+      regions[region.nextPhysical].prevPhysical = back;
+    }
+    region.nextPhysical = back;
+    region.size = size;
+    insertFree(back);
+  }
+
+  used += regions[id].size;
+  allocationCount++;
+  offset = regions[id].offset;
+  return id;
+}
+
+void Tlsf::free(uint32_t id) {
+  used -= regions[id].size;
+  allocationCount--;
+
+  uint32_t prev = regions[id].prevPhysical;
+  if (prev != INVALID && regions[prev].free) {
+    removeFree(prev);
+    regions[prev].size += regions[id].size;
+    regions[prev].nextPhysical = regions[id].nextPhysical;
+    if (regions[id].nextPhysical != INVALID) {
+      regions[regions[id].nextPhysical].prevPhysical = prev;
+    }
+    spare.push_back(id);
+    id = prev;
+  }
+
+  uint32_t next = regions[id].nextPhysical;
+  if (next != INVALID && regions[next].free) {
+    removeFree(next);
+    regions[id].size += regions[next].size;
+    regions[id].nextPhysical = regions[next].nextPhysical;
+    if (regions[next].nextPhysical != INVALID) {
+      regions[regions[next].nextPhysical].prevPhysical = id;
+    }
+    spare.push_back(next);
+  }
+
+  insertFree(id);
+}
+
+uint64_t Tlsf::getLargestFree() const {
+  if (flBitmap == 0) {
+    return 0;
+  }
+  uint32_t fl = highestBit(flBitmap);
+  uint32_t sl = 31 - __builtin_clz(slBitmap[fl]);
+
+  uint64_t largest = 0;
+  for (uint32_t id = heads[fl][sl]; id != INVALID; id = regions[id].nextFree) {
+    largest = std::max(largest, regions[id].size);
+  }
+  return largest;
+}
@@ -0,0 +1,64 @@
+#ifndef TOXENGINE_ENGINE_TLSF_H_
+#define TOXENGINE_ENGINE_TLSF_H_
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Two level segregated fit allocator (Masmano et al. 2004) over an offset
+// range [0, size) that has no storage of its own. Free regions are binned
+// by a power of two and a linear subdivision of it, two bitmaps find a
+// large enough bin in constant time and neighbours merge on free.
+class Tlsf {
+public:
+  static constexpr uint32_t INVALID = std::numeric_limits<uint32_t>::max();
+  // smallest region, every offset is a multiple of it
+  static constexpr uint64_t GRANULE = 256;
+
+  explicit Tlsf(uint64_t size);
+
+  // alignment is a power of two, returns a region id or INVALID when no
+  // free region is large enough
+  uint32_t allocate(uint64_t size, uint64_t alignment, uint64_t &offset);
+  void free(uint32_t region);
+
+  uint64_t getSize() const { return size; }
+  uint64_t getUsed() const { return used; }
+  uint32_t getAllocationCount() const { return allocationCount; }
+  uint32_t getFreeRegionCount() const { return freeRegionCount; }
+  uint64_t getLargestFree() const;
+
+private:
+  static constexpr uint32_t SL_BITS = 5;
+  static constexpr uint32_t SL_COUNT = 1 << SL_BITS;
+  static constexpr uint32_t FL_COUNT = 64;
+
+  struct Region {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t prevPhysical;
+    uint32_t nextPhysical;
+    uint32_t prevFree;
+    uint32_t nextFree;
+    bool free;
+  };
+
+  uint64_t size;
+  uint64_t used = 0;
+  uint32_t allocationCount = 0;
+  uint32_t freeRegionCount = 0;
+
+  std::vector<Region> regions;
+  std::vector<uint32_t> spare; // recycled region ids
+  uint64_t flBitmap = 0;
+  uint32_t slBitmap[FL_COUNT] = {};
+  uint32_t heads[FL_COUNT][SL_COUNT];
+
+  static void mapping(uint64_t size, uint32_t &fl, uint32_t &sl);
+  uint32_t createRegion(uint64_t offset, uint64_t size);
+  void insertFree(uint32_t id);
+  void removeFree(uint32_t id);
+  uint32_t findFree(uint64_t size) const;
+};
+
+#endif // TOXENGINE_ENGINE_TLSF_H_
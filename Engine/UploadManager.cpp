@@ -0,0 +1,381 @@
+#include "UploadManager.h"
+
+#include "Image.h"
+#include "Stats.h"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+// covers the texel block size of every format uploaded to images
+constexpr VkDeviceSize ALIGNMENT = 16;
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+UploadManager::UploadManager(VkDevice device, MemoryAllocator &allocator,
+                             uint32_t graphicsFamily, VkQueue graphicsQueue,
+                             uint32_t transferFamily, VkQueue transferQueue)
+    : device(device), allocator(allocator), graphicsFamily(graphicsFamily),
+      transferFamily(transferFamily), graphicsQueue(graphicsQueue),
+      transferQueue(transferQueue),
+      dedicated(transferFamily != graphicsFamily) {
+  transferPool = createCommandPool(transferFamily);
+  if (dedicated) {
+    graphicsPool = createCommandPool(graphicsFamily);
+  }
+
+  VkSemaphoreTypeCreateInfo typeInfo{};
+  typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  typeInfo.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphoreInfo.pNext = &typeInfo;
+
+  if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create upload semaphore!");
+  }
+
+  ring = createStaging(RING_SIZE);
+
+  if (enableStats) {
+    std::cout << "uploads run on the "
+              << (dedicated ? "dedicated transfer" : "graphics") << " queue"
+              << std::endl;
+  }
+}
+
+UploadManager::~UploadManager() {
+  wait();
+  destroyStaging(ring);
+  vkDestroySemaphore(device, semaphore, nullptr);
+  vkDestroyCommandPool(device, transferPool, nullptr);
+  if (dedicated) {
+    vkDestroyCommandPool(device, graphicsPool, nullptr);
+  }
+}
+
+void UploadManager::upload(VkBuffer buffer, const void *data,
+                           VkDeviceSize size, VkDeviceSize offset) {
+  if (size == 0) {
+    return;
+  }
+
+  VkBufferCopy region{};
+  VkBuffer source = reserve(data, size, region.srcOffset);
+  region.dstOffset = offset;
+  region.size = size;
+  vkCmdCopyBuffer(current.commandBuffer, source, buffer, 1, &region);
+
+  if (dedicated) {
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = transferFamily;
+    barrier.dstQueueFamilyIndex = graphicsFamily;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+
+    // release, the destination access is ignored
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(current.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                         1, &barrier, 0, nullptr);
+
+    // acquire, the source access is ignored
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    vkCmdPipelineBarrier(current.graphicsCommandBuffer,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1,
+                         &barrier, 0, nullptr);
+  }
+
+  copyCount++;
+  uploadedBytes += size;
+}
+
+void UploadManager::upload(Image &image, const void *data, VkDeviceSize size,
+                           std::vector<VkBufferImageCopy> regions,
+                           VkImageLayout finalLayout) {
+  VkDeviceSize offset;
+  VkBuffer source = reserve(data, size, offset);
+  for (VkBufferImageCopy &region : regions) {
+    region.bufferOffset += offset;
+  }
+
+  image.transitionLayout(VK_IMAGE_LAYOUT_UNDEFINED,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         current.commandBuffer);
+  vkCmdCopyBufferToImage(current.commandBuffer, source, image.get(),
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         static_cast<uint32_t>(regions.size()),
+                         regions.data());
+
+  if (dedicated) {
+    // the ownership transfer does the layout transition, release and
+    // acquire have to describe it identically
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = finalLayout;
+    barrier.srcQueueFamilyIndex = transferFamily;
+    barrier.dstQueueFamilyIndex = graphicsFamily;
+    barrier.image = image.get();
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = image.getMipLevels();
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(current.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                         0, nullptr, 1, &barrier);
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT |
+        VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(current.graphicsCommandBuffer,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+  } else if (finalLayout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+    image.transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, finalLayout,
+                           current.commandBuffer);
+  }
+
+  copyCount++;
+  uploadedBytes += size;
+}
+
+VkCommandBuffer UploadManager::getCommandBuffer() {
+  begin();
+  return current.graphicsCommandBuffer;
+}
+
+void UploadManager::flush() {
+  if (!recording) {
+    return;
+  }
+
+  // orders the copies and any extra work before everything submitted to
+  // the graphics queue later
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT |
+                          VK_ACCESS_MEMORY_WRITE_BIT;
+  vkCmdPipelineBarrier(current.graphicsCommandBuffer,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+
+  submit(transferQueue, current.commandBuffer, 0);
+  if (dedicated) {
+    submit(graphicsQueue, current.graphicsCommandBuffer, value);
+  }
+
+  current.value = value;
+  current.ringEnd = head;
+  pending.push_back(std::move(current));
+  current = Batch();
+  recording = false;
+}
+
+void UploadManager::wait() {
+  flush();
+  while (!pending.empty()) {
+    retire();
+  }
+}
+
+void UploadManager::printStats() {
+  std::cout << "uploads: " << copyCount << " copies ("
+            << uploadedBytes / (1 << 20) << " MiB) in " << submitCount
+            << " submits" << std::endl;
+}
+
+VkCommandPool UploadManager::createCommandPool(uint32_t queueFamily) {
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                   VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  poolInfo.queueFamilyIndex = queueFamily;
+
+  VkCommandPool commandPool;
+  if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create upload command pool!");
+  }
+  return commandPool;
+}
+
+UploadManager::Staging UploadManager::createStaging(VkDeviceSize size) {
+  VkBufferCreateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  Staging staging;
+  if (vkCreateBuffer(device, &bufferInfo, nullptr, &staging.buffer) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create staging buffer!");
+  }
+  staging.allocation = allocator.allocate(
+      staging.buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  return staging;
+}
+
+void UploadManager::destroyStaging(Staging &staging) {
+  vkDestroyBuffer(device, staging.buffer, nullptr);
+  allocator.free(staging.allocation);
+}
+
+VkBuffer UploadManager::reserve(const void *data, VkDeviceSize size,
+                                VkDeviceSize &offset) {
+  // large uploads would stall the ring, they get their own buffer which
+  // lives until the batch completes
+  if (size > RING_SIZE / 2) {
+    begin();
+    current.temporaries.push_back(createStaging(size));
+    memcpy(current.temporaries.back().allocation.mapped, data, size);
+    offset = 0;
+    return current.temporaries.back().buffer;
+  }
+
+  // uploads never wrap around the end of the ring
+  uint64_t start = alignUp(head, ALIGNMENT);
+  if (start / RING_SIZE != (start + size - 1) / RING_SIZE) {
+    start = alignUp(start, RING_SIZE);
+  }
+  while (start + size - tail > RING_SIZE) {
+    // the space is held by the batch being recorded
+    if (pending.empty()) {
+      flush();
+    }
+    retire();
+  }
+  head = start + size;
+
+  begin();
+  offset = start % RING_SIZE;
+  memcpy(static_cast<uint8_t *>(ring.allocation.mapped) + offset, data, size);
+  return ring.buffer;
+}
+
+void UploadManager::begin() {
+  if (recording) {
+    return;
+  }
+
+  // release finished batches without waiting
+  uint64_t completed;
+  vkGetSemaphoreCounterValue(device, semaphore, &completed);
+  while (!pending.empty() && pending.front().value <= completed) {
+    retire();
+  }
+
+  if (!spare.empty()) {
+    current = std::move(spare.back());
+    spare.pop_back();
+  } else {
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = transferPool;
+    allocInfo.commandBufferCount = 1;
+    if (vkAllocateCommandBuffers(device, &allocInfo,
+                                 &current.commandBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate upload command buffer!");
+    }
+
+    current.graphicsCommandBuffer = current.commandBuffer;
+    if (dedicated) {
+      allocInfo.commandPool = graphicsPool;
+      if (vkAllocateCommandBuffers(device, &allocInfo,
+                                   &current.graphicsCommandBuffer) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate upload command buffer!");
+      }
+    }
+  }
+
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  if (vkBeginCommandBuffer(current.commandBuffer, &beginInfo) != VK_SUCCESS ||
+      (dedicated && vkBeginCommandBuffer(current.graphicsCommandBuffer,
+                                         &beginInfo) != VK_SUCCESS)) {
+    throw std::runtime_error("failed to begin upload command buffer!");
+  }
+  recording = true;
+}
+
+void UploadManager::submit(VkQueue queue, VkCommandBuffer commandBuffer,
+                           uint64_t waitValue) {
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record upload command buffer!");
+  }
+
+  uint64_t signalValue = ++value;
+  VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.waitSemaphoreValueCount = waitValue > 0 ? 1 : 0;
+  timelineInfo.pWaitSemaphoreValues = &waitValue;
+  timelineInfo.signalSemaphoreValueCount = 1;
+  timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.waitSemaphoreCount = waitValue > 0 ? 1 : 0;
+  submitInfo.pWaitSemaphores = &semaphore;
+  submitInfo.pWaitDstStageMask = &waitStage;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = &semaphore;
+
+  if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+    throw std::runtime_error("failed to submit upload command buffer!");
+  }
+  submitCount++;
+}
+
+void UploadManager::retire() {
+  Batch batch = std::move(pending.front());
+  pending.pop_front();
+
+  VkSemaphoreWaitInfo waitInfo{};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &semaphore;
+  waitInfo.pValues = &batch.value;
+  vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+
+  vkResetCommandBuffer(batch.commandBuffer, 0);
+  if (dedicated) {
+    vkResetCommandBuffer(batch.graphicsCommandBuffer, 0);
+  }
+
+  tail = batch.ringEnd;
+  for (Staging &staging : batch.temporaries) {
+    destroyStaging(staging);
+  }
+  batch.temporaries.clear();
+  spare.push_back(std::move(batch));
+}
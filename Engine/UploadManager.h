@@ -0,0 +1,117 @@
+#ifndef TOXENGINE_ENGINE_UPLOADMANAGER_H_
+#define TOXENGINE_ENGINE_UPLOADMANAGER_H_
+
+#include "MemoryAllocator.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+class Image;
+
+// Streams data to device local buffers and images through a persistently
+// mapped staging ring. Copies are recorded into one command buffer and
+// submitted together on flush, every submission signals a timeline
+// semaphore which tells when its part of the ring can be reused, so no
+// queue ever has to idle.
+//
+// With a dedicated transfer family the copies run there concurrently with
+// rendering, ownership of each resource is released to the graphics family
+// and acquired by a small submission on the graphics queue that waits for
+// the copies on the gpu. Without one everything runs on the graphics queue.
+// Either way everything recorded is visible to later graphics submissions
+// after flush, frames wait on getSemaphore() at getSubmittedValue().
+// Not thread safe, record from the loading thread only.
+class UploadManager {
+public:
+  static constexpr VkDeviceSize RING_SIZE = 32ull << 20;
+
+  UploadManager(VkDevice device, MemoryAllocator &allocator,
+                uint32_t graphicsFamily, VkQueue graphicsQueue,
+                uint32_t transferFamily, VkQueue transferQueue);
+  ~UploadManager();
+
+  UploadManager(const UploadManager &) = delete;
+  UploadManager &operator=(const UploadManager &) = delete;
+
+  void upload(VkBuffer buffer, const void *data, VkDeviceSize size,
+              VkDeviceSize offset = 0);
+  // regions are relative to data, the image goes from UNDEFINED to
+  // finalLayout which is SHADER_READ_ONLY_OPTIMAL or TRANSFER_DST_OPTIMAL
+  void upload(Image &image, const void *data, VkDeviceSize size,
+              std::vector<VkBufferImageCopy> regions,
+              VkImageLayout finalLayout =
+                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+  // graphics queue command buffer of the current batch for work that has
+  // to run after the copies recorded so far
+  VkCommandBuffer getCommandBuffer();
+  // submits the current batch without waiting for it
+  void flush();
+  // submits the current batch and waits for every batch
+  void wait();
+
+  VkSemaphore getSemaphore() { return semaphore; }
+  // reached once everything flushed so far is usable on the graphics queue
+  uint64_t getSubmittedValue() { return value; }
+  bool hasTransferQueue() { return dedicated; }
+
+  void printStats();
+
+private:
+  struct Staging {
+    VkBuffer buffer;
+    MemoryAllocator::Allocation allocation;
+  };
+
+  struct Batch {
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    // acquires ownership on the graphics queue, commandBuffer without a
+    // dedicated transfer queue
+    VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+    uint64_t value = 0;
+    uint64_t ringEnd = 0;
+    // uploads too large for the ring
+    std::vector<Staging> temporaries;
+  };
+
+  VkDevice device;
+  MemoryAllocator &allocator;
+  uint32_t graphicsFamily;
+  uint32_t transferFamily;
+  VkQueue graphicsQueue;
+  VkQueue transferQueue;
+  bool dedicated;
+  VkCommandPool transferPool;
+  VkCommandPool graphicsPool = VK_NULL_HANDLE;
+  VkSemaphore semaphore;
+  uint64_t value = 0;
+
+  Staging ring;
+  // bytes ever reserved and released, positions are taken modulo RING_SIZE
+  uint64_t head = 0;
+  uint64_t tail = 0;
+
+  Batch current;
+  bool recording = false;
+  std::deque<Batch> pending;
+  std::vector<Batch> spare;
+
+  uint64_t copyCount = 0;
+  uint64_t submitCount = 0;
+  uint64_t uploadedBytes = 0;
+
+  VkCommandPool createCommandPool(uint32_t queueFamily);
+  Staging createStaging(VkDeviceSize size);
+  void destroyStaging(Staging &staging);
+  // staging memory for size bytes and the buffer it lives in
+  VkBuffer reserve(const void *data, VkDeviceSize size, VkDeviceSize &offset);
+  void begin();
+  void submit(VkQueue queue, VkCommandBuffer commandBuffer,
+              uint64_t waitValue);
+  void retire();
+};
+
+#endif // TOXENGINE_ENGINE_UPLOADMANAGER_H_
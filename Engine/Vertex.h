@@ -1,12 +1,16 @@
 #ifndef TOXENGINE_ENGINE_VERTEX_H_
 #define TOXENGINE_ENGINE_VERTEX_H_
 
-#define GLM_ENABLE_EXPERIMENTAL
+#include "../App/ITOXEngine.h"
+
 #include <glm/glm.hpp>
-#include <glm/gtx/hash.hpp>
 #include <vulkan/vulkan.h>
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
+
+constexpr size_t VERTEX_FORMAT_COUNT = 3;
 
 struct Vertex {
   glm::vec3 pos;
@@ -50,17 +54,48 @@ struct Vertex {
   }
 };
 
-namespace std {
-  
-template <> struct hash<Vertex> {
-  size_t operator()(Vertex const &vertex) const {
-    return ((hash<glm::vec3>()(vertex.pos) ^
-             (hash<glm::vec3>()(vertex.color) << 1)) >>
-            1) ^
-           (hash<glm::vec2>()(vertex.texCoord) << 1);
+// 12 byte vertex of the 16 bit formats, positions are normalized to the mesh
+// bounds and uvs to the uv bounds
+struct CompactVertex {
+  uint16_t pos[4]; // w is padding, 3 component 16 bit vertex formats are
+                   // rarely supported
+  uint16_t texCoord[2];
+
+  static VkVertexInputBindingDescription getBindingDescription() {
+    VkVertexInputBindingDescription bindingDescription{};
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(CompactVertex);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    return bindingDescription;
+  }
+
+  static std::array<VkVertexInputAttributeDescription, 2>
+  getAttributeDescriptions(VertexFormat format) {
+    std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = format == VertexFormat::Half16
+                                          ? VK_FORMAT_R16G16B16A16_SFLOAT
+                                          : VK_FORMAT_R16G16B16A16_SNORM;
+    attributeDescriptions[0].offset = offsetof(CompactVertex, pos);
+
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 2;
+    attributeDescriptions[1].format = VK_FORMAT_R16G16_UNORM;
+    attributeDescriptions[1].offset = offsetof(CompactVertex, texCoord);
+
+    return attributeDescriptions;
   }
 };
-  
-} // namespace std
+
+// push constant mapping stored attributes back to model space,
+// pos = stored * posScale + posOffset, uv = stored * xy + zw
+struct VertexDecode {
+  alignas(16) glm::vec4 posScale;
+  alignas(16) glm::vec4 posOffset;
+  alignas(16) glm::vec4 texCoordScaleOffset;
+};
 
 #endif // TOXENGINE_ENGINE_VERTEX_H_
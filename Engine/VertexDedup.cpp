@@ -0,0 +1,175 @@
+#include "VertexDedup.h"
+
+#include "Hash.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+constexpr size_t PARALLEL_THRESHOLD = 1 << 20;
+constexpr size_t BLOCK_SIZE = 1 << 16;
+constexpr uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
+
+struct Key {
+  uint64_t hash;
+  uint32_t index;
+
+  bool operator<(const Key &other) const {
+    return hash < other.hash || (hash == other.hash && index < other.index);
+  }
+};
+
+size_t blockCount(size_t count) {
+  return (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+} // namespace
+
+VertexDedup::VertexDedup(const void *vertices, size_t count, size_t stride) {
+  if (count >= EMPTY) {
+    throw std::runtime_error("failed to deduplicate vertices, too many!");
+  }
+
+  remap.resize(count);
+  if (count >= PARALLEL_THRESHOLD && ThreadPool::shared().size() > 1) {
+    dedupSort(static_cast<const uint8_t *>(vertices), count, stride);
+  } else {
+    dedupTable(static_cast<const uint8_t *>(vertices), count, stride);
+  }
+}
+
+void VertexDedup::dedupTable(const uint8_t *vertices, size_t count,
+                             size_t stride) {
+  // linear probing, kept at most half full
+  size_t capacity = 16;
+  while (capacity < count * 2) {
+    capacity *= 2;
+  }
+  std::vector<uint32_t> table(capacity, EMPTY);
+  size_t mask = capacity - 1;
+
+  for (size_t i = 0; i < count; i++) {
+    const uint8_t *vertex = vertices + i * stride;
+    size_t slot = hash::bytes(vertex, stride) & mask;
+
+    while (true) {
+      uint32_t id = table[slot];
+      if (id == EMPTY) {
+        table[slot] = remap[i] = static_cast<uint32_t>(unique.size());
+        unique.push_back(static_cast<uint32_t>(i));
+        break;
+      }
+      if (memcmp(vertices + size_t(unique[id]) * stride, vertex, stride) ==
+          0) {
+        remap[i] = id;
+        break;
+      }
+      slot = (slot + 1) & mask;
+    }
+  }
+}
+
+void VertexDedup::dedupSort(const uint8_t *vertices, size_t count,
+                            size_t stride) {
+  ThreadPool &pool = ThreadPool::shared();
+  size_t blocks = blockCount(count);
+
+  std::vector<Key> keys(count);
+  pool.parallelFor(blocks, [&](size_t b) {
+    size_t end = std::min(count, (b + 1) * BLOCK_SIZE);
+    for (size_t i = b * BLOCK_SIZE; i < end; i++) {
+      keys[i] = {hash::bytes(vertices + i * stride, stride),
+                 static_cast<uint32_t>(i)};
+    }
+  });
+
+  // sort blocks, then merge neighbours pairwise
+  pool.parallelFor(blocks, [&](size_t b) {
+    std::sort(keys.begin() + b * BLOCK_SIZE,
+              keys.begin() + std::min(count, (b + 1) * BLOCK_SIZE));
+  });
+  for (size_t width = BLOCK_SIZE; width < count; width *= 2) {
+    size_t pairs = (count + 2 * width - 1) / (2 * width);
+    pool.parallelFor(pairs, [&](size_t p) {
+      size_t begin = p * 2 * width;
+      size_t middle = std::min(count, begin + width);
+      size_t end = std::min(count, begin + 2 * width);
+      std::inplace_merge(keys.begin() + begin, keys.begin() + middle,
+                         keys.begin() + end);
+    });
+  }
+
+  // equal vertices share a hash run sorted by index, so the first equal
+  // vertex of a run is the first occurrence
+  std::vector<uint32_t> first(count);
+  pool.parallelFor(blocks, [&](size_t b) {
+    size_t begin = b * BLOCK_SIZE;
+    size_t end = std::min(count, begin + BLOCK_SIZE);
+
+    // runs starting in the previous block are handled there
+    while (begin < end && begin > 0 &&
+           keys[begin].hash == keys[begin - 1].hash) {
+      begin++;
+    }
+
+    for (size_t run = begin; run < end;) {
+      size_t runEnd = run + 1;
+      while (runEnd < count && keys[runEnd].hash == keys[run].hash) {
+        runEnd++;
+      }
+
+      for (size_t j = run; j < runEnd; j++) {
+        uint32_t index = keys[j].index;
+        first[index] = index;
+        for (size_t k = run; k < j; k++) {
+          uint32_t other = keys[k].index;
+          if (first[other] == other &&
+              memcmp(vertices + size_t(other) * stride,
+                     vertices + size_t(index) * stride, stride) == 0) {
+            first[index] = other;
+            break;
+          }
+        }
+      }
+      run = runEnd;
+    }
+  });
+
+  // number first occurrences in input order
+  std::vector<uint32_t> blockBase(blocks + 1, 0);
+  pool.parallelFor(blocks, [&](size_t b) {
+    size_t end = std::min(count, (b + 1) * BLOCK_SIZE);
+    uint32_t uniqueCount = 0;
+    for (size_t i = b * BLOCK_SIZE; i < end; i++) {
+      uniqueCount += first[i] == i;
+    }
+    blockBase[b + 1] = uniqueCount;
+  });
+  for (size_t b = 0; b < blocks; b++) {
+    blockBase[b + 1] += blockBase[b];
+  }
+
+  unique.resize(blockBase.back());
+  pool.parallelFor(blocks, [&](size_t b) {
+    size_t end = std::min(count, (b + 1) * BLOCK_SIZE);
+    uint32_t id = blockBase[b];
+    for (size_t i = b * BLOCK_SIZE; i < end; i++) {
+      if (first[i] == i) {
+        unique[id] = static_cast<uint32_t>(i);
+        remap[i] = id++;
+      }
+    }
+  });
+  pool.parallelFor(blocks, [&](size_t b) {
+    size_t end = std::min(count, (b + 1) * BLOCK_SIZE);
+    for (size_t i = b * BLOCK_SIZE; i < end; i++) {
+      if (first[i] != i) {
+        remap[i] = remap[first[i]];
+      }
+    }
+  });
+}
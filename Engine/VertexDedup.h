@@ -0,0 +1,33 @@
+#ifndef TOXENGINE_ENGINE_VERTEXDEDUP_H_
+#define TOXENGINE_ENGINE_VERTEXDEDUP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Finds the unique vertices of a flat vertex stream. Vertices are compared
+// bytewise (XXH64 over the raw bytes) in an open-addressing table; large
+// inputs are deduplicated by sorting on the hash across the shared
+// ThreadPool instead. Both paths number unique vertices in order of their
+// first occurrence, so the result does not depend on the path taken.
+class VertexDedup {
+public:
+  VertexDedup(const void *vertices, size_t count, size_t stride);
+
+  std::vector<uint32_t> remap;  // input vertex -> unique vertex
+  std::vector<uint32_t> unique; // unique vertex -> first input vertex
+
+  template <typename T>
+  void gather(const T *vertices, std::vector<T> &out) const {
+    out.resize(unique.size());
+    for (size_t i = 0; i < unique.size(); i++) {
+      out[i] = vertices[unique[i]];
+    }
+  }
+
+private:
+  void dedupTable(const uint8_t *vertices, size_t count, size_t stride);
+  void dedupSort(const uint8_t *vertices, size_t count, size_t stride);
+};
+
+#endif // TOXENGINE_ENGINE_VERTEXDEDUP_H_
@@ -6,15 +6,28 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 proj;
 } ubo;
 
+// the draw list, the cull pass draws each object with its index as first
+// instance
+struct Object {
+    mat4 transform;
+};
+layout(binding = 2) readonly buffer Objects { Object objects[]; };
+
+// maps the stored attributes of the compact vertex formats back to model space
+layout(push_constant) uniform VertexDecode {
+    vec4 posScale;
+    vec4 posOffset;
+    vec4 texCoordScaleOffset;
+} decode;
+
 layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
 
-layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
-    fragColor = inColor;
-    fragTexCoord = inTexCoord;
+    vec3 position = inPosition * decode.posScale.xyz + decode.posOffset.xyz;
+    mat4 transform = objects[gl_InstanceIndex].transform;
+    gl_Position = ubo.proj * ubo.view * ubo.model * transform * vec4(position, 1.0);
+    fragTexCoord = inTexCoord * decode.texCoordScaleOffset.xy + decode.texCoordScaleOffset.zw;
 }
\ No newline at end of file